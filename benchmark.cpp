@@ -0,0 +1,400 @@
+#include "preprocessor.hpp"
+#include "parallel_encoder.hpp"
+#include "csv_loader.hpp"
+#include "instrumentation.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+// Stage-by-stage benchmark of the pipeline. Every stage is timed on its own
+// for each (dataset size, thread count) pair, with warmup runs discarded,
+// and the results are written as JSON for plot_results.py.
+//
+// benchmark [--input FILE] [--raw] [--sizes 1000,10000] [--threads 1,2,4,8]
+//           [--warmup N] [--reps N] [--vocab N] [--vocab-budget KB] [--out FILE]
+//           [--stop-words] [--stem] [--trace FILE]
+//
+// --vocab-budget also times the bounded-memory vocabulary build
+// ("vocab_approx") and checks it against the exact one.
+// --stop-words/--stem also time cleaning with that token normalization
+// ("clean_norm") and compare vocabulary coverage with and without it.
+// --trace additionally writes a Chrome trace of all runs (only useful
+// in a SENTIMENT_TRACE build).
+
+struct BenchmarkOptions {
+    string input = "data/raw/train_for_cpp.csv";
+    TweetSchema schema;
+    vector<size_t> sizes = {1000, 10000, 100000};
+    vector<int> threads = {1, 2, 4, 8};
+    int warmup = 1;
+    int reps = 5;
+    int vocab_size = 5000;
+    size_t vocab_budget = 0;  // bytes, 0 skips vocab_approx
+    TokenNormalization normalization;  // disabled skips clean_norm
+    string output = "benchmark_results.json";
+    string trace;
+};
+
+struct StageResult {
+    string stage;
+    size_t size = 0;     // tweets processed per run
+    int threads = 0;
+    size_t bytes = 0;    // bytes processed per run
+    vector<double> samples_ms;
+    double median_ms = 0;
+    double p95_ms = 0;
+    double speedup = 0;  // against the smallest thread count of the sweep
+    double efficiency = 0;
+};
+
+// How much of a cleaned subset the vocabulary built from it covers.
+struct Coverage {
+    size_t size = 0;
+    bool normalized = false;
+    size_t tokens = 0;
+    size_t distinct = 0;   // distinct words in the subset
+    size_t in_vocab = 0;   // tokens found in the vocabulary
+
+    double ratio() const { return tokens ? static_cast<double>(in_vocab) / tokens : 0.0; }
+};
+
+namespace {
+
+template <typename T>
+vector<T> parse_list(const string& text) {
+    vector<T> values;
+    stringstream ss(text);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) values.push_back(static_cast<T>(stoll(item)));
+    }
+    if (values.empty()) throw runtime_error("Empty list: " + text);
+    return values;
+}
+
+// Nearest-rank percentile of the samples.
+double percentile(vector<double> samples, double p) {
+    sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(ceil(p * samples.size()));
+    return samples[rank > 0 ? rank - 1 : 0];
+}
+
+// Runs `run` warmup times untimed, then reps times timed, in milliseconds.
+template <typename Run>
+vector<double> time_runs(const BenchmarkOptions& options, Run&& run) {
+    for (int i = 0; i < options.warmup; i++) run();
+    vector<double> samples;
+    for (int i = 0; i < options.reps; i++) {
+        auto start = high_resolution_clock::now();
+        run();
+        auto end = high_resolution_clock::now();
+        samples.push_back(duration<double, milli>(end - start).count());
+    }
+    return samples;
+}
+
+// The first n tweets, repeating the dataset when it is smaller than n.
+vector<Tweet> make_subset(const vector<Tweet>& tweets, size_t n) {
+    vector<Tweet> subset;
+    subset.reserve(n);
+    for (size_t i = 0; i < n; i++) subset.push_back(tweets[i % tweets.size()]);
+    return subset;
+}
+
+size_t total_bytes(const vector<string>& texts) {
+    size_t bytes = 0;
+    for (const auto& text : texts) bytes += text.size();
+    return bytes;
+}
+
+Coverage measure_coverage(size_t size, bool normalized, const vector<string>& texts,
+                          const ParallelEncoder& encoder) {
+    Coverage coverage;
+    coverage.size = size;
+    coverage.normalized = normalized;
+    TokenCache cache = encoder.lookup_tokens(texts);
+    coverage.tokens = cache.tokens;
+    coverage.in_vocab = cache.ids.size();
+    unordered_set<string_view> words;
+    for (const auto& text : texts) {
+        Tokenizer::for_each_span(text, [&](size_t offset, size_t length) {
+            words.insert(string_view(text).substr(offset, length));
+        });
+    }
+    coverage.distinct = words.size();
+    cout << "  coverage " << (normalized ? "normalized" : "plain     ") << ": " << coverage.tokens
+         << " tokens, " << coverage.distinct << " distinct, " << fixed << setprecision(2)
+         << 100.0 * coverage.ratio() << " % in vocabulary" << endl;
+    return coverage;
+}
+
+size_t file_size(const string& filename) {
+    ifstream file(filename, ios::binary | ios::ate);
+    return file ? static_cast<size_t>(file.tellg()) : 0;
+}
+
+string json_string(const string& text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+            continue;
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+// Speedup and efficiency of every result against the run of the same stage
+// and size with the fewest threads.
+void compute_scaling(vector<StageResult>& results) {
+    map<pair<string, size_t>, const StageResult*> baseline;
+    for (const auto& r : results) {
+        auto& base = baseline[{r.stage, r.size}];
+        if (!base || r.threads < base->threads) base = &r;
+    }
+    for (auto& r : results) {
+        const StageResult* base = baseline[{r.stage, r.size}];
+        if (r.median_ms <= 0) continue;
+        r.speedup = base->median_ms / r.median_ms;
+        r.efficiency = r.speedup * base->threads / r.threads;
+    }
+}
+
+void write_json(const string& filename, const BenchmarkOptions& options,
+                const vector<StageResult>& results, const vector<Coverage>& coverage) {
+    ofstream out(filename);
+    if (!out) throw runtime_error("Cannot open file for writing: " + filename);
+
+    out << fixed << setprecision(3);
+    out << "{\n";
+    out << "  \"input\": " << json_string(options.input) << ",\n";
+    out << "  \"hardware_threads\": " << omp_get_num_procs() << ",\n";
+    out << "  \"warmup\": " << options.warmup << ",\n";
+    out << "  \"reps\": " << options.reps << ",\n";
+    out << "  \"vocab_size\": " << options.vocab_size << ",\n";
+    out << "  \"vocab_budget\": " << options.vocab_budget << ",\n";
+    out << "  \"stop_words\": " << (options.normalization.stop_words ? "true" : "false") << ",\n";
+    out << "  \"stem\": " << (options.normalization.stem ? "true" : "false") << ",\n";
+    out << "  \"coverage\": [\n";
+    for (size_t i = 0; i < coverage.size(); i++) {
+        const Coverage& c = coverage[i];
+        out << "    {\"size\": " << c.size
+            << ", \"normalized\": " << (c.normalized ? "true" : "false")
+            << ", \"tokens\": " << c.tokens
+            << ", \"distinct\": " << c.distinct
+            << ", \"in_vocab\": " << c.in_vocab
+            << ", \"coverage\": " << c.ratio()
+            << "}" << (i + 1 < coverage.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const StageResult& r = results[i];
+        double seconds = r.median_ms / 1000.0;
+        out << "    {\"stage\": " << json_string(r.stage)
+            << ", \"size\": " << r.size
+            << ", \"threads\": " << r.threads
+            << ", \"bytes\": " << r.bytes
+            << ", \"median_ms\": " << r.median_ms
+            << ", \"p95_ms\": " << r.p95_ms
+            << ", \"tweets_per_s\": " << (seconds > 0 ? r.size / seconds : 0.0)
+            << ", \"mb_per_s\": " << (seconds > 0 ? r.bytes / 1e6 / seconds : 0.0)
+            << ", \"speedup\": " << r.speedup
+            << ", \"efficiency\": " << r.efficiency
+            << ", \"samples_ms\": [";
+        for (size_t k = 0; k < r.samples_ms.size(); k++) {
+            out << (k ? ", " : "") << r.samples_ms[k];
+        }
+        out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    if (!out) throw runtime_error("Failed writing benchmark results: " + filename);
+}
+
+BenchmarkOptions parse_args(const vector<string>& args) {
+    BenchmarkOptions options;
+    for (size_t i = 0; i < args.size(); i++) {
+        bool has_value = i + 1 < args.size();
+        if (args[i] == "--raw") {
+            options.schema = TweetSchema::twitter_raw();
+        } else if (args[i] == "--input" && has_value) {
+            options.input = args[++i];
+        } else if (args[i] == "--sizes" && has_value) {
+            options.sizes = parse_list<size_t>(args[++i]);
+        } else if (args[i] == "--threads" && has_value) {
+            options.threads = parse_list<int>(args[++i]);
+        } else if (args[i] == "--warmup" && has_value) {
+            options.warmup = stoi(args[++i]);
+        } else if (args[i] == "--reps" && has_value) {
+            options.reps = stoi(args[++i]);
+        } else if (args[i] == "--vocab" && has_value) {
+            options.vocab_size = stoi(args[++i]);
+        } else if (args[i] == "--vocab-budget" && has_value) {
+            options.vocab_budget = stoul(args[++i]) << 10;
+        } else if (args[i] == "--stop-words") {
+            options.normalization.stop_words = true;
+        } else if (args[i] == "--stem") {
+            options.normalization.stem = true;
+        } else if (args[i] == "--out" && has_value) {
+            options.output = args[++i];
+        } else if (args[i] == "--trace" && has_value) {
+            options.trace = args[++i];
+        } else {
+            throw runtime_error("Unknown option: " + args[i]);
+        }
+    }
+    if (options.reps < 1 || options.warmup < 0) {
+        throw runtime_error("--reps must be at least 1 and --warmup non-negative");
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        BenchmarkOptions options = parse_args(vector<string>(argv + 1, argv + argc));
+        const string save_path = options.output + ".save.tmp";
+
+        auto tweets = load_tweets(options.input, options.schema);
+        if (tweets.empty()) {
+            cerr << "No tweets loaded from " << options.input << endl;
+            return 1;
+        }
+
+        vector<StageResult> results;
+        vector<Coverage> coverage;
+        auto record = [&](const string& stage, size_t size, int threads, size_t bytes,
+                          vector<double> samples) {
+            StageResult r;
+            r.stage = stage;
+            r.size = size;
+            r.threads = threads;
+            r.bytes = bytes;
+            r.median_ms = percentile(samples, 0.5);
+            r.p95_ms = percentile(samples, 0.95);
+            r.samples_ms = move(samples);
+            cout << left << setw(10) << stage << right << setw(9) << size << setw(4) << threads
+                 << fixed << setprecision(2) << setw(11) << r.median_ms << " ms (p95 "
+                 << r.p95_ms << ")" << endl;
+            results.push_back(move(r));
+        };
+
+        for (int threads : options.threads) {
+            Executor executor(threads);
+
+            // Loading is measured on the whole input file.
+            size_t loaded = 0;
+            auto load_samples = time_runs(options, [&] {
+                loaded = load_tweets(options.input, options.schema, executor).size();
+            });
+            record("load", loaded, threads, file_size(options.input), move(load_samples));
+
+            for (size_t size : options.sizes) {
+                TextPreprocessor preprocessor(executor);
+                ParallelEncoder encoder(options.vocab_size, executor);
+                encoder.set_verbose(false);
+
+                vector<Tweet> subset = make_subset(tweets, size);
+                size_t raw_bytes = 0;
+                for (const auto& tweet : subset) raw_bytes += tweet.text.size();
+
+                vector<string> texts;
+                record("clean", size, threads, raw_bytes, time_runs(options, [&] {
+                    texts = preprocessor.preprocess_batch(subset);
+                }));
+                size_t clean_bytes = total_bytes(texts);
+
+                size_t tokens = 0;
+                record("tokenize", size, threads, clean_bytes, time_runs(options, [&] {
+                    size_t count = 0;
+                    #pragma omp parallel for schedule(dynamic, 64) reduction(+:count) num_threads(executor.threads_for(Stage::CLEAN, texts.size()))
+                    for (size_t i = 0; i < texts.size(); i++) {
+                        count += Tokenizer::count(texts[i]);
+                    }
+                    tokens = count;
+                }));
+
+                record("vocab", size, threads, clean_bytes, time_runs(options, [&] {
+                    encoder.build_vocabulary(texts);
+                }));
+
+                if (options.vocab_budget > 0) {
+                    ParallelEncoder approximate(options.vocab_size, executor);
+                    approximate.set_verbose(false);
+                    approximate.set_vocabulary_budget(options.vocab_budget);
+                    record("vocab_approx", size, threads, clean_bytes, time_runs(options, [&] {
+                        approximate.build_vocabulary(texts);
+                    }));
+                    const VocabularyEstimate& estimate = approximate.vocabulary_estimate();
+                    bool same = approximate.vocabulary_hash() == encoder.vocabulary_hash();
+                    cout << "  approximate vocabulary " << (same ? "matches" : "differs from")
+                         << " exact; " << estimate.capacity << " words monitored, floor "
+                         << estimate.floor << ", max error " << estimate.max_error
+                         << (estimate.exact ? " (certified exact)" : "") << endl;
+                }
+
+                if (options.normalization.enabled()) {
+                    TextPreprocessor normalizer(executor);
+                    normalizer.set_normalization(options.normalization);
+                    vector<string> normalized;
+                    record("clean_norm", size, threads, raw_bytes, time_runs(options, [&] {
+                        normalized = normalizer.preprocess_batch(subset);
+                    }));
+                    // Coverage does not depend on the thread count.
+                    if (threads == options.threads.front()) {
+                        ParallelEncoder normalized_encoder(options.vocab_size, executor);
+                        normalized_encoder.set_verbose(false);
+                        normalized_encoder.build_vocabulary(normalized);
+                        coverage.push_back(measure_coverage(size, false, texts, encoder));
+                        coverage.push_back(measure_coverage(size, true, normalized, normalized_encoder));
+                    }
+                }
+
+                SparseEncodings encodings;
+                record("encode", size, threads, clean_bytes, time_runs(options, [&] {
+                    encodings = encoder.encode_sparse(texts);
+                }));
+
+                auto save_samples = time_runs(options, [&] {
+                    encoder.save_sparse_encodings(save_path, encodings);
+                });
+                record("save", size, threads, file_size(save_path), move(save_samples));
+                remove(save_path.c_str());
+
+                if (tokens == 0) {
+                    cerr << "Warning: no tokens in the first " << size << " tweets" << endl;
+                }
+            }
+        }
+
+        compute_scaling(results);
+        write_json(options.output, options, results, coverage);
+        cout << "Saved benchmark results to: " << options.output << endl;
+        if (!options.trace.empty()) {
+            instrumentation::print_summary();
+            instrumentation::write_chrome_trace(options.trace);
+            cout << "Saved trace to: " << options.trace << endl;
+        }
+    } catch (const exception& e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "instrumentation.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+using namespace std;
+
+// Blocking FIFO with a fixed capacity, used to connect pipeline stages.
+// push() waits while the queue is full, which is what gives the pipeline
+// backpressure; pop() waits while it is empty and returns nullopt once the
+// producer has called close() and everything has been drained.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+    // Returns false if the queue was closed before the item could be queued.
+    bool push(T item) {
+        unique_lock<mutex> lock(mutex_);
+        if (items_.size() >= capacity_ && !closed_) {
+            TRACE_WAIT("queue_push_wait");
+            not_full_.wait(lock, [this] { return items_.size() < capacity_ || closed_; });
+        }
+        if (closed_) return false;
+        items_.push_back(move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    optional<T> pop() {
+        unique_lock<mutex> lock(mutex_);
+        if (items_.empty() && !closed_) {
+            TRACE_WAIT("queue_pop_wait");
+            not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+        }
+        if (items_.empty()) return nullopt;
+        T item = move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return item;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    deque<T> items_;
+    bool closed_ = false;
+    mutex mutex_;
+    condition_variable not_full_;
+    condition_variable not_empty_;
+};
@@ -1,9 +1,12 @@
 #pragma once
 #include "preprocessor.hpp"
+#include "csv_loader.hpp"
 #include <fstream>
 #include <sstream>
 
-vector<Tweet> load_tweets(const string& filename);
-void save_processed_tweets(const string& filename, 
-                         const vector<Tweet>& tweets,
-                         const vector<string>& processed_texts);
\ No newline at end of file
+// "id,text,sentiment" CSV of the cleaned texts of tweets, with the text
+// quoted and escaped; rows are formatted and written in parallel.
+void save_processed_tweets(const string& filename,
+                           const TweetBatchView& tweets,
+                           const TokenizedBatch& cleaned,
+                           const Executor& executor = Executor::global());
\ No newline at end of file
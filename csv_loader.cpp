@@ -0,0 +1,459 @@
+#include "csv_loader.hpp"
+#include "instrumentation.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const size_t MIN_CHUNK_BYTES = 1 << 16;
+
+string_view trim(string_view s) {
+    size_t first = 0, last = s.size();
+    while (first < last && (s[first] == ' ' || s[first] == '\t')) first++;
+    while (last > first && (s[last - 1] == ' ' || s[last - 1] == '\t')) last--;
+    return s.substr(first, last - first);
+}
+
+// Walk the fields of one record, handing each to emit(column, field).
+// emit returns false to stop early. Returns the number of columns visited.
+template <typename Emit>
+size_t scan_record(string_view record, Emit emit) {
+    size_t i = 0, n = record.size(), count = 0;
+    while (true) {
+        CsvField field;
+        while (i < n && (record[i] == ' ' || record[i] == '\t')) i++;
+
+        if (i < n && record[i] == '"') {
+            size_t start = ++i;
+            while (i < n) {
+                if (record[i] == '"') {
+                    if (i + 1 < n && record[i + 1] == '"') {
+                        field.escaped = true;
+                        i += 2;
+                        continue;
+                    }
+                    break;
+                }
+                i++;
+            }
+            field.text = record.substr(start, i - start);
+            // Anything between the closing quote and the comma is dropped
+            while (i < n && record[i] != ',') i++;
+        } else {
+            size_t start = i;
+            while (i < n && record[i] != ',') i++;
+            field.text = trim(record.substr(start, i - start));
+        }
+
+        if (!emit(count++, field)) break;
+        if (i >= n) break;
+        i++;  // skip the comma
+    }
+    return count;
+}
+
+} // namespace
+
+string CsvField::str() const {
+    if (!escaped) return string(text);
+
+    string result(size(), '\0');
+    copy_to(&result[0]);
+    return result;
+}
+
+size_t CsvField::size() const {
+    if (!escaped) return text.size();
+    return text.size() - count(text.begin(), text.end(), '"') / 2;
+}
+
+void CsvField::copy_to(char* out) const {
+    if (!escaped) {
+        if (!text.empty()) memcpy(out, text.data(), text.size());
+        return;
+    }
+    for (size_t i = 0; i < text.size(); i++) {
+        *out++ = text[i];
+        if (text[i] == '"' && i + 1 < text.size() && text[i + 1] == '"') i++;
+    }
+}
+
+CsvFile::CsvFile(const string& filename, bool has_header, const Executor& executor)
+    : file_(filename) {
+    find_records(executor);
+
+    if (has_header && !records_.empty()) {
+        split(0, header_);
+        records_.erase(records_.begin());
+    }
+}
+
+void CsvFile::split(size_t record, vector<CsvField>& out) const {
+    out.clear();
+    scan_record(records_[record], [&](size_t, const CsvField& field) {
+        out.push_back(field);
+        return true;
+    });
+}
+
+void CsvFile::find_records(const Executor& executor) {
+    const char* data = file_.data();
+    size_t size = file_.size();
+    if (size == 0) return;
+
+    int threads = executor.threads_for(Stage::LOAD);
+    size_t num_chunks = max<size_t>(1, min<size_t>(threads * 4, size / MIN_CHUNK_BYTES));
+    size_t chunk_size = (size + num_chunks - 1) / num_chunks;
+
+    // Pass 1: quote parity of every chunk tells the next chunk whether it
+    // starts inside a quoted field.
+    vector<char> starts_quoted(num_chunks, 0);
+    vector<char> parity(num_chunks, 0);
+    #pragma omp parallel for schedule(static) num_threads(threads)
+    for (size_t c = 0; c < num_chunks; c++) {
+        const char* p = data + min(size, c * chunk_size);
+        const char* end = data + min(size, (c + 1) * chunk_size);
+        size_t quotes = 0;
+        while ((p = static_cast<const char*>(memchr(p, '"', end - p))) != nullptr) {
+            quotes++;
+            p++;
+        }
+        parity[c] = quotes & 1;
+    }
+    for (size_t c = 1; c < num_chunks; c++) {
+        starts_quoted[c] = starts_quoted[c - 1] ^ parity[c - 1];
+    }
+
+    // Pass 2: record terminators are newlines outside quotes.
+    vector<vector<size_t>> chunk_breaks(num_chunks);
+    #pragma omp parallel for schedule(static) num_threads(threads)
+    for (size_t c = 0; c < num_chunks; c++) {
+        size_t begin = min(size, c * chunk_size);
+        size_t end = min(size, (c + 1) * chunk_size);
+        bool in_quotes = starts_quoted[c];
+        for (size_t i = begin; i < end; i++) {
+            char ch = data[i];
+            if (ch == '"') in_quotes = !in_quotes;
+            else if (ch == '\n' && !in_quotes) chunk_breaks[c].push_back(i);
+        }
+    }
+
+    size_t start = 0;
+    auto add_record = [&](size_t end) {
+        string_view record(data + start, end - start);
+        if (!record.empty() && record.back() == '\r') record.remove_suffix(1);
+        if (!record.empty()) records_.push_back(record);
+    };
+    for (const auto& breaks : chunk_breaks) {
+        for (size_t pos : breaks) {
+            add_record(pos);
+            start = pos + 1;
+        }
+    }
+    if (start < size) add_record(size);
+}
+
+int parse_sentiment(string_view label) {
+    label = trim(label);
+    if (label == "Positive" || label == "2") return 2;
+    if (label == "Negative" || label == "0") return 0;
+    if (label == "Irrelevant" || label == "-1") return -1;
+    return 1;  // Default to neutral without warning
+}
+
+TweetSchema TweetSchema::twitter_raw() {
+    TweetSchema schema;
+    schema.id = 0;
+    schema.entity = 1;
+    schema.label = 2;
+    schema.text = 3;
+    schema.has_header = false;
+    return schema;
+}
+
+namespace {
+
+enum TweetSlot { SLOT_ID, SLOT_ENTITY, SLOT_LABEL, SLOT_TEXT, NUM_SLOTS };
+
+int resolve_column(const CsvColumn& column, const vector<CsvField>& header) {
+    if (!column.mapped()) return -1;
+    if (column.index >= 0) return column.index;
+
+    for (size_t i = 0; i < header.size(); i++) {
+        if (header[i].str() == column.name) return static_cast<int>(i);
+    }
+    throw runtime_error("Column '" + column.name + "' not found in CSV header");
+}
+
+} // namespace
+
+TweetProjector::TweetProjector(const TweetSchema& schema, const vector<CsvField>& header)
+    : schema_(schema) {
+    // slots_[column] says which Tweet member a column feeds, -1 to skip it
+    const CsvColumn* roles[NUM_SLOTS] = {&schema.id, &schema.entity,
+                                         &schema.label, &schema.text};
+    for (int slot = 0; slot < NUM_SLOTS; slot++) {
+        int col = resolve_column(*roles[slot], header);
+        if (col < 0) continue;
+        if (static_cast<size_t>(col) >= slots_.size()) slots_.resize(col + 1, -1);
+        slots_[col] = slot;
+    }
+    if (slots_.empty()) {
+        throw runtime_error("Tweet schema maps no columns");
+    }
+}
+
+bool TweetProjector::scan(string_view record, CsvField* fields) const {
+    size_t seen = scan_record(record, [&](size_t col, const CsvField& field) {
+        if (slots_[col] >= 0) fields[slots_[col]] = field;
+        return col + 1 < slots_.size();
+    });
+    return seen >= slots_.size();
+}
+
+int TweetProjector::parse_id(const CsvField& field, int record_number) const {
+    if (!schema_.id.mapped()) return record_number;
+    string_view id = field.text;
+    int value = 0;
+    auto parsed = from_chars(id.data(), id.data() + id.size(), value);
+    if (parsed.ec == errc() && parsed.ptr == id.data() + id.size()) return value;
+    return record_number;
+}
+
+bool TweetProjector::project(string_view record, int record_number, Tweet& tweet) const {
+    CsvField fields[NUM_SLOTS];
+    if (!scan(record, fields)) return false;
+
+    tweet.id = parse_id(fields[SLOT_ID], record_number);
+    tweet.entity = fields[SLOT_ENTITY].str();
+    tweet.text = fields[SLOT_TEXT].str();
+    tweet.sentiment = parse_sentiment(fields[SLOT_LABEL].text);
+    return true;
+}
+
+bool TweetProjector::project(string_view record, int record_number, int& id, int& label,
+                             CsvField& text) const {
+    CsvField fields[NUM_SLOTS];
+    if (!scan(record, fields)) return false;
+
+    id = parse_id(fields[SLOT_ID], record_number);
+    label = parse_sentiment(fields[SLOT_LABEL].text);
+    text = fields[SLOT_TEXT];
+    return true;
+}
+
+bool TweetProjector::project(string_view record, int record_number, TweetBatch& batch) const {
+    int id, label;
+    CsvField text;
+    if (!project(record, record_number, id, label, text)) return false;
+    text.copy_to(batch.append(id, label, text.size()));
+    return true;
+}
+
+CsvReader::CsvReader(const string& filename, bool has_header)
+    : CsvReader(filename, has_header, 0, SIZE_MAX) {}
+
+CsvReader::CsvReader(const string& filename, bool has_header, size_t begin, size_t end)
+    : file_(filename), end_(file_.size()) {
+    string_view record;
+    if (has_header && next_record(record)) {
+        scan_record(record, [&](size_t, const CsvField& field) {
+            header_.push_back(field);
+            return true;
+        });
+    }
+    end_ = min(end, file_.size());
+    if (begin > pos_) pos_ = record_start_at(begin);
+}
+
+void CsvReader::seek(size_t offset) {
+    pos_ = max(pos_, min(offset, file_.size()));
+}
+
+namespace {
+
+// First record start at or after each of the ascending offsets: an offset
+// itself if a newline outside quotes precedes it, else the byte after the
+// next such newline. Quote parity is carried from one offset to the next,
+// so the file is read once up to the last result.
+vector<size_t> find_record_starts(const char* data, size_t size, const vector<size_t>& offsets) {
+    vector<size_t> starts;
+    starts.reserve(offsets.size());
+    size_t scanned = 0, quotes = 0;  // quotes in data[0, scanned)
+    for (size_t offset : offsets) {
+        if (offset == 0 || offset >= size) {
+            starts.push_back(min(offset, size));
+            continue;
+        }
+        // The previous search already ran past this offset to a start.
+        if (scanned > offset - 1) {
+            starts.push_back(scanned);
+            continue;
+        }
+        for (const char* q = data + scanned;
+             (q = static_cast<const char*>(memchr(q, '"', data + offset - 1 - q))) != nullptr; q++) {
+            quotes++;
+        }
+        size_t start = size;
+        for (size_t i = offset - 1; i < size; i++) {
+            if (data[i] == '"') quotes++;
+            else if (data[i] == '\n' && quotes % 2 == 0) {
+                start = i + 1;
+                break;
+            }
+        }
+        scanned = start;
+        starts.push_back(start);
+    }
+    return starts;
+}
+
+} // namespace
+
+size_t CsvReader::record_start_at(size_t offset) const {
+    return find_record_starts(file_.data(), file_.size(), {offset})[0];
+}
+
+vector<size_t> CsvReader::record_starts(const string& filename, const vector<size_t>& offsets) {
+    if (!is_sorted(offsets.begin(), offsets.end())) {
+        throw invalid_argument("Record start offsets must be ascending");
+    }
+    MappedFile file(filename);
+    return find_record_starts(file.data(), file.size(), offsets);
+}
+
+bool CsvReader::next_record(string_view& record) {
+    const char* data = file_.data();
+    size_t size = file_.size();
+
+    while (pos_ < end_) {
+        // Jump newline to newline; a newline only ends the record when the
+        // quotes seen since the record start are balanced.
+        size_t scan = pos_;
+        size_t quotes = 0;
+        size_t end = size;
+        while (scan < size) {
+            const char* nl = static_cast<const char*>(memchr(data + scan, '\n', size - scan));
+            end = nl ? static_cast<size_t>(nl - data) : size;
+            for (const char* q = data + scan;
+                 (q = static_cast<const char*>(memchr(q, '"', data + end - q))) != nullptr; q++) {
+                quotes++;
+            }
+            if (quotes % 2 == 0 || !nl) break;
+            scan = end + 1;
+        }
+
+        record = string_view(data + pos_, end - pos_);
+        pos_ = min(size, end + 1);
+        if (!record.empty() && record.back() == '\r') record.remove_suffix(1);
+        if (!record.empty()) return true;
+    }
+    return false;
+}
+
+size_t CsvReader::next_records(size_t max_records, vector<string_view>& out) {
+    size_t added = 0;
+    string_view record;
+    while (added < max_records && next_record(record)) {
+        out.push_back(record);
+        added++;
+    }
+    return added;
+}
+
+void CsvReader::release_consumed() {
+    // The mapping is file-backed and read-only, so dropped pages are simply
+    // faulted back in if a view into them is touched again.
+    file_.drop_prefix(pos_);
+}
+
+vector<Tweet> load_tweets(const string& filename, const TweetSchema& schema,
+                          const Executor& executor) {
+    TRACE_SCOPE("load");
+    vector<Tweet> tweets;
+
+    try {
+        CsvFile csv(filename, schema.has_header, executor);
+        TweetProjector projector(schema, csv.header());
+        TRACE_COUNT(BYTES_IN, csv.size());
+
+        size_t n = csv.num_records();
+        tweets.resize(n);
+        vector<char> valid(n, 0);
+
+        #pragma omp parallel for schedule(dynamic, 256) num_threads(executor.threads_for(Stage::LOAD, n))
+        for (size_t i = 0; i < n; i++) {
+            if (!projector.project(csv.record(i), static_cast<int>(i + 1), tweets[i])) continue;
+            valid[i] = 1;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (!valid[i]) continue;
+            if (kept != i) tweets[kept] = move(tweets[i]);
+            kept++;
+        }
+        tweets.resize(kept);
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return tweets;
+    }
+
+    cout << "Successfully loaded " << tweets.size()
+         << " tweets from " << filename << endl;
+    return tweets;
+}
+
+TweetBatch load_tweet_batch(const string& filename, const TweetSchema& schema,
+                            const Executor& executor) {
+    TRACE_SCOPE("load");
+    TweetBatch batch;
+
+    try {
+        CsvFile csv(filename, schema.has_header, executor);
+        TweetProjector projector(schema, csv.header());
+        TRACE_COUNT(BYTES_IN, csv.size());
+
+        size_t n = csv.num_records();
+        int threads = executor.threads_for(Stage::LOAD, n);
+        vector<int> ids(n), labels(n);
+        vector<CsvField> texts(n);
+        vector<uint64_t> sizes(n);
+        vector<char> valid(n, 0);
+
+        #pragma omp parallel for schedule(dynamic, 256) num_threads(threads)
+        for (size_t i = 0; i < n; i++) {
+            if (!projector.project(csv.record(i), static_cast<int>(i + 1), ids[i], labels[i],
+                                   texts[i])) continue;
+            sizes[i] = texts[i].size();
+            valid[i] = 1;
+        }
+
+        // Place the kept rows, then copy every text into its slot.
+        vector<size_t> rows;
+        rows.reserve(n);
+        batch.reserve(n, 0);
+        for (size_t i = 0; i < n; i++) {
+            if (!valid[i]) continue;
+            rows.push_back(i);
+            batch.ids.push_back(ids[i]);
+            batch.labels.push_back(labels[i]);
+            batch.text_offsets.push_back(batch.text_offsets.back() + sizes[i]);
+        }
+        batch.arena.resize(batch.text_offsets.back());
+
+        #pragma omp parallel for schedule(dynamic, 256) num_threads(threads)
+        for (size_t r = 0; r < rows.size(); r++) {
+            texts[rows[r]].copy_to(batch.arena.data() + batch.text_offsets[r]);
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return batch;
+    }
+
+    cout << "Successfully loaded " << batch.size()
+         << " tweets from " << filename << endl;
+    return batch;
+}
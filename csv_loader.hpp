@@ -0,0 +1,155 @@
+#pragma once
+#include "preprocessor.hpp"
+#include "mapped_file.hpp"
+#include "executor.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// One CSV field as a view into the mapped file. Surrounding quotes are
+// already stripped; doubled quotes inside are left as-is until str().
+struct CsvField {
+    string_view text;
+    bool escaped = false;
+
+    string str() const;
+    // Length once doubled quotes are undone, and the unescaped bytes
+    // written to out, which must have room for size() of them.
+    size_t size() const;
+    void copy_to(char* out) const;
+};
+
+// RFC 4180 CSV file parsed in parallel over a read-only mapping.
+//
+// Record boundaries are found quote-aware in two parallel passes (quote
+// parity per chunk, then newline positions outside quotes), so quoted
+// fields may contain commas and newlines. Fields are string_views into the
+// mapping and stay valid for the lifetime of the CsvFile.
+class CsvFile {
+public:
+    explicit CsvFile(const string& filename, bool has_header = true,
+                     const Executor& executor = Executor::global());
+
+    size_t num_records() const { return records_.size(); }
+    string_view record(size_t i) const { return records_[i]; }
+    const vector<CsvField>& header() const { return header_; }
+    size_t size() const { return file_.size(); }
+
+    // Split every column of a record.
+    void split(size_t record, vector<CsvField>& out) const;
+
+private:
+    void find_records(const Executor& executor);
+
+    MappedFile file_;
+    vector<CsvField> header_;
+    vector<string_view> records_;
+};
+
+// Where a Tweet member comes from: a column index, a header name, or
+// nowhere (index -1 and no name).
+struct CsvColumn {
+    int index = -1;
+    string name;
+
+    CsvColumn() = default;
+    CsvColumn(int i) : index(i) {}
+    CsvColumn(const char* n) : name(n) {}
+    CsvColumn(string n) : name(move(n)) {}
+    bool mapped() const { return index >= 0 || !name.empty(); }
+};
+
+// Column roles for load_tweets. An unmapped id falls back to the 1-based
+// record number; other unmapped roles are left empty.
+struct TweetSchema {
+    CsvColumn id;
+    CsvColumn entity;
+    CsvColumn label = 2;
+    CsvColumn text = 1;
+    bool has_header = true;
+
+    // id,text,sentiment_label with a header row, as written by data.py
+    static TweetSchema cpp_export() { return TweetSchema(); }
+    // id,entity,sentiment,text without a header, as in twitter_validation.csv
+    static TweetSchema twitter_raw();
+};
+
+// A TweetSchema resolved against a header: knows which columns to split
+// and which Tweet member each one fills. Columns after the last projected
+// one are never scanned, and unprojected ones are never materialized.
+class TweetProjector {
+public:
+    TweetProjector(const TweetSchema& schema, const vector<CsvField>& header);
+
+    // Fill tweet from one record. Returns false if the record is missing a
+    // projected column. record_number is the id used when none is mapped.
+    bool project(string_view record, int record_number, Tweet& tweet) const;
+    // Append the record to batch without materializing the text anywhere
+    // else. Entities are dropped.
+    bool project(string_view record, int record_number, TweetBatch& batch) const;
+    // The id and label of a record and its text field, still escaped, for
+    // callers that place the text themselves.
+    bool project(string_view record, int record_number, int& id, int& label,
+                 CsvField& text) const;
+
+private:
+    bool scan(string_view record, CsvField* fields) const;
+    int parse_id(const CsvField& field, int record_number) const;
+
+    TweetSchema schema_;
+    vector<int> slots_;
+};
+
+// Forward-only reader that hands out batches of records from a mapped file
+// without indexing the whole file first. Pages that have been consumed can
+// be dropped with release_consumed(), so resident memory stays bounded.
+class CsvReader {
+public:
+    explicit CsvReader(const string& filename, bool has_header = true);
+    // Only the records that start at a byte offset in [begin, end), so that
+    // readers over adjacent ranges split a file at record boundaries with
+    // nothing read twice or skipped. The header is still read from the top.
+    // Quotes before begin are counted to know where records start, so this
+    // reads the whole file up to begin; with many readers over one file,
+    // find the starts once with record_starts() and seek() to them instead.
+    CsvReader(const string& filename, bool has_header, size_t begin, size_t end);
+
+    // Append up to max_records record views to out. Returns how many were
+    // added; 0 means the end of the file.
+    size_t next_records(size_t max_records, vector<string_view>& out);
+    const vector<CsvField>& header() const { return header_; }
+    size_t offset() const { return pos_; }
+    size_t size() const { return file_.size(); }
+    // Continue from offset, which must be a record start such as an earlier
+    // offset(); unlike a begin offset it is trusted, so nothing before it is
+    // read.
+    void seek(size_t offset);
+    void release_consumed();
+
+    // First record start at or after each of the ascending offsets, found
+    // in one pass over the file up to the last of them.
+    static vector<size_t> record_starts(const string& filename, const vector<size_t>& offsets);
+
+private:
+    bool next_record(string_view& record);
+    size_t record_start_at(size_t offset) const;
+
+    MappedFile file_;
+    vector<CsvField> header_;
+    size_t pos_ = 0;
+    size_t end_;
+};
+
+// Map a sentiment label ("Positive", "2", ...) to the numeric code used
+// across the pipeline; unknown labels fall back to neutral (1).
+int parse_sentiment(string_view label);
+
+vector<Tweet> load_tweets(const string& filename, const TweetSchema& schema = TweetSchema(),
+                          const Executor& executor = Executor::global());
+// load_tweets into a columnar batch: fields are projected in parallel, then
+// every text is unescaped straight into its place in the arena.
+TweetBatch load_tweet_batch(const string& filename, const TweetSchema& schema = TweetSchema(),
+                            const Executor& executor = Executor::global());
@@ -0,0 +1,163 @@
+#include "dedup_cache.hpp"
+#include "hash_utils.hpp"
+#include "instrumentation.hpp"
+#include "parallel_utils.hpp"
+#include <cstdio>
+
+string DedupStats::summary() const {
+    char line[192];
+    snprintf(line, sizeof(line),
+             "dedup_hit_rate=%.1f%% hits=%llu lookups=%llu entries=%llu cache_mb=%.1f evictions=%llu",
+             100.0 * hit_rate(), static_cast<unsigned long long>(hits),
+             static_cast<unsigned long long>(lookups), static_cast<unsigned long long>(entries),
+             bytes / (1024.0 * 1024.0), static_cast<unsigned long long>(evictions));
+    return line;
+}
+
+TokenCache DedupedBatch::token_cache() const {
+    TokenCache cache;
+    size_t total = 0;
+    for (const auto& row : rows) total += row->ids.size();
+    cache.row_offsets.reserve(rows.size() + 1);
+    cache.ids.reserve(total);
+    for (const auto& row : rows) {
+        cache.ids.insert(cache.ids.end(), row->ids.begin(), row->ids.end());
+        cache.row_offsets.push_back(cache.ids.size());
+        cache.tokens += row->tokens;
+    }
+    return cache;
+}
+
+DedupCache::DedupCache(size_t max_bytes)
+    : max_bytes_(max_bytes), shard_budget_(max_bytes / NUM_SHARDS) {}
+
+// Payload plus a flat allowance for the list node, index node and
+// shared_ptr control block.
+size_t DedupCache::entry_bytes(string_view text, const CachedText& value) {
+    return sizeof(Entry) + sizeof(CachedText) + 64 + text.size() + value.clean.capacity() +
+           value.ids.capacity() * sizeof(uint32_t);
+}
+
+shared_ptr<const CachedText> DedupCache::find(string_view text, uint64_t hash) {
+    Shard& shard = shards_[shard_of(hash)];
+    lock_guard<mutex> lock(shard.lock);
+    auto found = shard.index.find(hash);
+    if (found == shard.index.end() || found->second->text != text) return nullptr;
+    shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+    return found->second->value;
+}
+
+void DedupCache::insert(string_view text, uint64_t hash, shared_ptr<const CachedText> value) {
+    size_t bytes = entry_bytes(text, *value);
+    if (bytes > shard_budget_) return;
+
+    Shard& shard = shards_[shard_of(hash)];
+    lock_guard<mutex> lock(shard.lock);
+    auto found = shard.index.find(hash);
+    if (found != shard.index.end()) {
+        shard.bytes -= found->second->bytes;
+        shard.lru.erase(found->second);
+        shard.index.erase(found);
+    }
+    shard.lru.push_front(Entry{string(text), hash, bytes, move(value)});
+    shard.index.emplace(hash, shard.lru.begin());
+    shard.bytes += bytes;
+
+    while (shard.bytes > shard_budget_) {
+        const Entry& oldest = shard.lru.back();
+        shard.bytes -= oldest.bytes;
+        shard.index.erase(oldest.hash);
+        shard.lru.pop_back();
+        shard.evictions++;
+    }
+}
+
+void DedupCache::clear() {
+    for (Shard& shard : shards_) {
+        lock_guard<mutex> lock(shard.lock);
+        shard.index.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+    }
+}
+
+DedupStats DedupCache::stats() const {
+    DedupStats stats;
+    stats.lookups = lookups_.load(memory_order_relaxed);
+    stats.hits = hits_.load(memory_order_relaxed);
+    for (Shard& shard : shards_) {
+        lock_guard<mutex> lock(shard.lock);
+        stats.entries += shard.index.size();
+        stats.bytes += shard.bytes;
+        stats.evictions += shard.evictions;
+    }
+    return stats;
+}
+
+DedupedBatch DedupCache::resolve(const TweetBatchView& tweets, const TextPreprocessor& preprocessor,
+                                 const ParallelEncoder& encoder) {
+    TRACE_SCOPE("dedup_resolve");
+    uint64_t fingerprint = encoder.vocabulary_hash();
+    if (fingerprint_.exchange(fingerprint) != fingerprint) clear();
+
+    const Executor& executor = preprocessor.executor();
+    size_t n = tweets.size();
+    DedupedBatch batch;
+    batch.rows.resize(n);
+    vector<uint64_t> hashes(n);
+
+    RowTasks tasks = executor.plan(Stage::CLEAN, n, [&](size_t i) { return tweets.text(i).size(); });
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(tasks.threads)
+    for (size_t t = 0; t < tasks.size(); t++) {
+        for (size_t i = tasks.begin(t); i < tasks.end(t); i++) {
+            hashes[i] = hash_bytes(tweets.text(i));
+            batch.rows[i] = find(tweets.text(i), hashes[i]);
+        }
+    }
+
+    // Distinct texts that are not cached, by first occurrence in the batch;
+    // later copies take the result of the first.
+    vector<size_t> misses;
+    vector<size_t> source(n);
+    unordered_map<uint64_t, size_t, IdentityHash> first_miss;
+    for (size_t i = 0; i < n; i++) {
+        if (batch.rows[i]) continue;
+        auto seen = first_miss.find(hashes[i]);
+        if (seen != first_miss.end() && tweets.text(misses[seen->second]) == tweets.text(i)) {
+            source[i] = seen->second;
+            continue;
+        }
+        if (seen == first_miss.end()) first_miss.emplace(hashes[i], misses.size());
+        source[i] = misses.size();
+        misses.push_back(i);
+    }
+
+    if (!misses.empty()) {
+        TokenizedBatch cleaned;
+        CleanWorkspace workspace;
+        preprocessor.clean_tokenize_rows(misses.size(),
+                                         [&](size_t m) { return tweets.text(misses[m]); }, cleaned,
+                                         workspace, "dedup_clean_rows");
+        TokenCache ids = encoder.lookup_tokens(cleaned);
+
+        vector<shared_ptr<const CachedText>> fresh(misses.size());
+        #pragma omp parallel for schedule(static) num_threads(tasks.threads)
+        for (size_t m = 0; m < misses.size(); m++) {
+            auto value = make_shared<CachedText>();
+            value->clean = string(cleaned.text(m));
+            value->ids.assign(ids.ids.begin() + ids.row_offsets[m],
+                              ids.ids.begin() + ids.row_offsets[m + 1]);
+            value->tokens = static_cast<uint32_t>(cleaned.span_offsets[m + 1] - cleaned.span_offsets[m]);
+            insert(tweets.text(misses[m]), hashes[misses[m]], value);
+            fresh[m] = move(value);
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (!batch.rows[i]) batch.rows[i] = fresh[source[i]];
+        }
+    }
+
+    lookups_ += n;
+    hits_ += n - misses.size();
+    TRACE_COUNT(DEDUP_HITS, n - misses.size());
+    return batch;
+}
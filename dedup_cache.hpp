@@ -0,0 +1,103 @@
+#pragma once
+#include "preprocessor.hpp"
+#include "parallel_encoder.hpp"
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// What the pipeline derives from one raw text: the cleaned text and its
+// token ids against the encoder's columns. Immutable once cached, so rows
+// with the same text share one copy.
+struct CachedText {
+    string clean;
+    vector<uint32_t> ids;
+    uint32_t tokens = 0;  // every token, including out-of-vocabulary ones
+};
+
+struct DedupStats {
+    uint64_t lookups = 0;    // tweets resolved
+    uint64_t hits = 0;       // ... that were not cleaned again
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    uint64_t evictions = 0;
+
+    double hit_rate() const { return lookups ? double(hits) / lookups : 0; }
+    string summary() const;
+};
+
+// Rows of a batch resolved through a DedupCache, in input order. Duplicate
+// texts point at the same CachedText.
+struct DedupedBatch {
+    vector<shared_ptr<const CachedText>> rows;
+
+    size_t size() const { return rows.size(); }
+    // The token ids in the layout encode_sparse takes.
+    TokenCache token_cache() const;
+};
+
+// Cache of cleaned texts and token ids keyed by a hash of the raw text, so
+// retweets and repeated texts are cleaned, tokenized and looked up once.
+//
+// Entries live in NUM_SHARDS hash-partitioned shards, each with its own
+// lock and an LRU list. Every shard may hold max_bytes / NUM_SHARDS of
+// (estimated) memory and evicts its least recently used texts beyond that.
+// An evicted entry stays alive for as long as a batch still refers to it.
+// Token ids are only valid for one vocabulary, so the cache empties itself
+// when it is used with an encoder whose vocabulary_hash differs.
+class DedupCache {
+public:
+    static constexpr size_t NUM_SHARDS = 64;
+
+    explicit DedupCache(size_t max_bytes);
+
+    // Cleaned text and token ids for every tweet. Texts that are neither
+    // cached nor repeated earlier in the batch are cleaned with preprocessor
+    // and looked up with encoder, once per distinct text, then cached.
+    DedupedBatch resolve(const TweetBatchView& tweets, const TextPreprocessor& preprocessor,
+                         const ParallelEncoder& encoder);
+
+    // Entry for text, or null. hash must be hash_bytes(text).
+    shared_ptr<const CachedText> find(string_view text, uint64_t hash);
+    void insert(string_view text, uint64_t hash, shared_ptr<const CachedText> value);
+    void clear();
+
+    DedupStats stats() const;
+    size_t max_bytes() const { return max_bytes_; }
+
+private:
+    struct Entry {
+        string text;
+        uint64_t hash;
+        size_t bytes;
+        shared_ptr<const CachedText> value;
+    };
+    struct IdentityHash {
+        size_t operator()(uint64_t hash) const { return hash; }
+    };
+    // One 64-bit hash maps to one entry; a colliding text replaces it.
+    struct Shard {
+        mutex lock;
+        list<Entry> lru;  // most recently used first
+        unordered_map<uint64_t, list<Entry>::iterator, IdentityHash> index;
+        size_t bytes = 0;
+        uint64_t evictions = 0;
+    };
+
+    static size_t shard_of(uint64_t hash) { return hash >> 58; }
+    static size_t entry_bytes(string_view text, const CachedText& value);
+
+    size_t max_bytes_;
+    size_t shard_budget_;
+    mutable Shard shards_[NUM_SHARDS];
+    atomic<uint64_t> fingerprint_{0};
+    atomic<uint64_t> lookups_{0};
+    atomic<uint64_t> hits_{0};
+};
@@ -0,0 +1,452 @@
+#include "embedding_io.hpp"
+#include "instrumentation.hpp"
+#include "parallel_writer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <cstdio>
+#include <stdexcept>
+
+namespace {
+
+uint64_t align_up(uint64_t value) {
+    return (value + EMBEDDING_SECTION_ALIGN - 1) / EMBEDDING_SECTION_ALIGN * EMBEDDING_SECTION_ALIGN;
+}
+
+EmbeddingFileHeader make_header(EmbeddingLayout layout, uint64_t rows, uint64_t cols,
+                                uint64_t vocab_hash) {
+    EmbeddingFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EMBEDDING_MAGIC, sizeof(header.magic));
+    header.version = EMBEDDING_FORMAT_VERSION;
+    header.endian_tag = EMBEDDING_ENDIAN_TAG;
+    header.layout = static_cast<uint32_t>(layout);
+    header.rows = rows;
+    header.cols = cols;
+    header.vocab_hash = vocab_hash;
+    return header;
+}
+
+void pad_to(ofstream& file, uint64_t offset) {
+    static const char zeros[EMBEDDING_SECTION_ALIGN] = {};
+    uint64_t pos = static_cast<uint64_t>(file.tellp());
+    if (offset > pos) {
+        file.write(zeros, offset - pos);
+    }
+}
+
+void pack_bits_row(const SparseEncodings& encodings, size_t row, vector<uint64_t>& bits) {
+    fill(bits.begin(), bits.end(), 0);
+    for (uint64_t k = encodings.row_offsets[row]; k < encodings.row_offsets[row + 1]; k++) {
+        uint32_t col = encodings.indices[k];
+        bits[col / 64] |= uint64_t(1) << (col % 64);
+    }
+}
+
+// Same into zeroed bytes that need not be 8-byte aligned.
+void pack_bits_row(const SparseEncodings& encodings, size_t row, char* bits) {
+    for (uint64_t k = encodings.row_offsets[row]; k < encodings.row_offsets[row + 1]; k++) {
+        uint32_t col = encodings.indices[k];
+        uint64_t word;
+        memcpy(&word, bits + col / 64 * sizeof(word), sizeof(word));
+        word |= uint64_t(1) << (col % 64);
+        memcpy(bits + col / 64 * sizeof(word), &word, sizeof(word));
+    }
+}
+
+ofstream open_output(const string& filename) {
+    ofstream file(filename, ios::binary);
+    if (!file) {
+        throw runtime_error("Cannot open file for writing: " + filename);
+    }
+    return file;
+}
+
+void open_spool(fstream& spool, const string& path) {
+    spool.open(path, ios::binary | ios::in | ios::out | ios::trunc);
+    if (!spool) {
+        throw runtime_error("Cannot open file for writing: " + path);
+    }
+}
+
+void copy_spool(fstream& spool, ofstream& file) {
+    spool.seekg(0);
+    vector<char> buffer(1 << 20);
+    while (spool.read(buffer.data(), buffer.size()) || spool.gcount() > 0) {
+        file.write(buffer.data(), spool.gcount());
+    }
+}
+
+} // namespace
+
+void write_embeddings(const string& filename,
+                      const vector<vector<float>>& encodings,
+                      uint64_t vocab_hash,
+                      const Executor& executor) {
+    TRACE_SCOPE("write_embeddings");
+    uint64_t rows = encodings.size();
+    uint64_t cols = encodings.empty() ? 0 : encodings[0].size();
+    for (const auto& row : encodings) {
+        if (row.size() != cols) {
+            throw runtime_error("Ragged encodings cannot be written: " + filename);
+        }
+    }
+
+    auto header = make_header(EmbeddingLayout::DENSE_F32, rows, cols, vocab_hash);
+    header.row_stride = cols * sizeof(float);
+    header.data_offset = align_up(sizeof(header));
+    header.data_bytes = rows * header.row_stride;
+
+    PositionalFile file(filename);
+    file.write_at(0, &header, sizeof(header));
+    write_rows(file, header.data_offset, rows, executor,
+               [&](size_t) { return header.row_stride; },
+               [&](size_t i, string& out) {
+                   out.append(reinterpret_cast<const char*>(encodings[i].data()), header.row_stride);
+               });
+    file.close();
+    TRACE_COUNT(BYTES_OUT, header.data_offset + header.data_bytes);
+}
+
+void write_embeddings(const string& filename,
+                      const SparseEncodings& encodings,
+                      EmbeddingLayout layout,
+                      uint64_t vocab_hash,
+                      const Executor& executor) {
+    TRACE_SCOPE("write_embeddings");
+    uint64_t rows = encodings.rows();
+    uint64_t cols = encodings.num_cols;
+    auto header = make_header(layout, rows, cols, vocab_hash);
+    header.data_offset = align_up(sizeof(header));
+
+    PositionalFile file(filename);
+    uint64_t end;
+
+    if (layout == EmbeddingLayout::DENSE_F32) {
+        header.row_stride = cols * sizeof(float);
+        header.data_bytes = rows * header.row_stride;
+        end = write_rows(file, header.data_offset, rows, executor,
+                         [&](size_t) { return header.row_stride; },
+                         [&](size_t i, string& out) {
+                             size_t at = out.size();
+                             out.resize(at + header.row_stride);
+                             encodings.dense_row(i, reinterpret_cast<float*>(&out[at]));
+                         });
+    } else if (layout == EmbeddingLayout::ONEHOT_BITS) {
+        header.row_stride = (cols + 63) / 64 * sizeof(uint64_t);
+        header.data_bytes = rows * header.row_stride;
+        end = write_rows(file, header.data_offset, rows, executor,
+                         [&](size_t) { return header.row_stride; },
+                         [&](size_t i, string& out) {
+                             size_t at = out.size();
+                             out.resize(at + header.row_stride, '\0');
+                             pack_bits_row(encodings, i, &out[at]);
+                         });
+    } else {
+        header.nnz = encodings.nnz();
+        header.data_bytes = header.nnz * sizeof(uint32_t);
+        header.offsets_offset = align_up(header.data_offset + header.data_bytes);
+        end = header.offsets_offset + (rows + 1) * sizeof(uint64_t);
+        write_block(file, header.data_offset, encodings.indices.data(), header.data_bytes, executor);
+        write_block(file, header.offsets_offset, encodings.row_offsets.data(),
+                    (rows + 1) * sizeof(uint64_t), executor);
+        if (encodings.has_counts()) {
+            header.flags |= EMBEDDING_FLAG_COUNTS;
+            header.counts_offset = align_up(end);
+            end = header.counts_offset + header.nnz * sizeof(float);
+            write_block(file, header.counts_offset, encodings.counts.data(),
+                        header.nnz * sizeof(float), executor);
+        }
+    }
+
+    file.write_at(0, &header, sizeof(header));
+    file.close();
+    TRACE_COUNT(BYTES_OUT, end);
+}
+
+EmbeddingStreamWriter::EmbeddingStreamWriter(const string& filename, EmbeddingLayout layout,
+                                             size_t cols, uint64_t vocab_hash, bool with_counts,
+                                             bool append)
+    : filename_(filename), header_(make_header(layout, 0, cols, vocab_hash)),
+      with_counts_(with_counts) {
+    header_.data_offset = align_up(sizeof(header_));
+    if (layout == EmbeddingLayout::DENSE_F32) {
+        header_.row_stride = cols * sizeof(float);
+    } else if (layout == EmbeddingLayout::ONEHOT_BITS) {
+        if (with_counts) {
+            throw runtime_error("Bit-packed embeddings cannot store counts: " + filename);
+        }
+        header_.row_stride = (cols + 63) / 64 * sizeof(uint64_t);
+    } else {
+        offsets_path_ = filename + ".offsets.tmp";
+        open_spool(offsets_, offsets_path_);
+        uint64_t zero = 0;
+        offsets_.write(reinterpret_cast<const char*>(&zero), sizeof(zero));
+        if (with_counts) {
+            header_.flags |= EMBEDDING_FLAG_COUNTS;
+            counts_path_ = filename + ".counts.tmp";
+            open_spool(counts_, counts_path_);
+        }
+    }
+
+    if (append && ifstream(filename).good()) {
+        EmbeddingReader existing(filename);
+        if (existing.is_legacy() || existing.layout() != layout || existing.cols() != cols ||
+            existing.vocab_hash() != vocab_hash ||
+            (existing.nnz() > 0 && existing.has_counts() != with_counts)) {
+            throw runtime_error("Cannot append to embeddings of another shape: " + filename);
+        }
+        header_.rows = existing.rows();
+        header_.nnz = existing.nnz();
+        header_.data_bytes = existing.rows() * header_.row_stride;
+        if (layout == EmbeddingLayout::SPARSE_CSR) {
+            header_.data_bytes = existing.nnz() * sizeof(uint32_t);
+            uint64_t end = 0;
+            size_t count;
+            for (size_t i = 0; i < existing.rows(); i++) {
+                existing.row_indices(i, count);
+                end += count;
+                offsets_.write(reinterpret_cast<const char*>(&end), sizeof(end));
+            }
+            // Counts are one contiguous section starting at row 0's.
+            if (with_counts && existing.nnz() > 0) {
+                counts_.write(reinterpret_cast<const char*>(existing.row_counts(0)),
+                              existing.nnz() * sizeof(float));
+            }
+        }
+        if (!offsets_path_.empty() && !offsets_) {
+            throw runtime_error("Cannot open file for writing: " + offsets_path_);
+        }
+        file_.open(filename, ios::binary | ios::in | ios::out);
+        if (!file_) {
+            throw runtime_error("Cannot open file for writing: " + filename);
+        }
+        file_.seekp(header_.data_offset + header_.data_bytes);
+        return;
+    }
+
+    // Placeholder header; the real one is written by finish()
+    file_ = open_output(filename);
+    file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    pad_to(file_, header_.data_offset);
+}
+
+EmbeddingStreamWriter::~EmbeddingStreamWriter() {
+    if (!offsets_path_.empty()) {
+        offsets_.close();
+        remove(offsets_path_.c_str());
+    }
+    if (!counts_path_.empty()) {
+        counts_.close();
+        remove(counts_path_.c_str());
+    }
+}
+
+void EmbeddingStreamWriter::append(const SparseEncodings& batch) {
+    TRACE_SCOPE("write_batch");
+    if (finished_) {
+        throw runtime_error("Embedding stream already finished: " + filename_);
+    }
+    // A batch without non-zeros has no counts either way.
+    bool counts_match = batch.nnz() == 0 || batch.has_counts() == with_counts_;
+    if (batch.num_cols != header_.cols || !counts_match) {
+        throw runtime_error("Batch does not match embedding stream: " + filename_);
+    }
+
+    size_t rows = batch.rows();
+    switch (static_cast<EmbeddingLayout>(header_.layout)) {
+    case EmbeddingLayout::DENSE_F32: {
+        vector<float> row(header_.cols);
+        for (size_t i = 0; i < rows; i++) {
+            batch.dense_row(i, row.data());
+            file_.write(reinterpret_cast<const char*>(row.data()), header_.row_stride);
+        }
+        header_.data_bytes += rows * header_.row_stride;
+        break;
+    }
+    case EmbeddingLayout::ONEHOT_BITS: {
+        vector<uint64_t> bits(header_.row_stride / sizeof(uint64_t));
+        for (size_t i = 0; i < rows; i++) {
+            pack_bits_row(batch, i, bits);
+            file_.write(reinterpret_cast<const char*>(bits.data()), header_.row_stride);
+        }
+        header_.data_bytes += rows * header_.row_stride;
+        break;
+    }
+    case EmbeddingLayout::SPARSE_CSR: {
+        file_.write(reinterpret_cast<const char*>(batch.indices.data()),
+                    batch.nnz() * sizeof(uint32_t));
+        for (size_t i = 1; i <= rows; i++) {
+            uint64_t offset = header_.nnz + batch.row_offsets[i];
+            offsets_.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        }
+        if (with_counts_) {
+            counts_.write(reinterpret_cast<const char*>(batch.counts.data()),
+                          batch.nnz() * sizeof(float));
+        }
+        header_.nnz += batch.nnz();
+        header_.data_bytes += batch.nnz() * sizeof(uint32_t);
+        break;
+    }
+    }
+    header_.rows += rows;
+
+    if (!file_ || (!offsets_path_.empty() && !offsets_) || (!counts_path_.empty() && !counts_)) {
+        throw runtime_error("Failed writing embeddings: " + filename_);
+    }
+}
+
+void EmbeddingStreamWriter::finish() {
+    if (finished_) return;
+    TRACE_SCOPE("write_finish");
+    finished_ = true;
+
+    if (static_cast<EmbeddingLayout>(header_.layout) == EmbeddingLayout::SPARSE_CSR) {
+        header_.offsets_offset = align_up(header_.data_offset + header_.data_bytes);
+        pad_to(file_, header_.offsets_offset);
+        copy_spool(offsets_, file_);
+
+        if (with_counts_) {
+            header_.counts_offset = align_up(header_.offsets_offset +
+                                             (header_.rows + 1) * sizeof(uint64_t));
+            pad_to(file_, header_.counts_offset);
+            copy_spool(counts_, file_);
+        }
+    }
+
+    TRACE_COUNT(BYTES_OUT, file_.tellp());
+    file_.seekp(0);
+    file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    file_.close();
+    if (!file_) {
+        throw runtime_error("Failed writing embeddings: " + filename_);
+    }
+}
+
+EmbeddingReader::EmbeddingReader(const string& filename) : file_(filename) {
+    memset(&header_, 0, sizeof(header_));
+
+    if (file_.size() >= sizeof(header_) &&
+        memcmp(file_.data(), EMBEDDING_MAGIC, sizeof(EMBEDDING_MAGIC)) == 0) {
+        memcpy(&header_, file_.data(), sizeof(header_));
+        if (header_.endian_tag != EMBEDDING_ENDIAN_TAG) {
+            throw runtime_error("Embedding file has foreign byte order: " + filename);
+        }
+        if (header_.version != EMBEDDING_FORMAT_VERSION) {
+            throw runtime_error("Unsupported embedding file version: " + filename);
+        }
+    } else {
+        // Legacy blob: u64 n, u64 dim, then n * dim floats.
+        if (file_.size() < 2 * sizeof(uint64_t)) {
+            throw runtime_error("Embedding file too small: " + filename);
+        }
+        legacy_ = true;
+        uint64_t dims[2];
+        memcpy(dims, file_.data(), sizeof(dims));
+        uint64_t available = file_.size() - sizeof(dims);
+        if (dims[1] > available / sizeof(float) ||
+            (dims[1] > 0 && dims[0] > available / (dims[1] * sizeof(float)))) {
+            throw runtime_error("Embedding file is truncated: " + filename);
+        }
+        header_.layout = static_cast<uint32_t>(EmbeddingLayout::DENSE_F32);
+        header_.rows = dims[0];
+        header_.cols = dims[1];
+        header_.row_stride = dims[1] * sizeof(float);
+        header_.data_offset = sizeof(dims);
+        header_.data_bytes = header_.rows * header_.row_stride;
+    }
+
+    if (header_.layout > static_cast<uint32_t>(EmbeddingLayout::SPARSE_CSR)) {
+        throw runtime_error("Unknown embedding layout in: " + filename);
+    }
+
+    // Every section must lie inside the file and hold what rows, cols and
+    // nnz promise; all sums and products are checked before they can wrap.
+    const uint64_t size = file_.size();
+    auto section_fits = [&](uint64_t offset, uint64_t count, uint64_t item_bytes) {
+        return offset % item_bytes == 0 && offset <= size && count <= (size - offset) / item_bytes;
+    };
+    bool valid = header_.data_offset >= (legacy_ ? 2 * sizeof(uint64_t) : sizeof(header_)) &&
+                 section_fits(header_.data_offset, header_.data_bytes, 1);
+    if (layout() == EmbeddingLayout::SPARSE_CSR) {
+        valid = valid && header_.rows < size &&
+                header_.nnz <= header_.data_bytes / sizeof(uint32_t) &&
+                section_fits(header_.data_offset, header_.nnz, sizeof(uint32_t)) &&
+                section_fits(header_.offsets_offset, header_.rows + 1, sizeof(uint64_t)) &&
+                (!has_counts() || section_fits(header_.counts_offset, header_.nnz, sizeof(float)));
+    } else {
+        bool bits = layout() == EmbeddingLayout::ONEHOT_BITS;
+        uint64_t word_bytes = bits ? sizeof(uint64_t) : sizeof(float);
+        uint64_t words = bits ? (header_.cols + 63) / 64 : header_.cols;
+        valid = valid && header_.cols <= size && words <= header_.row_stride / word_bytes &&
+                section_fits(header_.data_offset, 0, word_bytes) &&
+                (header_.row_stride > 0 ? header_.rows <= header_.data_bytes / header_.row_stride
+                                        : header_.cols == 0);
+    }
+    if (!valid) {
+        throw runtime_error("Embedding file is truncated or corrupt: " + filename);
+    }
+
+    // CSR rows are read through the offsets without further checks, so they
+    // must run from 0 to nnz without going backwards.
+    if (layout() == EmbeddingLayout::SPARSE_CSR) {
+        const uint64_t* offsets = reinterpret_cast<const uint64_t*>(section(header_.offsets_offset));
+        valid = offsets[0] == 0 && offsets[header_.rows] == header_.nnz;
+        for (uint64_t row = 0; row < header_.rows && valid; row++) {
+            valid = offsets[row] <= offsets[row + 1];
+        }
+        if (!valid) {
+            throw runtime_error("Corrupt CSR row offsets in: " + filename);
+        }
+    }
+}
+
+const float* EmbeddingReader::dense_row(size_t row) const {
+    return reinterpret_cast<const float*>(section(header_.data_offset + row * header_.row_stride));
+}
+
+const uint64_t* EmbeddingReader::bit_row(size_t row) const {
+    return reinterpret_cast<const uint64_t*>(section(header_.data_offset + row * header_.row_stride));
+}
+
+const uint32_t* EmbeddingReader::row_indices(size_t row, size_t& count) const {
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(section(header_.offsets_offset));
+    count = offsets[row + 1] - offsets[row];
+    return reinterpret_cast<const uint32_t*>(section(header_.data_offset)) + offsets[row];
+}
+
+const float* EmbeddingReader::row_counts(size_t row) const {
+    if (!has_counts()) return nullptr;
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(section(header_.offsets_offset));
+    return reinterpret_cast<const float*>(section(header_.counts_offset)) + offsets[row];
+}
+
+void EmbeddingReader::copy_dense_row(size_t row, float* out) const {
+    switch (layout()) {
+    case EmbeddingLayout::DENSE_F32: {
+        const float* src = dense_row(row);
+        copy(src, src + cols(), out);
+        break;
+    }
+    case EmbeddingLayout::ONEHOT_BITS: {
+        const uint64_t* bits = bit_row(row);
+        for (size_t col = 0; col < cols(); col++) {
+            out[col] = (bits[col / 64] >> (col % 64)) & 1 ? 1.0f : 0.0f;
+        }
+        break;
+    }
+    case EmbeddingLayout::SPARSE_CSR: {
+        fill(out, out + cols(), 0.0f);
+        size_t count = 0;
+        const uint32_t* idx = row_indices(row, count);
+        const float* counts = row_counts(row);
+        for (size_t k = 0; k < count; k++) {
+            if (idx[k] >= cols()) throw runtime_error("CSR column out of range");
+            out[idx[k]] = counts ? counts[k] : 1.0f;
+        }
+        break;
+    }
+    default:
+        throw runtime_error("Unknown embedding layout");
+    }
+}
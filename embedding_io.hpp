@@ -0,0 +1,127 @@
+#pragma once
+#include "parallel_encoder.hpp"
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// On-disk embedding container, version 2.
+//
+// A fixed 128-byte header is followed by 64-byte aligned sections, so every
+// section can be mmapped (or np.memmap'ed) in place. Files without the magic
+// are treated as the legacy `u64 n, u64 dim, float[n * dim]` blob.
+enum class EmbeddingLayout : uint32_t {
+    DENSE_F32 = 0,    // rows x cols float32, row_stride bytes apart
+    ONEHOT_BITS = 1,  // one bit per column, LSB first, rows padded to 8 bytes
+    SPARSE_CSR = 2    // uint64 row offsets + uint32 column indices (+ float32 counts)
+};
+
+struct EmbeddingFileHeader {
+    char magic[8];            // "SENTEMB\0"
+    uint32_t version;         // EMBEDDING_FORMAT_VERSION
+    uint32_t endian_tag;      // EMBEDDING_ENDIAN_TAG as written by the producer
+    uint32_t layout;          // EmbeddingLayout
+    uint32_t flags;           // EMBEDDING_FLAG_*
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t nnz;             // CSR only
+    uint64_t vocab_hash;      // ParallelEncoder::vocabulary_hash(), 0 if unknown
+    uint64_t data_offset;     // dense floats, packed bits or CSR indices
+    uint64_t data_bytes;
+    uint64_t offsets_offset;  // CSR row offsets (rows + 1 entries)
+    uint64_t counts_offset;   // CSR counts, 0 when absent
+    uint64_t row_stride;      // bytes per row for dense and bit layouts
+    uint8_t reserved[32];
+};
+static_assert(sizeof(EmbeddingFileHeader) == 128, "embedding header must stay 128 bytes");
+
+constexpr char EMBEDDING_MAGIC[8] = {'S', 'E', 'N', 'T', 'E', 'M', 'B', '\0'};
+constexpr uint32_t EMBEDDING_FORMAT_VERSION = 2;
+constexpr uint32_t EMBEDDING_ENDIAN_TAG = 0x01020304;
+constexpr uint32_t EMBEDDING_FLAG_COUNTS = 1u << 0;
+constexpr size_t EMBEDDING_SECTION_ALIGN = 64;
+
+// Whole-batch writers. Rows are formatted and written by up to
+// threads_for(Stage::WRITE) threads at precomputed file offsets (see
+// parallel_writer.hpp).
+void write_embeddings(const string& filename,
+                      const vector<vector<float>>& encodings,
+                      uint64_t vocab_hash = 0,
+                      const Executor& executor = Executor::global());
+void write_embeddings(const string& filename,
+                      const SparseEncodings& encodings,
+                      EmbeddingLayout layout,
+                      uint64_t vocab_hash = 0,
+                      const Executor& executor = Executor::global());
+
+// Writes a v2 file batch by batch, so only the current batch has to be in
+// memory. The header is patched in finish(). For SPARSE_CSR the row offsets
+// (and counts) are spooled to "<filename>.offsets.tmp" ("<filename>.counts.tmp")
+// and copied behind the indices at the end. with_counts says whether batches
+// carry counts; ONEHOT_BITS cannot store them.
+//
+// With append set and an existing v2 file of the same layout, columns,
+// vocab_hash and counts, new rows go after the ones already there: the
+// existing offsets and counts are spooled again and the data section is
+// extended in place. Until finish() the file is not readable, so a failed
+// append leaves it damaged; callers that append keep their own record of
+// the expected row count (see incremental.hpp).
+class EmbeddingStreamWriter {
+public:
+    EmbeddingStreamWriter(const string& filename, EmbeddingLayout layout,
+                          size_t cols, uint64_t vocab_hash = 0, bool with_counts = false,
+                          bool append = false);
+    ~EmbeddingStreamWriter();
+
+    void append(const SparseEncodings& batch);
+    void finish();
+    size_t rows() const { return header_.rows; }
+
+private:
+    string filename_;
+    string offsets_path_;
+    string counts_path_;
+    ofstream file_;
+    fstream offsets_;
+    fstream counts_;
+    EmbeddingFileHeader header_;
+    bool with_counts_;
+    bool finished_ = false;
+};
+
+// Zero-copy reader over a mapped embedding file (v2 or legacy). Row accessors
+// return pointers into the mapping, valid for the reader's lifetime.
+class EmbeddingReader {
+public:
+    explicit EmbeddingReader(const string& filename);
+
+    size_t rows() const { return header_.rows; }
+    size_t cols() const { return header_.cols; }
+    size_t nnz() const { return header_.nnz; }
+    EmbeddingLayout layout() const { return static_cast<EmbeddingLayout>(header_.layout); }
+    uint64_t vocab_hash() const { return header_.vocab_hash; }
+    bool is_legacy() const { return legacy_; }
+    bool has_counts() const { return header_.flags & EMBEDDING_FLAG_COUNTS; }
+
+    // DENSE_F32 only.
+    const float* dense_row(size_t row) const;
+    // ONEHOT_BITS only; row_stride() / 8 words per row.
+    const uint64_t* bit_row(size_t row) const;
+    size_t row_stride() const { return header_.row_stride; }
+    // SPARSE_CSR only; row_counts is null when the file has no counts.
+    const uint32_t* row_indices(size_t row, size_t& count) const;
+    const float* row_counts(size_t row) const;
+
+    // Expand any layout into cols() floats.
+    void copy_dense_row(size_t row, float* out) const;
+
+private:
+    const char* section(uint64_t offset) const { return file_.data() + offset; }
+
+    MappedFile file_;
+    EmbeddingFileHeader header_;
+    bool legacy_ = false;
+};
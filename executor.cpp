@@ -0,0 +1,34 @@
+#include "executor.hpp"
+
+Executor::Executor(int threads, size_t grain)
+    : threads_(max(1, threads)), grain_(max<size_t>(1, grain)) {}
+
+const Executor& Executor::global() {
+    static const Executor executor;
+    return executor;
+}
+
+void Executor::set_stage_limit(Stage stage, int limit) {
+    limits_[static_cast<int>(stage)] = max(0, limit);
+}
+
+void Executor::share(initializer_list<Stage> stages) {
+    if (stages.size() == 0) return;
+    int parts = static_cast<int>(stages.size());
+    int index = 0;
+    for (Stage stage : stages) {
+        // The first threads_ % parts stages get the leftover threads.
+        int share = threads_ / parts + (index++ < threads_ % parts ? 1 : 0);
+        set_stage_limit(stage, max(1, share));
+    }
+}
+
+int Executor::threads_for(Stage stage) const {
+    int limit = limits_[static_cast<int>(stage)];
+    return limit > 0 ? min(limit, threads_) : threads_;
+}
+
+int Executor::threads_for(Stage stage, size_t rows) const {
+    size_t grains = (rows + grain_ - 1) / grain_;
+    return static_cast<int>(max<size_t>(1, min<size_t>(threads_for(stage), grains)));
+}
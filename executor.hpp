@@ -0,0 +1,104 @@
+#pragma once
+#include <omp.h>
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
+
+using namespace std;
+
+// Pipeline stages that run parallel regions, for per-stage thread limits.
+enum class Stage { LOAD, CLEAN, COUNT, ENCODE, PREDICT, WRITE, NUM_STAGES };
+
+// Contiguous row ranges of about equal cost, handed out one at a time with
+// schedule(dynamic, 1) so a run of long tweets cannot stall one thread.
+// Task t covers rows [bounds[t], bounds[t + 1]).
+struct RowTasks {
+    int threads = 1;
+    vector<size_t> bounds{0};
+
+    size_t size() const { return bounds.size() - 1; }
+    size_t rows() const { return bounds.back(); }
+    size_t begin(size_t task) const { return bounds[task]; }
+    size_t end(size_t task) const { return bounds[task + 1]; }
+};
+
+// Shared execution context for the parallel stages. Components take one
+// and pass its limits to every parallel region's num_threads clause, so no
+// constructor has to change OpenMP's global thread count (where the last
+// object built would win for everyone, the sequential baseline included).
+// OpenMP keeps its worker threads alive between regions; the executor only
+// decides how many of them each stage may use.
+class Executor {
+public:
+    explicit Executor(int threads = omp_get_max_threads(), size_t grain = 64);
+
+    // Executor for callers that are not given one; sized by OMP_NUM_THREADS
+    // or the hardware.
+    static const Executor& global();
+
+    int threads() const { return threads_; }
+    // Smallest number of rows worth handing to a thread.
+    size_t grain() const { return grain_; }
+    void set_grain(size_t grain) { grain_ = max<size_t>(1, grain); }
+
+    // Cap a stage below the budget; 0 lifts the cap.
+    void set_stage_limit(Stage stage, int limit);
+    // Split the budget evenly between stages that run at the same time
+    // (at least one thread each), so together they do not oversubscribe.
+    void share(initializer_list<Stage> stages);
+
+    // Threads the stage may use: its limit, or the whole budget.
+    int threads_for(Stage stage) const;
+    // Team size for a region of stage over rows rows: no more threads than
+    // there are grains of work.
+    int threads_for(Stage stage, size_t rows) const;
+
+    // Split rows into tasks of roughly equal total cost(i) (e.g. text
+    // length), a few per thread and at least grain rows each.
+    template <typename Cost>
+    RowTasks plan(Stage stage, size_t rows, Cost cost) const;
+    // Same, into tasks, whose bounds keep their capacity between calls.
+    template <typename Cost>
+    void plan(Stage stage, size_t rows, Cost cost, RowTasks& tasks) const;
+
+private:
+    static constexpr size_t TASKS_PER_THREAD = 4;
+
+    int threads_;
+    size_t grain_;
+    int limits_[static_cast<int>(Stage::NUM_STAGES)] = {};
+};
+
+template <typename Cost>
+RowTasks Executor::plan(Stage stage, size_t rows, Cost cost) const {
+    RowTasks tasks;
+    plan(stage, rows, cost, tasks);
+    return tasks;
+}
+
+template <typename Cost>
+void Executor::plan(Stage stage, size_t rows, Cost cost, RowTasks& tasks) const {
+    tasks.bounds.assign(1, 0);
+    tasks.threads = threads_for(stage, rows);
+    if (tasks.threads == 1) {
+        if (rows > 0) tasks.bounds.push_back(rows);
+        return;
+    }
+
+    // Every row costs at least 1, so runs of empty rows still get split.
+    size_t total = 0;
+    for (size_t i = 0; i < rows; i++) total += cost(i) + 1;
+    size_t target = max<size_t>(1, total / (tasks.threads * TASKS_PER_THREAD));
+
+    size_t load = 0, start = 0;
+    for (size_t i = 0; i < rows; i++) {
+        load += cost(i) + 1;
+        if (load >= target && i + 1 - start >= grain_) {
+            tasks.bounds.push_back(i + 1);
+            start = i + 1;
+            load = 0;
+        }
+    }
+    if (start < rows) tasks.bounds.push_back(rows);
+}
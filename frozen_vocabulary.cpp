@@ -0,0 +1,227 @@
+#include "frozen_vocabulary.hpp"
+#include "hash_utils.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+constexpr uint64_t SECTION_ALIGN = 64;
+
+uint64_t align_up(uint64_t value) {
+    return (value + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN;
+}
+
+void pad_to(ofstream& file, uint64_t offset) {
+    static const char zeros[SECTION_ALIGN] = {};
+    uint64_t pos = static_cast<uint64_t>(file.tellp());
+    if (offset > pos) {
+        file.write(zeros, offset - pos);
+    }
+}
+
+} // namespace
+
+FrozenVocabulary::FrozenVocabulary(const vector<string>& words, const vector<uint64_t>& counts) {
+    if (!counts.empty() && counts.size() != words.size()) {
+        throw runtime_error("Vocabulary counts do not match its words");
+    }
+
+    auto storage = make_shared<Storage>();
+    size_t total = 0;
+    for (const auto& w : words) total += w.size();
+    storage->keys.reserve(total);
+    storage->key_offsets.reserve(words.size() + 1);
+    for (const auto& w : words) {
+        storage->keys += w;
+        storage->key_offsets.push_back(static_cast<uint32_t>(storage->keys.size()));
+    }
+    storage->counts = counts;
+
+    size_t capacity = 16;
+    while (capacity < words.size() * 2) capacity <<= 1;
+    storage->slots.assign(capacity, Slot{0, 0, 0});
+
+    // Point the views at the storage first: matches() reads words through them.
+    slots_ = storage->slots.data();
+    mask_ = capacity - 1;
+    keys_ = storage->keys.data();
+    key_offsets_ = storage->key_offsets.data();
+    counts_ = storage->counts.empty() ? nullptr : storage->counts.data();
+    size_ = words.size();
+
+    vector<Slot>& slots = storage->slots;
+    for (size_t id = 0; id < words.size(); id++) {
+        const string& key = words[id];
+        uint64_t prefix = prefix_of(key);
+        size_t pos = hash_bytes(key) & mask_;
+        while (slots[pos].id != 0) {
+            if (matches(slots[pos], key, prefix)) {
+                throw runtime_error("Duplicate vocabulary word: " + key);
+            }
+            pos = (pos + 1) & mask_;
+        }
+        slots[pos] = Slot{static_cast<uint32_t>(id + 1), static_cast<uint32_t>(key.size()), prefix};
+    }
+
+    storage_ = move(storage);
+    content_hash_ = compute_content_hash();
+}
+
+uint64_t FrozenVocabulary::prefix_of(string_view word) {
+    uint64_t prefix = 0;
+    if (word.size() >= sizeof(prefix)) {
+        memcpy(&prefix, word.data(), sizeof(prefix));
+        return prefix;
+    }
+    for (size_t i = 0; i < word.size(); i++) {
+        prefix |= uint64_t(static_cast<unsigned char>(word[i])) << (8 * i);
+    }
+    return prefix;
+}
+
+bool FrozenVocabulary::matches(const Slot& slot, string_view key, uint64_t prefix) const {
+    if (slot.length != key.size() || slot.prefix != prefix) return false;
+    if (key.size() <= sizeof(prefix)) return true;
+    return word(slot.id - 1).substr(sizeof(prefix)) == key.substr(sizeof(prefix));
+}
+
+int FrozenVocabulary::find(string_view key) const {
+    if (!slots_) return -1;
+
+    uint64_t prefix = prefix_of(key);
+    size_t pos = hash_bytes(key) & mask_;
+    while (true) {
+        const Slot& slot = slots_[pos];
+        if (slot.id == 0) return -1;
+        if (matches(slot, key, prefix)) return static_cast<int>(slot.id - 1);
+        pos = (pos + 1) & mask_;
+    }
+}
+
+uint64_t FrozenVocabulary::compute_content_hash() const {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t id = 0; id < size_; id++) {
+        for (unsigned char c : word(id)) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+        hash = (hash ^ 0) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+void FrozenVocabulary::save(const string& filename) const {
+    VocabularyFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, VOCABULARY_MAGIC, sizeof(header.magic));
+    header.version = VOCABULARY_FORMAT_VERSION;
+    header.endian_tag = VOCABULARY_ENDIAN_TAG;
+    header.hash_version = HASH_BYTES_VERSION;
+    header.words = size_;
+    header.slots = slots_ ? mask_ + 1 : 0;
+    header.content_hash = content_hash_;
+    header.keys_bytes = key_offsets_[size_];
+    header.slots_offset = align_up(sizeof(header));
+    header.offsets_offset = align_up(header.slots_offset + header.slots * sizeof(Slot));
+    header.keys_offset = align_up(header.offsets_offset + (size_ + 1) * sizeof(uint32_t));
+    header.counts_offset = counts_ ? align_up(header.keys_offset + header.keys_bytes) : 0;
+
+    ofstream file(filename, ios::binary);
+    if (!file) {
+        throw runtime_error("Cannot open file for writing: " + filename);
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    pad_to(file, header.slots_offset);
+    file.write(reinterpret_cast<const char*>(slots_), header.slots * sizeof(Slot));
+    pad_to(file, header.offsets_offset);
+    file.write(reinterpret_cast<const char*>(key_offsets_), (size_ + 1) * sizeof(uint32_t));
+    pad_to(file, header.keys_offset);
+    file.write(keys_, header.keys_bytes);
+    if (counts_) {
+        pad_to(file, header.counts_offset);
+        file.write(reinterpret_cast<const char*>(counts_), size_ * sizeof(uint64_t));
+    }
+    if (!file) {
+        throw runtime_error("Failed writing vocabulary: " + filename);
+    }
+}
+
+FrozenVocabulary FrozenVocabulary::load(const string& filename) {
+    auto storage = make_shared<Storage>();
+    storage->file = MappedFile(filename);
+    const MappedFile& file = storage->file;
+
+    VocabularyFileHeader header;
+    if (file.size() < sizeof(header)) {
+        throw runtime_error("Not a vocabulary file: " + filename);
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, VOCABULARY_MAGIC, sizeof(header.magic)) != 0) {
+        throw runtime_error("Not a vocabulary file: " + filename);
+    }
+    if (header.endian_tag != VOCABULARY_ENDIAN_TAG) {
+        throw runtime_error("Vocabulary written with a different byte order: " + filename);
+    }
+    if (header.version != VOCABULARY_FORMAT_VERSION) {
+        throw runtime_error("Unsupported vocabulary version " + to_string(header.version) +
+                            ": " + filename);
+    }
+    if (header.hash_version != HASH_BYTES_VERSION) {
+        throw runtime_error("Vocabulary built with an incompatible hash function: " + filename);
+    }
+
+    auto section_fits = [&](uint64_t offset, uint64_t count, uint64_t item_bytes) {
+        return offset % SECTION_ALIGN == 0 && offset <= file.size() &&
+               count <= (file.size() - offset) / item_bytes;
+    };
+    bool valid = (header.slots & (header.slots - 1)) == 0 &&
+                 header.words < UINT32_MAX && header.slots / 2 >= header.words &&
+                 section_fits(header.slots_offset, header.slots, sizeof(Slot)) &&
+                 section_fits(header.offsets_offset, header.words + 1, sizeof(uint32_t)) &&
+                 section_fits(header.keys_offset, header.keys_bytes, 1) &&
+                 (header.counts_offset == 0 ||
+                  section_fits(header.counts_offset, header.words, sizeof(uint64_t)));
+    if (!valid) {
+        throw runtime_error("Corrupt vocabulary file: " + filename);
+    }
+
+    FrozenVocabulary vocab;
+    const char* base = file.data();
+    vocab.slots_ = header.slots ? reinterpret_cast<const Slot*>(base + header.slots_offset) : nullptr;
+    vocab.mask_ = header.slots ? header.slots - 1 : 0;
+    vocab.keys_ = base + header.keys_offset;
+    vocab.key_offsets_ = reinterpret_cast<const uint32_t*>(base + header.offsets_offset);
+    vocab.counts_ = header.counts_offset
+                        ? reinterpret_cast<const uint64_t*>(base + header.counts_offset)
+                        : nullptr;
+    vocab.size_ = header.words;
+
+    // Offsets and slot ids must stay inside their sections, and the words
+    // must be what the producer hashed. Every word owns exactly one slot,
+    // so at least half the table is empty and find() always stops.
+    for (size_t id = 0; id < vocab.size_; id++) {
+        if (vocab.key_offsets_[id] > vocab.key_offsets_[id + 1]) valid = false;
+    }
+    if (!valid || vocab.key_offsets_[0] != 0 || vocab.key_offsets_[vocab.size_] != header.keys_bytes) {
+        throw runtime_error("Corrupt vocabulary file: " + filename);
+    }
+    vector<bool> placed(vocab.size_, false);
+    for (size_t pos = 0; pos < header.slots && valid; pos++) {
+        const Slot& slot = vocab.slots_[pos];
+        if (slot.id == 0) continue;
+        valid = slot.id <= vocab.size_ && !placed[slot.id - 1] &&
+                slot.length == vocab.word(slot.id - 1).size();
+        if (valid) placed[slot.id - 1] = true;
+    }
+    if (!valid || std::find(placed.begin(), placed.end(), false) != placed.end()) {
+        throw runtime_error("Corrupt vocabulary file: " + filename);
+    }
+    vocab.content_hash_ = vocab.compute_content_hash();
+    if (vocab.content_hash_ != header.content_hash) {
+        throw runtime_error("Vocabulary content hash mismatch: " + filename);
+    }
+
+    vocab.storage_ = move(storage);
+    return vocab;
+}
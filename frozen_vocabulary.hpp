@@ -0,0 +1,105 @@
+#pragma once
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// On-disk vocabulary, version 1. A 128-byte header is followed by 64-byte
+// aligned sections holding the lookup table exactly as it sits in memory, so
+// loading is an mmap plus header checks - no hashing or counting pass.
+struct VocabularyFileHeader {
+    char magic[8];            // "SENTVOC\0"
+    uint32_t version;         // VOCABULARY_FORMAT_VERSION
+    uint32_t endian_tag;      // VOCABULARY_ENDIAN_TAG as written by the producer
+    uint32_t hash_version;    // HASH_BYTES_VERSION the slot table was built with
+    uint32_t reserved0;
+    uint64_t words;
+    uint64_t slots;           // power of two
+    uint64_t content_hash;    // FrozenVocabulary::content_hash()
+    uint64_t slots_offset;    // slots x 16-byte Slot
+    uint64_t offsets_offset;  // (words + 1) x uint32 key offsets
+    uint64_t keys_offset;     // interned words, back to back
+    uint64_t keys_bytes;
+    uint64_t counts_offset;   // words x uint64 frequencies
+    uint8_t reserved[40];
+};
+static_assert(sizeof(VocabularyFileHeader) == 128, "vocabulary header must stay 128 bytes");
+
+constexpr char VOCABULARY_MAGIC[8] = {'S', 'E', 'N', 'T', 'V', 'O', 'C', '\0'};
+constexpr uint32_t VOCABULARY_FORMAT_VERSION = 1;
+constexpr uint32_t VOCABULARY_ENDIAN_TAG = 0x01020304;
+
+// Read-only word -> id table, built once after the vocabulary is chosen.
+//
+// Words are interned back to back in one buffer. Lookups go through an
+// open-addressing table (linear probing, load factor <= 0.5) of 16-byte
+// slots that carry the word length and its first eight bytes inline, so
+// words of up to eight bytes - most tokens - are matched or rejected
+// without leaving the slot's cache line. Lookups take string_view, so the
+// encode loop never materializes a std::string.
+//
+// The table is immutable once built, so copies share it. A table loaded
+// from disk points straight into the mapped file.
+class FrozenVocabulary {
+public:
+    FrozenVocabulary() = default;
+    // Word i gets id i. Words must be distinct. counts, if given, holds the
+    // corpus frequency of each word and is saved alongside it.
+    explicit FrozenVocabulary(const vector<string>& words, const vector<uint64_t>& counts = {});
+
+    // Throws runtime_error on I/O failure or if the file is not a vocabulary
+    // this build can use.
+    static FrozenVocabulary load(const string& filename);
+    void save(const string& filename) const;
+
+    // Id of word, or -1 when it is not in the vocabulary.
+    int find(string_view word) const;
+    string_view word(size_t id) const {
+        return string_view(keys_ + key_offsets_[id], key_offsets_[id + 1] - key_offsets_[id]);
+    }
+    // Frequency of word `id` when the vocabulary was built, 0 if unknown.
+    uint64_t count(size_t id) const { return counts_ ? counts_[id] : 0; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Stable fingerprint of the id -> word mapping: FNV-1a over the words in
+    // id order, each terminated by a NUL byte.
+    uint64_t content_hash() const { return content_hash_; }
+
+private:
+    struct Slot {
+        uint32_t id;      // id + 1, 0 marks an empty slot
+        uint32_t length;
+        uint64_t prefix;  // first eight bytes of the word, zero padded
+    };
+    static_assert(sizeof(Slot) == 16, "slots are stored on disk as-is");
+
+    // Backing memory: either the vectors filled by the constructor or a
+    // mapped vocabulary file.
+    struct Storage {
+        vector<Slot> slots;
+        string keys;
+        vector<uint32_t> key_offsets{0};
+        vector<uint64_t> counts;
+        MappedFile file;
+    };
+
+    static uint64_t prefix_of(string_view word);
+    bool matches(const Slot& slot, string_view key, uint64_t prefix) const;
+    uint64_t compute_content_hash() const;
+
+    shared_ptr<const Storage> storage_;
+    const Slot* slots_ = nullptr;
+    uint64_t mask_ = 0;
+    const char* keys_ = nullptr;
+    const uint32_t* key_offsets_ = empty_offsets;
+    const uint64_t* counts_ = nullptr;
+    size_t size_ = 0;
+    uint64_t content_hash_ = 1469598103934665603ULL;  // FNV basis: no words
+
+    static constexpr uint32_t empty_offsets[1] = {0};
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+using namespace std;
+
+// Bumped whenever hash_bytes changes, since tables persisted to disk (see
+// VocabularyFileHeader) are laid out by it.
+constexpr uint32_t HASH_BYTES_VERSION = 1;
+
+// Fast non-cryptographic hash for short keys such as tokens. Reads eight
+// bytes at a time and finishes with a murmur-style avalanche, so the low
+// bits are good enough to index a power-of-two table directly.
+inline uint64_t hash_bytes(string_view key, uint64_t seed = 0) {
+    const uint64_t mul = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = seed ^ (key.size() * mul);
+    const char* p = key.data();
+    size_t n = key.size();
+
+    while (n >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * mul;
+        h ^= h >> 32;
+        p += 8;
+        n -= 8;
+    }
+    if (n > 0) {
+        uint64_t word = 0;
+        for (size_t i = 0; i < n; i++) {
+            word |= uint64_t(static_cast<unsigned char>(p[i])) << (8 * i);
+        }
+        h = (h ^ word) * mul;
+        h ^= h >> 32;
+    }
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
@@ -0,0 +1,327 @@
+#include "incremental.hpp"
+#include "csv_loader.hpp"
+#include "embedding_io.hpp"
+#include "hash_utils.hpp"
+#include "instrumentation.hpp"
+#include "mapped_file.hpp"
+#include "token_counter.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace {
+
+constexpr const char* CHECKPOINT_MAGIC = "sentiment-checkpoint";
+constexpr int CHECKPOINT_VERSION = 1;
+constexpr size_t FINGERPRINT_WINDOW = size_t(64) << 10;
+
+TweetSchema schema_named(const string& name) {
+    if (name == "cpp_export") return TweetSchema::cpp_export();
+    if (name == "twitter_raw") return TweetSchema::twitter_raw();
+    throw invalid_argument("Unknown schema: " + name);
+}
+
+uint64_t fingerprint_of(const MappedFile& file, size_t offset) {
+    const char* data = file.data();
+    string_view head(data, min(offset, FINGERPRINT_WINDOW));
+    size_t tail_start = offset - min(offset, FINGERPRINT_WINDOW);
+    string_view tail(data + tail_start, offset - tail_start);
+    return hash_bytes(tail, hash_bytes(head, offset));
+}
+
+// One past the last newline outside quotes at or after offset, which must
+// be a record start; offset itself if no record there is complete yet.
+size_t complete_records_end(const MappedFile& file, size_t offset) {
+    const char* data = file.data();
+    size_t end = offset;
+    size_t quotes = 0;
+    for (size_t i = offset; i < file.size(); i++) {
+        if (data[i] == '"') quotes++;
+        else if (data[i] == '\n' && quotes % 2 == 0) end = i + 1;
+    }
+    return end;
+}
+
+void rename_over(const string& from, const string& to) {
+    if (rename(from.c_str(), to.c_str()) != 0) {
+        throw runtime_error("Cannot replace " + to + ": " + strerror(errno));
+    }
+}
+
+uint64_t total_count(const FrozenVocabulary& counts) {
+    uint64_t total = 0;
+    for (size_t id = 0; id < counts.size(); id++) total += counts.count(id);
+    return total;
+}
+
+// Save every counted word, most frequent first, and return the total.
+uint64_t save_counts(const ShardedTokenCounter& counter, const string& path) {
+    vector<string> words;
+    vector<uint64_t> counts;
+    for (auto& entry : counter.top_k(counter.distinct())) {
+        words.push_back(move(entry.first));
+        counts.push_back(entry.second);
+    }
+    FrozenVocabulary(words, counts).save(path + ".tmp");
+    rename_over(path + ".tmp", path);
+    return counter.total();
+}
+
+// counts.voc is ranked like ParallelEncoder::build_vocabulary (count desc,
+// word asc), so the vocabulary is its first vocab_size words.
+FrozenVocabulary freeze(const FrozenVocabulary& counts, size_t vocab_size, const string& path) {
+    vector<string> words;
+    vector<uint64_t> frequencies;
+    for (size_t id = 0; id < min(vocab_size, counts.size()); id++) {
+        words.emplace_back(counts.word(id));
+        frequencies.push_back(counts.count(id));
+    }
+    FrozenVocabulary vocabulary(words, frequencies);
+    vocabulary.save(path);
+    return vocabulary;
+}
+
+// The checkpoint describes the input and the outputs as they are now, or
+// the last run stopped part way and the work directory must be rebuilt.
+FrozenVocabulary check_workdir(const Checkpoint& checkpoint, const string& workdir,
+                               const MappedFile& input) {
+    if (input.size() < checkpoint.offset ||
+        fingerprint_of(input, checkpoint.offset) != checkpoint.fingerprint) {
+        throw runtime_error("Input changed before the checkpointed offset, not only appended to: " +
+                            checkpoint.input);
+    }
+    FrozenVocabulary counts = FrozenVocabulary::load(incremental_counts_path(workdir));
+    string output = incremental_output_path(workdir, checkpoint.vocab_version);
+    EmbeddingReader embeddings(output);
+    if (total_count(counts) != checkpoint.tokens || embeddings.rows() != checkpoint.rows ||
+        embeddings.nnz() != checkpoint.nnz || embeddings.vocab_hash() != checkpoint.vocab_hash) {
+        throw runtime_error("Work directory does not match its checkpoint (interrupted run?): " +
+                            workdir);
+    }
+    return counts;
+}
+
+// Count every token of the records in [0, end) without encoding them.
+size_t count_records(const string& input, const TweetSchema& schema, size_t end,
+                     TextPreprocessor& preprocessor, ShardedTokenCounter& counter,
+                     size_t batch_size) {
+    TRACE_SCOPE("count_records");
+    CsvReader reader(input, schema.has_header, 0, end);
+    TweetProjector projector(schema, reader.header());
+    vector<string_view> records;
+    TweetBatch tweets;
+    TokenizedBatch cleaned;
+    CleanWorkspace workspace;
+    int record_number = 0;
+
+    while (true) {
+        records.clear();
+        if (reader.next_records(batch_size, records) == 0) break;
+        tweets.clear();
+        for (auto record : records) projector.project(record, ++record_number, tweets);
+        preprocessor.preprocess_tokenized(tweets, cleaned, workspace);
+        count_tokens(cleaned, counter, preprocessor.executor());
+        reader.release_consumed();
+    }
+    return record_number;
+}
+
+void finish_checkpoint(Checkpoint& checkpoint, const string& workdir, const MappedFile& input) {
+    checkpoint.fingerprint = fingerprint_of(input, checkpoint.offset);
+    EmbeddingReader embeddings(incremental_output_path(workdir, checkpoint.vocab_version));
+    checkpoint.rows = embeddings.rows();
+    checkpoint.nnz = embeddings.nnz();
+    checkpoint.save(checkpoint_path(workdir));
+}
+
+} // namespace
+
+bool Checkpoint::load(const string& filename, Checkpoint& out) {
+    ifstream in(filename);
+    if (!in) return false;
+
+    map<string, string> values;
+    string key, value;
+    while (in >> key && getline(in, value)) {
+        values[key] = value.empty() ? value : value.substr(1);
+    }
+    auto get = [&](const string& name) -> const string& {
+        auto it = values.find(name);
+        if (it == values.end()) throw runtime_error("Checkpoint has no " + name + ": " + filename);
+        return it->second;
+    };
+    if (get(CHECKPOINT_MAGIC) != to_string(CHECKPOINT_VERSION)) {
+        throw runtime_error("Unsupported checkpoint version: " + filename);
+    }
+    out.input = get("input");
+    out.schema = get("schema");
+    out.offset = stoull(get("offset"));
+    out.fingerprint = stoull(get("fingerprint"));
+    out.records = stoull(get("records"));
+    out.tokens = stoull(get("tokens"));
+    out.rows = stoull(get("rows"));
+    out.nnz = stoull(get("nnz"));
+    out.vocab_version = static_cast<uint32_t>(stoul(get("vocab_version")));
+    out.vocab_hash = stoull(get("vocab_hash"));
+    out.vocab_size = stoull(get("vocab_size"));
+    return true;
+}
+
+void Checkpoint::save(const string& filename) const {
+    string temp = filename + ".tmp";
+    {
+        ofstream out(temp);
+        if (!out) throw runtime_error("Cannot open file for writing: " + temp);
+        out << CHECKPOINT_MAGIC << " " << CHECKPOINT_VERSION << "\n"
+            << "input " << input << "\n"
+            << "schema " << schema << "\n"
+            << "offset " << offset << "\n"
+            << "fingerprint " << fingerprint << "\n"
+            << "records " << records << "\n"
+            << "tokens " << tokens << "\n"
+            << "rows " << rows << "\n"
+            << "nnz " << nnz << "\n"
+            << "vocab_version " << vocab_version << "\n"
+            << "vocab_hash " << vocab_hash << "\n"
+            << "vocab_size " << vocab_size << "\n";
+        out.close();
+        if (!out) throw runtime_error("Failed writing checkpoint: " + temp);
+    }
+    rename_over(temp, filename);
+}
+
+string checkpoint_path(const string& workdir) {
+    return workdir + "/checkpoint";
+}
+
+string incremental_counts_path(const string& workdir) {
+    return workdir + "/counts.voc";
+}
+
+string incremental_vocabulary_path(const string& workdir, uint32_t version) {
+    return workdir + "/vocab-" + to_string(version) + ".voc";
+}
+
+string incremental_output_path(const string& workdir, uint32_t version) {
+    return workdir + "/embeddings-" + to_string(version) + ".bin";
+}
+
+uint64_t input_fingerprint(const string& input, size_t offset) {
+    MappedFile file(input);
+    if (offset > file.size()) {
+        throw out_of_range("Offset " + to_string(offset) + " past the end of " + input);
+    }
+    return fingerprint_of(file, offset);
+}
+
+IncrementalStats run_incremental(const string& input, const string& workdir,
+                                 TextPreprocessor& preprocessor, ParallelEncoder& encoder,
+                                 StreamingOptions options, const string& schema_name,
+                                 size_t vocab_size) {
+    TRACE_SCOPE("run_incremental");
+    if (options.dedup_bytes > 0) {
+        throw invalid_argument("Incremental runs count tokens and cannot deduplicate");
+    }
+    mkdir(workdir.c_str(), 0755);
+    options.schema = schema_named(schema_name);
+
+    IncrementalStats stats;
+    Checkpoint& checkpoint = stats.checkpoint;
+    stats.first_run = !Checkpoint::load(checkpoint_path(workdir), checkpoint);
+    MappedFile file(input);
+    FrozenVocabulary counts;
+    if (stats.first_run) {
+        checkpoint.input = input;
+        checkpoint.schema = schema_name;
+        checkpoint.vocab_size = vocab_size;
+    } else {
+        if (checkpoint.input != input || checkpoint.schema != schema_name) {
+            throw runtime_error("Work directory belongs to " + checkpoint.input + " (" +
+                                checkpoint.schema + "): " + workdir);
+        }
+        counts = check_workdir(checkpoint, workdir, file);
+    }
+
+    size_t end = complete_records_end(file, checkpoint.offset);
+    if (end == checkpoint.offset) return stats;
+    options.byte_end = end;
+
+    const Executor& executor = preprocessor.executor();
+    ShardedTokenCounter counter(executor.threads_for(Stage::COUNT));
+    string output = incremental_output_path(workdir, max<uint32_t>(checkpoint.vocab_version, 1));
+
+    if (stats.first_run) {
+        // Nothing to encode against yet: count everything, then freeze v1.
+        stats.records = count_records(input, options.schema, end, preprocessor, counter,
+                                      options.batch_size);
+        counter.merge();
+        checkpoint.tokens = save_counts(counter, incremental_counts_path(workdir));
+        counts = FrozenVocabulary::load(incremental_counts_path(workdir));
+        checkpoint.vocab_version = 1;
+        checkpoint.vocab_hash = freeze(counts, vocab_size, incremental_vocabulary_path(workdir, 1))
+                                    .content_hash();
+        encoder.load_vocabulary(incremental_vocabulary_path(workdir, 1));
+        stats.stream = run_streaming_pipeline(input, output, preprocessor, encoder, options);
+    } else {
+        encoder.load_vocabulary(incremental_vocabulary_path(workdir, checkpoint.vocab_version));
+        if (encoder.vocabulary_hash() != checkpoint.vocab_hash) {
+            throw runtime_error("Vocabulary version " + to_string(checkpoint.vocab_version) +
+                                " does not match the checkpoint: " + workdir);
+        }
+
+        // Seed the counter with the saved counts (views into the mapped
+        // file, which outlives it), then count the new records while they
+        // are encoded.
+        int threads = executor.threads_for(Stage::COUNT);
+        #pragma omp parallel for schedule(static) num_threads(threads)
+        for (size_t id = 0; id < counts.size(); id++) {
+            counter.add(omp_get_thread_num(), counts.word(id), counts.count(id));
+        }
+        options.byte_begin = checkpoint.offset;
+        options.begin_at_record = true;
+        options.first_record = static_cast<int>(checkpoint.records);
+        options.counter = &counter;
+        options.append_output = true;
+        stats.stream = run_streaming_pipeline(input, output, preprocessor, encoder, options);
+        stats.records = stats.stream.records;
+        counter.merge();
+        checkpoint.tokens = save_counts(counter, incremental_counts_path(workdir));
+    }
+
+    stats.new_bytes = end - checkpoint.offset;
+    checkpoint.offset = end;
+    checkpoint.records += stats.records;
+    finish_checkpoint(checkpoint, workdir, file);
+    return stats;
+}
+
+Checkpoint refreeze_vocabulary(const string& workdir, TextPreprocessor& preprocessor,
+                               ParallelEncoder& encoder, StreamingOptions options,
+                               size_t vocab_size) {
+    TRACE_SCOPE("refreeze_vocabulary");
+    Checkpoint checkpoint;
+    if (!Checkpoint::load(checkpoint_path(workdir), checkpoint)) {
+        throw runtime_error("No checkpoint to refreeze in: " + workdir);
+    }
+    MappedFile file(checkpoint.input);
+    FrozenVocabulary counts = check_workdir(checkpoint, workdir, file);
+    if (vocab_size > 0) checkpoint.vocab_size = vocab_size;
+
+    uint32_t version = checkpoint.vocab_version + 1;
+    string vocabulary_path = incremental_vocabulary_path(workdir, version);
+    checkpoint.vocab_hash = freeze(counts, checkpoint.vocab_size, vocabulary_path).content_hash();
+    encoder.load_vocabulary(vocabulary_path);
+
+    options.schema = schema_named(checkpoint.schema);
+    options.byte_end = checkpoint.offset;
+    run_streaming_pipeline(checkpoint.input, incremental_output_path(workdir, version),
+                           preprocessor, encoder, options);
+    checkpoint.vocab_version = version;
+    finish_checkpoint(checkpoint, workdir, file);
+    return checkpoint;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "preprocessor.hpp"
+#include "parallel_encoder.hpp"
+#include "streaming_pipeline.hpp"
+#include "frozen_vocabulary.hpp"
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Incremental processing of an input CSV that only ever grows at the end,
+// such as a log of collected tweets. Every run picks up at the checkpointed
+// byte offset, so only records appended since the last run are parsed,
+// cleaned and encoded. The work directory holds:
+//
+//   checkpoint         offset, input fingerprint and totals of the last run
+//   counts.voc         frequency of every token seen so far
+//   vocab-<v>.voc      frozen vocabulary version v
+//   embeddings-<v>.bin every row so far, encoded against vocab-<v>.voc
+//
+// A run appends new rows to the current embeddings file and adds their
+// tokens to counts.voc, but never changes the vocabulary: ids stay fixed
+// so rows written earlier remain valid. refreeze_vocabulary() is the
+// explicit step that picks a new vocabulary from the counts as the next
+// version and re-encodes the input into a new embeddings file, leaving the
+// old version's files untouched.
+//
+// Only records ended by a newline are taken; a record still being written
+// at the end of the file is left for the next run. Vocabulary mode only:
+// feature hashing has no vocabulary to keep up to date, so an appended
+// file can simply be streamed with --hash from the checkpointed offset.
+
+struct Checkpoint {
+    string input;
+    string schema;                // "cpp_export" or "twitter_raw"
+    size_t offset = 0;            // first input byte not processed yet
+    uint64_t fingerprint = 0;     // input_fingerprint(input, offset)
+    uint64_t records = 0;         // records read so far; ids of id-less rows continue here
+    uint64_t tokens = 0;          // sum of counts.voc, to notice a half-saved run
+    uint64_t rows = 0;            // rows and nnz of the current embeddings file
+    uint64_t nnz = 0;
+    uint32_t vocab_version = 0;
+    uint64_t vocab_hash = 0;      // FrozenVocabulary::content_hash() of that version
+    size_t vocab_size = 5000;     // words kept when freezing
+
+    // Returns false if there is no checkpoint yet; throws if it is unreadable.
+    static bool load(const string& filename, Checkpoint& out);
+    // Written to a temporary file and renamed over the old checkpoint.
+    void save(const string& filename) const;
+};
+
+string checkpoint_path(const string& workdir);
+string incremental_counts_path(const string& workdir);
+string incremental_vocabulary_path(const string& workdir, uint32_t version);
+string incremental_output_path(const string& workdir, uint32_t version);
+
+// Hash of the input's first 64 KB and of the 64 KB before offset, together
+// with offset, so a truncated or rewritten input is caught before anything
+// is appended to the outputs.
+uint64_t input_fingerprint(const string& input, size_t offset);
+
+struct IncrementalStats {
+    bool first_run = false;
+    size_t records = 0;          // new records read by this run
+    size_t new_bytes = 0;        // input bytes taken by this run
+    StreamingStats stream;
+    Checkpoint checkpoint;       // as saved at the end of the run
+};
+
+// Process everything appended to input since the checkpoint in workdir.
+// The first run counts the input, freezes vocabulary version 1 from the
+// vocab_size most frequent words and encodes against it; later runs count
+// and encode in one streaming pass. schema_name ("cpp_export" or
+// "twitter_raw") sets options.schema and must stay the same across runs.
+// Throws runtime_error if the input no longer matches the checkpoint or
+// the outputs were left half-written by a failed run; rebuild the work
+// directory from scratch then.
+IncrementalStats run_incremental(const string& input, const string& workdir,
+                                 TextPreprocessor& preprocessor, ParallelEncoder& encoder,
+                                 StreamingOptions options, const string& schema_name,
+                                 size_t vocab_size);
+
+// Freeze the next vocabulary version from counts.voc, keeping vocab_size
+// words (0 keeps the checkpoint's size), and encode the input up to the
+// checkpointed offset against it into that version's embeddings file.
+// Later runs append there. Returns the new checkpoint.
+Checkpoint refreeze_vocabulary(const string& workdir, TextPreprocessor& preprocessor,
+                               ParallelEncoder& encoder, StreamingOptions options,
+                               size_t vocab_size = 0);
@@ -0,0 +1,166 @@
+#include "inference_engine.hpp"
+#include "instrumentation.hpp"
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+void apply_activation(Activation activation, float* x, size_t n) {
+    if (activation == Activation::RELU) {
+        #pragma omp simd
+        for (size_t j = 0; j < n; j++) {
+            x[j] = x[j] > 0.0f ? x[j] : 0.0f;
+        }
+    } else if (activation == Activation::SOFTMAX) {
+        float peak = *max_element(x, x + n);
+        float sum = 0.0f;
+        for (size_t j = 0; j < n; j++) {
+            x[j] = exp(x[j] - peak);
+            sum += x[j];
+        }
+        for (size_t j = 0; j < n; j++) {
+            x[j] /= sum;
+        }
+    }
+}
+
+} // namespace
+
+SentimentModel::SentimentModel(const string& filename, const Executor& executor)
+    : executor_(executor) {
+    MappedFile file(filename);
+
+    ModelFileHeader header;
+    if (file.size() < sizeof(header)) {
+        throw runtime_error("Not a model file: " + filename);
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, MODEL_MAGIC, sizeof(header.magic)) != 0) {
+        throw runtime_error("Not a model file: " + filename);
+    }
+    if (header.endian_tag != MODEL_ENDIAN_TAG) {
+        throw runtime_error("Model written with a different byte order: " + filename);
+    }
+    if (header.version != MODEL_FORMAT_VERSION) {
+        throw runtime_error("Unsupported model version " + to_string(header.version) +
+                            ": " + filename);
+    }
+    if (header.num_layers == 0 || header.layers_offset > file.size() ||
+        header.num_layers * sizeof(ModelLayerDesc) > file.size() - header.layers_offset) {
+        throw runtime_error("Corrupt model file: " + filename);
+    }
+
+    auto read_floats = [&](uint64_t offset, uint64_t count, vector<float>& out) {
+        if (offset > file.size() || count * sizeof(float) > file.size() - offset) {
+            throw runtime_error("Corrupt model file: " + filename);
+        }
+        out.resize(count);
+        memcpy(out.data(), file.data() + offset, count * sizeof(float));
+    };
+
+    vocab_hash_ = header.vocab_hash;
+    for (uint32_t l = 0; l < header.num_layers; l++) {
+        ModelLayerDesc desc;
+        memcpy(&desc, file.data() + header.layers_offset + l * sizeof(desc), sizeof(desc));
+
+        Layer layer;
+        layer.in = desc.in_features;
+        layer.out = desc.out_features;
+        layer.activation = static_cast<Activation>(desc.activation);
+        bool transposed = desc.flags & MODEL_LAYER_TRANSPOSED;
+        // The first layer is gathered by input column, the rest are dotted
+        // by output row; anything else would need a transpose here.
+        if (transposed != (l == 0) || layer.in == 0 || layer.out == 0 ||
+            desc.activation > static_cast<uint32_t>(Activation::SOFTMAX) ||
+            (l > 0 && layer.in != layers_.back().out)) {
+            throw runtime_error("Unsupported layer " + to_string(l) + " in model: " + filename);
+        }
+        read_floats(desc.weights_offset, uint64_t(layer.in) * layer.out, layer.weights);
+        read_floats(desc.bias_offset, layer.out, layer.bias);
+        max_width_ = max(max_width_, layer.out);
+        layers_.push_back(move(layer));
+    }
+
+    if (input_size() != header.input_size || num_classes() != header.num_classes) {
+        throw runtime_error("Corrupt model file: " + filename);
+    }
+}
+
+void SentimentModel::forward_row(const SparseEncodings& batch, size_t row,
+                                 vector<float>& a, vector<float>& b, float* out) const {
+    // Layer 0: embedding-bag gather-sum over the row's columns.
+    const Layer& first = layers_.front();
+    float* h = a.data();
+    copy(first.bias.begin(), first.bias.end(), h);
+    for (uint64_t k = batch.row_offsets[row]; k < batch.row_offsets[row + 1]; k++) {
+        uint32_t col = batch.indices[k];
+        if (col >= first.in) continue;
+        const float* w = first.weights.data() + size_t(col) * first.out;
+        float scale = batch.has_counts() ? batch.counts[k] : 1.0f;
+        #pragma omp simd
+        for (size_t j = 0; j < first.out; j++) {
+            h[j] += scale * w[j];
+        }
+    }
+    apply_activation(first.activation, h, first.out);
+
+    // Remaining layers: one dot product per output against the previous
+    // activations, ping-ponging between the two scratch vectors.
+    for (size_t l = 1; l < layers_.size(); l++) {
+        const Layer& layer = layers_[l];
+        float* next = (h == a.data()) ? b.data() : a.data();
+        for (size_t o = 0; o < layer.out; o++) {
+            const float* w = layer.weights.data() + o * layer.in;
+            float sum = 0.0f;
+            #pragma omp simd reduction(+:sum)
+            for (size_t j = 0; j < layer.in; j++) {
+                sum += w[j] * h[j];
+            }
+            next[o] = sum + layer.bias[o];
+        }
+        apply_activation(layer.activation, next, layer.out);
+        h = next;
+    }
+
+    copy(h, h + num_classes(), out);
+}
+
+vector<float> SentimentModel::predict_proba(const SparseEncodings& batch) const {
+    TRACE_SCOPE("predict");
+    if (batch.num_cols != input_size()) {
+        throw runtime_error("Encodings have " + to_string(batch.num_cols) +
+                            " columns, model expects " + to_string(input_size()));
+    }
+
+    size_t classes = num_classes();
+    vector<float> probabilities(batch.rows() * classes);
+
+    #pragma omp parallel num_threads(executor_.threads_for(Stage::PREDICT, batch.rows()))
+    {
+        TRACE_SCOPE("predict_rows");
+        vector<float> a(max_width_), b(max_width_);
+
+        #pragma omp for schedule(dynamic, executor_.grain())
+        for (size_t i = 0; i < batch.rows(); i++) {
+            forward_row(batch, i, a, b, probabilities.data() + i * classes);
+        }
+    }
+    return probabilities;
+}
+
+vector<int> SentimentModel::predict(const SparseEncodings& batch, vector<float>* confidence) const {
+    vector<float> probabilities = predict_proba(batch);
+    size_t classes = num_classes();
+
+    vector<int> labels(batch.rows());
+    if (confidence) confidence->resize(batch.rows());
+    for (size_t i = 0; i < batch.rows(); i++) {
+        const float* p = probabilities.data() + i * classes;
+        labels[i] = static_cast<int>(max_element(p, p + classes) - p);
+        if (confidence) (*confidence)[i] = p[labels[i]];
+    }
+    return labels;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "parallel_encoder.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Weights exported by sentiment_ann.py, version 1. A 128-byte header is
+// followed by one 32-byte descriptor per layer and 64-byte aligned float32
+// sections. The first layer is stored transposed (in x out), so a one-hot
+// input becomes a sum of contiguous weight rows; later layers are stored
+// as nn.Linear keeps them (out x in).
+struct ModelFileHeader {
+    char magic[8];          // "SENTMDL\0"
+    uint32_t version;       // MODEL_FORMAT_VERSION
+    uint32_t endian_tag;    // MODEL_ENDIAN_TAG as written by the producer
+    uint32_t num_layers;
+    uint32_t reserved0;
+    uint64_t input_size;    // vocabulary size the model was trained on
+    uint64_t num_classes;
+    uint64_t vocab_hash;    // ParallelEncoder::vocabulary_hash(), 0 if unknown
+    uint64_t layers_offset; // num_layers x ModelLayerDesc
+    uint8_t reserved[72];
+};
+static_assert(sizeof(ModelFileHeader) == 128, "model header must stay 128 bytes");
+
+struct ModelLayerDesc {
+    uint32_t in_features;
+    uint32_t out_features;
+    uint32_t activation;    // Activation
+    uint32_t flags;         // MODEL_LAYER_TRANSPOSED
+    uint64_t weights_offset;
+    uint64_t bias_offset;
+};
+static_assert(sizeof(ModelLayerDesc) == 32, "layer descriptor must stay 32 bytes");
+
+constexpr char MODEL_MAGIC[8] = {'S', 'E', 'N', 'T', 'M', 'D', 'L', '\0'};
+constexpr uint32_t MODEL_FORMAT_VERSION = 1;
+constexpr uint32_t MODEL_ENDIAN_TAG = 0x01020304;
+constexpr uint32_t MODEL_LAYER_TRANSPOSED = 1u << 0;
+
+enum class Activation : uint32_t {
+    NONE = 0,
+    RELU = 1,
+    SOFTMAX = 2
+};
+
+// Feed-forward SentimentANN scored straight from sparse encodings. The
+// first layer is an embedding-bag: the hidden vector starts at the bias and
+// adds the weight row of every present column (scaled by its count), so no
+// dense one-hot row is ever built. The remaining small layers are GEMVs
+// over contiguous weight rows.
+class SentimentModel {
+public:
+    // Throws runtime_error if the file cannot be read or is not a model.
+    // Batches are scored on executor, which must outlive the model.
+    explicit SentimentModel(const string& filename, const Executor& executor = Executor::global());
+
+    size_t input_size() const { return layers_.front().in; }
+    size_t num_classes() const { return layers_.back().out; }
+    uint64_t vocab_hash() const { return vocab_hash_; }
+
+    // Class probabilities (or final activations), rows() x num_classes()
+    // in row-major order.
+    vector<float> predict_proba(const SparseEncodings& batch) const;
+    // Most likely class per row; confidence receives its probability.
+    vector<int> predict(const SparseEncodings& batch, vector<float>* confidence = nullptr) const;
+
+    // sentiment_ann.py classes are irrelevant, negative, neutral, positive;
+    // Tweet::sentiment uses -1, 0, 1, 2 for the same labels.
+    static int class_to_sentiment(int cls) { return cls - 1; }
+    static int sentiment_to_class(int sentiment) { return sentiment + 1; }
+
+private:
+    struct Layer {
+        size_t in = 0;
+        size_t out = 0;
+        Activation activation = Activation::NONE;
+        vector<float> weights;
+        vector<float> bias;
+    };
+
+    void forward_row(const SparseEncodings& batch, size_t row,
+                     vector<float>& a, vector<float>& b, float* out) const;
+
+    const Executor& executor_;
+    vector<Layer> layers_;
+    size_t max_width_ = 0;
+    uint64_t vocab_hash_ = 0;
+};
@@ -0,0 +1,201 @@
+#include "instrumentation.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace instrumentation {
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    bool wait;
+};
+
+// Owned by the registry, so records outlive the threads that wrote them.
+// Counters are only written by the owning thread; relaxed atomics keep the
+// adds free of locked instructions.
+struct alignas(64) ThreadRecord {
+    int index = 0;
+    atomic<uint64_t> counters[NUM_COUNTERS] = {};
+    uint64_t busy_ns = 0;
+    int depth = 0;
+    vector<TraceEvent> events;
+};
+
+struct Registry {
+    mutex lock;
+    vector<unique_ptr<ThreadRecord>> threads;
+    steady_clock::time_point epoch = steady_clock::now();
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+thread_local ThreadRecord* current = nullptr;
+
+ThreadRecord& local() {
+    if (!current) {
+        Registry& reg = registry();
+        lock_guard<mutex> guard(reg.lock);
+        reg.threads.push_back(make_unique<ThreadRecord>());
+        current = reg.threads.back().get();
+        current->index = static_cast<int>(reg.threads.size()) - 1;
+    }
+    return *current;
+}
+
+uint64_t now_ns() {
+    return duration_cast<nanoseconds>(steady_clock::now() - registry().epoch).count();
+}
+
+const char* counter_name(int counter) {
+    static const char* names[NUM_COUNTERS] = {
+        "bytes_in", "bytes_out", "tokens", "oov_tokens", "rows", "queue_wait_ns",
+        "dedup_hits"};
+    return names[counter];
+}
+
+string json_string(const char* text) {
+    string out = "\"";
+    for (const char* p = text; *p; p++) {
+        if (*p == '"' || *p == '\\') out += '\\';
+        out += *p;
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+void add(Counter counter, uint64_t value) {
+    auto& slot = local().counters[counter];
+    slot.store(slot.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+ScopedTimer::ScopedTimer(const char* name, bool wait)
+    : name_(name), start_ns_(now_ns()), wait_(wait) {
+    local().depth++;
+}
+
+ScopedTimer::~ScopedTimer() {
+    uint64_t duration = now_ns() - start_ns_;
+    ThreadRecord& record = local();
+    record.depth--;
+    record.events.push_back({name_, start_ns_, duration, wait_});
+    if (wait_) {
+        add(QUEUE_WAIT_NS, duration);
+    } else if (record.depth == 0) {
+        record.busy_ns += duration;
+    }
+}
+
+void write_chrome_trace(const string& filename) {
+    ofstream out(filename);
+    if (!out) throw runtime_error("Cannot open file for writing: " + filename);
+
+    Registry& reg = registry();
+    lock_guard<mutex> guard(reg.lock);
+    out << fixed << setprecision(3) << "{\"traceEvents\": [\n";
+    bool first = true;
+    auto separator = [&] {
+        if (!first) out << ",\n";
+        first = false;
+    };
+    for (const auto& thread : reg.threads) {
+        separator();
+        out << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " << thread->index
+            << ", \"args\": {\"name\": \"thread " << thread->index << "\"}}";
+        for (const TraceEvent& event : thread->events) {
+            separator();
+            out << "{\"ph\": \"X\", \"name\": " << json_string(event.name)
+                << ", \"cat\": \"" << (event.wait ? "wait" : "work") << "\""
+                << ", \"pid\": 1, \"tid\": " << thread->index
+                << ", \"ts\": " << event.start_ns / 1000.0
+                << ", \"dur\": " << event.duration_ns / 1000.0 << "}";
+        }
+    }
+    out << "\n]}\n";
+    if (!out) throw runtime_error("Failed writing trace: " + filename);
+}
+
+void print_summary(ostream& out) {
+    Registry& reg = registry();
+    lock_guard<mutex> guard(reg.lock);
+
+#ifndef SENTIMENT_TRACE
+    out << "Instrumentation is compiled out (build with SENTIMENT_TRACE)" << endl;
+#endif
+
+    struct StageTotals {
+        uint64_t calls = 0, total_ns = 0, max_ns = 0;
+    };
+    map<string, StageTotals> stages;
+    uint64_t totals[NUM_COUNTERS] = {};
+    uint64_t span_begin = UINT64_MAX, span_end = 0;
+    for (const auto& thread : reg.threads) {
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+            totals[c] += thread->counters[c].load(memory_order_relaxed);
+        }
+        for (const TraceEvent& event : thread->events) {
+            StageTotals& stage = stages[event.name];
+            stage.calls++;
+            stage.total_ns += event.duration_ns;
+            stage.max_ns = max(stage.max_ns, event.duration_ns);
+            span_begin = min(span_begin, event.start_ns);
+            span_end = max(span_end, event.start_ns + event.duration_ns);
+        }
+    }
+    uint64_t span = span_end > span_begin ? span_end - span_begin : 0;
+
+    out << fixed << setprecision(2);
+    out << left << setw(24) << "stage" << right << setw(10) << "calls" << setw(14) << "total ms"
+        << setw(12) << "mean ms" << setw(12) << "max ms" << endl;
+    for (const auto& entry : stages) {
+        const StageTotals& stage = entry.second;
+        out << left << setw(24) << entry.first << right << setw(10) << stage.calls
+            << setw(14) << stage.total_ns / 1e6 << setw(12) << stage.total_ns / 1e6 / stage.calls
+            << setw(12) << stage.max_ns / 1e6 << endl;
+    }
+
+    out << left << setw(24) << "thread" << right << setw(14) << "busy ms" << setw(12) << "wait ms"
+        << setw(12) << "idle ms" << endl;
+    for (const auto& thread : reg.threads) {
+        uint64_t wait = thread->counters[QUEUE_WAIT_NS].load(memory_order_relaxed);
+        uint64_t used = thread->busy_ns + wait;
+        out << left << setw(24) << ("thread " + to_string(thread->index)) << right
+            << setw(14) << thread->busy_ns / 1e6 << setw(12) << wait / 1e6
+            << setw(12) << (span > used ? span - used : 0) / 1e6 << endl;
+    }
+
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        out << left << setw(24) << counter_name(c) << right << setw(14) << totals[c] << endl;
+    }
+    if (totals[TOKENS] > 0) {
+        out << left << setw(24) << "oov_rate" << right << setw(14)
+            << 100.0 * totals[OOV_TOKENS] / totals[TOKENS] << " %" << endl;
+    }
+}
+
+void reset() {
+    Registry& reg = registry();
+    lock_guard<mutex> guard(reg.lock);
+    for (auto& thread : reg.threads) {
+        for (auto& counter : thread->counters) counter.store(0, memory_order_relaxed);
+        thread->busy_ns = 0;
+        thread->events.clear();
+    }
+}
+
+} // namespace instrumentation
@@ -0,0 +1,97 @@
+#pragma once
+#include <omp.h>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// Hot-path instrumentation. Build with -DSENTIMENT_TRACE (CMake option
+// SENTIMENT_TRACE) to compile the TRACE_* macros in; otherwise they expand to
+// nothing and cost nothing.
+//
+// Every thread records into its own slot - counters and a list of timed
+// scopes - so recording never takes a lock. Results are read with
+// write_chrome_trace() or print_summary() once the work being measured has
+// finished; they must not be called while instrumented code is running.
+namespace instrumentation {
+
+enum Counter {
+    BYTES_IN,       // raw bytes entering the pipeline
+    BYTES_OUT,      // bytes written to output files
+    TOKENS,         // tokens looked up
+    OOV_TOKENS,     // tokens not in the vocabulary
+    ROWS,           // tweets processed
+    QUEUE_WAIT_NS,  // time blocked on a full or empty pipeline queue
+    DEDUP_HITS,     // tweets served from the dedup cache
+    NUM_COUNTERS
+};
+
+void add(Counter counter, uint64_t value);
+
+// Records one event from construction to destruction. Scopes that are not
+// nested in another scope of the same thread count as busy time; wait scopes
+// count as QUEUE_WAIT_NS instead.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* name, bool wait = false);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* name_;
+    uint64_t start_ns_;
+    bool wait_;
+};
+
+// Chrome trace event format, loadable in chrome://tracing or Perfetto.
+void write_chrome_trace(const string& filename);
+// Per-stage times, per-thread busy/wait/idle time and counter totals.
+void print_summary(ostream& out = cout);
+void reset();
+
+} // namespace instrumentation
+
+// Prints "Processed N <what>..." every `every` items from a parallel loop.
+// Workers only bump a relaxed atomic; the printing is left to whichever
+// thread is the team's master, so progress never serializes the loop.
+class ProgressReporter {
+public:
+    ProgressReporter(const char* what, size_t every, bool enabled = true)
+        : what_(what), every_(every ? every : 1), next_(every_), enabled_(enabled) {}
+
+    void add(size_t items) {
+        size_t done = done_.fetch_add(items, memory_order_relaxed) + items;
+        if (enabled_ && omp_get_thread_num() == 0 && done >= next_) {
+            next_ = (done / every_ + 1) * every_;
+            cout << "Processed " << done / every_ * every_ << " " << what_ << "..." << endl;
+        }
+    }
+
+private:
+    const char* what_;
+    size_t every_;
+    size_t next_;  // only touched by the master thread
+    bool enabled_;
+    atomic<size_t> done_{0};
+};
+
+#ifdef SENTIMENT_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    instrumentation::ScopedTimer TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_WAIT(name) \
+    instrumentation::ScopedTimer TRACE_CONCAT(trace_scope_, __LINE__)(name, true)
+#define TRACE_COUNT(counter, value) \
+    instrumentation::add(instrumentation::counter, static_cast<uint64_t>(value))
+#else
+// The name still counts as used, so a stage name passed in as a parameter
+// does not trip -Wunused-parameter in untraced builds.
+#define TRACE_SCOPE(name) ((void)(name))
+#define TRACE_WAIT(name) ((void)(name))
+#define TRACE_COUNT(counter, value) ((void)0)
+#endif
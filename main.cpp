@@ -2,204 +2,714 @@
 #include "sequential.hpp"
 #include "common_headers.hpp"
 #include "parallel_encoder.hpp"  // Add this line
+#include "embedding_io.hpp"
+#include "streaming_pipeline.hpp"
+#include "instrumentation.hpp"
+#include "inference_engine.hpp"
+#include "scoring_server.hpp"
+#include "parallel_writer.hpp"
+#include "shard_mode.hpp"
+#include "incremental.hpp"
+#include <csignal>
 #include <chrono>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char** environ;
 
 using namespace std::chrono;
 
-vector<Tweet> load_tweets(const string& filename) {
-    vector<Tweet> tweets;
-    ifstream file(filename);
-    
-    if (!file.is_open()) {
-        cerr << "Error: Cannot open file " << filename << endl;
-        return tweets;
+void save_processed_tweets(const string& filename,
+                           const TweetBatchView& tweets,
+                           const TokenizedBatch& cleaned,
+                           const Executor& executor) {
+    size_t rows = min(tweets.size(), cleaned.rows());
+    try {
+        PositionalFile file(filename);
+        const string header = "id,text,sentiment\n";
+        file.write_at(0, header.data(), header.size());
+        write_rows(file, header.size(), rows, executor,
+                   [&](size_t i) { return cleaned.text(i).size() + 16; },
+                   [&](size_t i, string& out) {
+                       out += to_string(tweets.id(i));
+                       out += ',';
+                       append_csv_field(out, cleaned.text(i));
+                       out += ',';
+                       out += to_string(tweets.label(i));
+                       out += '\n';
+                   });
+        file.close();
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return;
     }
-    
-    string line;
-    int line_num = 0;
-    
-    // Skip header
-    getline(file, line);
-    
-    // Read tweets
-    while (getline(file, line)) {
-        line_num++;
-        try {
-            vector<string> fields;
-            string current_field;
-            bool in_quotes = false;
-            
-            for (size_t i = 0; i < line.length(); i++) {
-                char c = line[i];
-                if (c == '"') {
-                    in_quotes = !in_quotes;
-                }
-                else if (c == ',' && !in_quotes) {
-                    // Trim whitespace from field
-                    while (!current_field.empty() && isspace(current_field.back())) {
-                        current_field.pop_back();
-                    }
-                    while (!current_field.empty() && isspace(current_field.front())) {
-                        current_field.erase(0, 1);
-                    }
-                    fields.push_back(current_field);
-                    current_field.clear();
-                }
-                else {
-                    current_field += c;
-                }
-            }
-            // Add last field
-            fields.push_back(current_field);
-
-            // Create Tweet object
-            if (fields.size() >= 3) {
-                Tweet tweet;
-                tweet.id = line_num;
-                
-                // Get text (remove surrounding quotes if present)
-                string text = fields[1];
-                if (text.length() >= 2 && text.front() == '"' && text.back() == '"') {
-                    text = text.substr(1, text.length() - 2);
-                }
-                tweet.text = text;
-                
-                // Get sentiment (last field, remove quotes)
-                string sentiment_str = fields.back();
-                if (sentiment_str.length() >= 2 && 
-                    sentiment_str.front() == '"' && 
-                    sentiment_str.back() == '"') {
-                    sentiment_str = sentiment_str.substr(1, sentiment_str.length() - 2);
-                }
-                
-                // Clean up sentiment string
-                sentiment_str.erase(
-                    remove_if(sentiment_str.begin(), sentiment_str.end(), 
-                            [](char c) { return isspace(c); }),
-                    sentiment_str.end()
-                );
-                
-                // Map sentiment values, default to neutral (1) silently
-                if (sentiment_str == "Positive" || sentiment_str == "2") {
-                    tweet.sentiment = 2;
-                } else if (sentiment_str == "Negative" || sentiment_str == "0") {
-                    tweet.sentiment = 0;
-                } else if (sentiment_str == "Irrelevant" || sentiment_str == "-1") {
-                    tweet.sentiment = -1;
-                } else {
-                    tweet.sentiment = 1;  // Default to neutral without warning
-                }
-                tweets.push_back(tweet);
-            }
+
+    cout << "Saved " << rows << " processed tweets to " << filename << endl;
+}
+
+// --hash DIM [--hash-seed S] [--signed] encode by feature hashing instead of
+// a vocabulary. Returns false when args[i] is none of them.
+bool parse_hashing_option(const vector<string>& args, size_t& i, FeatureHashing& hashing) {
+    if (args[i] == "--hash" && i + 1 < args.size()) {
+        hashing.dim = stoul(args[++i]);
+    } else if (args[i] == "--hash-seed" && i + 1 < args.size()) {
+        hashing.seed = stoull(args[++i]);
+    } else if (args[i] == "--signed") {
+        hashing.signed_hash = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// --threads T sets the thread budget of a mode's executor; without it the
+// budget is OpenMP's default (OMP_NUM_THREADS or the hardware). Returns
+// false when args[i] is not --threads.
+bool parse_threads_option(const vector<string>& args, size_t& i, int& threads) {
+    if (args[i] != "--threads" || i + 1 >= args.size()) return false;
+    threads = max(1, stoi(args[++i]));
+    return true;
+}
+
+// --stop-words [--stem] drop stop words and/or stem tokens before vocabulary
+// lookup (see token_normalizer.hpp). A model must be encoded with the same
+// settings it was trained with. Returns false when args[i] is neither.
+bool parse_normalization_option(const vector<string>& args, size_t i, TokenNormalization& normalization) {
+    if (args[i] == "--stop-words") {
+        normalization.stop_words = true;
+    } else if (args[i] == "--stem") {
+        normalization.stem = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// --stream <input.csv> <output.bin> [--raw] [--sample N] [--batch N] [--bits]
+//          [--vocab FILE] [--save-vocab FILE] [--vocab-budget KB]
+//          [--hash DIM [--hash-seed S] [--signed]] [--stop-words] [--stem]
+//          [--dedup MB] [--threads T] [--trace FILE]
+// Builds the vocabulary from the first N tweets (or loads it with --vocab,
+// or skips it with --hash; --vocab-budget counts in bounded memory, see
+// ParallelEncoder::set_vocabulary_budget), then streams the whole file
+// through load -> clean -> encode -> write with bounded memory. --dedup
+// caches up to MB megabytes of cleaned texts and token ids so repeated
+// tweets are processed once. --trace writes a Chrome trace and prints a
+// stage summary (needs a SENTIMENT_TRACE build to record anything).
+//
+// --ring <input.csv> <name> [--ring-mb MB] [same options except --bits]
+// Streams the same way, but into the shared-memory ring <name> of MB
+// megabytes (default 64) instead of a file, for shm_ring.py to read while
+// encoding goes on. Returns once the reader has taken every batch.
+int run_stream_mode(const vector<string>& args) {
+    bool ring = args[0] == "--ring";
+    if (args.size() < 3) {
+        cerr << "Usage: parallel_processor " << (ring ? "--ring <input.csv> <name> [--ring-mb MB] "
+                                                      : "--stream <input.csv> <output.bin> [--bits] ")
+             << "[--raw] [--sample N] [--batch N] "
+             << "[--vocab FILE] [--save-vocab FILE] [--vocab-budget KB] "
+             << "[--hash DIM [--hash-seed S] [--signed]] [--stop-words] [--stem] "
+             << "[--dedup MB] [--threads T] [--trace FILE]" << endl;
+        return 1;
+    }
+
+    int num_threads = omp_get_max_threads();
+    size_t sample_size = 10000;
+    size_t vocab_budget = 0;
+    size_t ring_bytes = size_t(64) << 20;
+    string vocab_in, vocab_out, trace_path;
+    FeatureHashing hashing;
+    TokenNormalization normalization;
+    StreamingOptions options;
+    for (size_t i = 3; i < args.size(); i++) {
+        if (parse_hashing_option(args, i, hashing) || parse_normalization_option(args, i, normalization) ||
+            parse_threads_option(args, i, num_threads)) {
+            continue;
+        } else if (args[i] == "--raw") {
+            options.schema = TweetSchema::twitter_raw();
+        } else if (args[i] == "--bits" && !ring) {
+            options.layout = EmbeddingLayout::ONEHOT_BITS;
+        } else if (args[i] == "--ring-mb" && ring && i + 1 < args.size()) {
+            ring_bytes = stoul(args[++i]) << 20;
+        } else if (args[i] == "--sample" && i + 1 < args.size()) {
+            sample_size = stoul(args[++i]);
+        } else if (args[i] == "--batch" && i + 1 < args.size()) {
+            options.batch_size = stoul(args[++i]);
+        } else if (args[i] == "--vocab" && i + 1 < args.size()) {
+            vocab_in = args[++i];
+        } else if (args[i] == "--save-vocab" && i + 1 < args.size()) {
+            vocab_out = args[++i];
+        } else if (args[i] == "--vocab-budget" && i + 1 < args.size()) {
+            vocab_budget = stoul(args[++i]) << 10;
+        } else if (args[i] == "--dedup" && i + 1 < args.size()) {
+            options.dedup_bytes = stoul(args[++i]) << 20;
+        } else if (args[i] == "--trace" && i + 1 < args.size()) {
+            trace_path = args[++i];
+        } else {
+            cerr << "Unknown option: " << args[i] << endl;
+            return 1;
         }
-        catch (const exception& e) {
-            cerr << "Warning: Skipping malformed line " << line_num << endl;
+    }
+
+    // Clean and encode overlap while streaming, so they split the threads.
+    Executor executor(num_threads);
+    executor.share({Stage::CLEAN, Stage::ENCODE});
+    TextPreprocessor preprocessor(executor);
+    preprocessor.set_normalization(normalization);
+    ParallelEncoder encoder(5000, executor);
+    encoder.set_vocabulary_budget(vocab_budget);
+
+    if (hashing.enabled()) {
+        encoder.set_feature_hashing(hashing);
+        cout << "Feature hashing into " << hashing.dim << " columns" << endl;
+    } else if (!vocab_in.empty()) {
+        encoder.load_vocabulary(vocab_in);
+    } else {
+        TweetBatch sample = load_tweet_sample(args[1], options.schema, sample_size);
+        TokenizedBatch cleaned;
+        preprocessor.preprocess_tokenized(sample, cleaned);
+        encoder.build_vocabulary(cleaned);
+        cout << "Vocabulary built from " << sample.size() << " tweets: "
+             << encoder.get_vocab_size() << " words" << endl;
+    }
+    if (!vocab_out.empty()) {
+        encoder.save_vocabulary(vocab_out);
+        cout << "Saved vocabulary to: " << vocab_out << endl;
+    }
+    encoder.set_verbose(false);
+
+    if (ring) cout << "Publishing batches to shared memory ring: " << args[2] << endl;
+    auto stats = ring ? run_ring_pipeline(args[1], args[2], ring_bytes, preprocessor, encoder, options)
+                      : run_streaming_pipeline(args[1], args[2], preprocessor, encoder, options);
+    cout << "Streamed " << stats.tweets << " tweets in " << stats.batches << " batches, "
+         << stats.elapsed_ms << " ms, peak RSS " << stats.peak_rss_kb / 1024 << " MB" << endl;
+    if (options.dedup_bytes > 0) cout << "Dedup: " << stats.dedup.summary() << endl;
+    if (!ring) cout << "Saved encodings to: " << args[2] << endl;
+
+    if (!trace_path.empty()) {
+        instrumentation::print_summary();
+        instrumentation::write_chrome_trace(trace_path);
+        cout << "Saved trace to: " << trace_path << endl;
+    }
+    return 0;
+}
+
+// --classify <input.csv> <model.weights> <predictions.csv>
+//            (--vocab FILE | --hash DIM [--hash-seed S] [--signed]) [--raw] [--batch N]
+//            [--stop-words] [--stem] [--dedup MB] [--threads T]
+// Scores every tweet with a model exported by sentiment_ann.py, encoding
+// against the vocabulary (or hashing settings) it was trained with.
+int run_classify_mode(const vector<string>& args) {
+    if (args.size() < 4) {
+        cerr << "Usage: parallel_processor --classify <input.csv> <model.weights> "
+             << "<predictions.csv> (--vocab FILE | --hash DIM [--hash-seed S] [--signed]) "
+             << "[--raw] [--batch N] [--stop-words] [--stem] [--dedup MB] [--threads T]" << endl;
+        return 1;
+    }
+
+    int num_threads = omp_get_max_threads();
+    string vocab_path;
+    FeatureHashing hashing;
+    TokenNormalization normalization;
+    StreamingOptions options;
+    for (size_t i = 4; i < args.size(); i++) {
+        if (parse_hashing_option(args, i, hashing) || parse_normalization_option(args, i, normalization) ||
+            parse_threads_option(args, i, num_threads)) {
             continue;
+        } else if (args[i] == "--raw") {
+            options.schema = TweetSchema::twitter_raw();
+        } else if (args[i] == "--batch" && i + 1 < args.size()) {
+            options.batch_size = stoul(args[++i]);
+        } else if (args[i] == "--vocab" && i + 1 < args.size()) {
+            vocab_path = args[++i];
+        } else if (args[i] == "--dedup" && i + 1 < args.size()) {
+            options.dedup_bytes = stoul(args[++i]) << 20;
+        } else {
+            cerr << "Unknown option: " << args[i] << endl;
+            return 1;
         }
     }
-    
-    cout << "Successfully loaded " << tweets.size() 
-         << " tweets from " << filename << endl;
-    
-    return tweets;
+    if (vocab_path.empty() && !hashing.enabled()) {
+        cerr << "--classify needs the model's vocabulary (--vocab FILE) or hashing (--hash DIM)" << endl;
+        return 1;
+    }
+
+    // Clean, encode and predict overlap, so they split the threads.
+    Executor executor(num_threads);
+    executor.share({Stage::CLEAN, Stage::ENCODE, Stage::PREDICT});
+    TextPreprocessor preprocessor(executor);
+    preprocessor.set_normalization(normalization);
+    ParallelEncoder encoder(5000, executor);
+    if (hashing.enabled()) {
+        encoder.set_feature_hashing(hashing);
+    } else {
+        encoder.load_vocabulary(vocab_path);
+    }
+    encoder.set_verbose(false);
+    SentimentModel model(args[2], executor);
+
+    auto stats = run_classification_pipeline(args[1], args[3], preprocessor, encoder, model, options);
+    cout << "Classified " << stats.tweets << " tweets in " << stats.elapsed_ms << " ms, peak RSS "
+         << stats.peak_rss_kb / 1024 << " MB" << endl;
+    if (options.dedup_bytes > 0) cout << "Dedup: " << stats.dedup.summary() << endl;
+    if (stats.tweets > 0) {
+        cout << "Agreement with label column: " << 100.0 * stats.correct / stats.tweets << " %" << endl;
+    }
+    cout << "Saved predictions to: " << args[3] << endl;
+    return 0;
 }
 
-void save_processed_tweets(const string& filename, 
-                         const vector<Tweet>& tweets,
-                         const vector<string>& processed_texts) {
-    ofstream file(filename);
-    if (!file.is_open()) {
-        cerr << "Error: Cannot open output file " << filename << endl;
-        return;
+ScoringServer* active_server = nullptr;
+
+void stop_active_server(int) {
+    if (active_server) active_server->stop();
+}
+
+// --serve (--vocab FILE | --hash DIM [--hash-seed S] [--signed]) --model FILE
+//         [--socket PATH] [--max-batch N] [--max-delay-us T] [--stop-words] [--stem]
+//         [--dedup MB] [--threads T]
+// Scores one tweet per line from stdin (or every client of the Unix socket)
+// until end of input (or SIGINT/SIGTERM), micro-batching requests.
+int run_serve_mode(const vector<string>& args) {
+    int num_threads = omp_get_max_threads();
+    string vocab_path, model_path, socket_path;
+    FeatureHashing hashing;
+    TokenNormalization normalization;
+    ScoringOptions options;
+    for (size_t i = 1; i < args.size(); i++) {
+        if (parse_hashing_option(args, i, hashing) || parse_normalization_option(args, i, normalization) ||
+            parse_threads_option(args, i, num_threads)) {
+            continue;
+        } else if (args[i] == "--vocab" && i + 1 < args.size()) {
+            vocab_path = args[++i];
+        } else if (args[i] == "--model" && i + 1 < args.size()) {
+            model_path = args[++i];
+        } else if (args[i] == "--socket" && i + 1 < args.size()) {
+            socket_path = args[++i];
+        } else if (args[i] == "--max-batch" && i + 1 < args.size()) {
+            options.max_batch = stoul(args[++i]);
+        } else if (args[i] == "--max-delay-us" && i + 1 < args.size()) {
+            options.max_delay_us = stol(args[++i]);
+        } else if (args[i] == "--dedup" && i + 1 < args.size()) {
+            options.dedup_bytes = stoul(args[++i]) << 20;
+        } else {
+            cerr << "Unknown option: " << args[i] << endl;
+            return 1;
+        }
     }
-    
-    file << "id,text,sentiment\n";
-    
-    for (size_t i = 0; i < tweets.size(); i++) {
-        if (i < processed_texts.size()) {  // Safety check
-            file << tweets[i].id << ","
-                 << "\"" << processed_texts[i] << "\","
-                 << tweets[i].sentiment << "\n";
+    if ((vocab_path.empty() && !hashing.enabled()) || model_path.empty()) {
+        cerr << "Usage: parallel_processor --serve (--vocab FILE | --hash DIM [--hash-seed S] "
+             << "[--signed]) --model FILE [--socket PATH] [--max-batch N] [--max-delay-us T] "
+             << "[--stop-words] [--stem] [--dedup MB] [--threads T]" << endl;
+        return 1;
+    }
+
+    // Clients are read and answered while a batch is scored, so the scoring
+    // stages keep to a share of the budget like the pipelines do.
+    Executor executor(num_threads);
+    executor.share({Stage::CLEAN, Stage::ENCODE, Stage::PREDICT});
+    TextPreprocessor preprocessor(executor);
+    preprocessor.set_normalization(normalization);
+    ParallelEncoder encoder(5000, executor);
+    encoder.set_verbose(false);
+    if (hashing.enabled()) {
+        encoder.set_feature_hashing(hashing);
+    } else {
+        encoder.load_vocabulary(vocab_path);
+    }
+    SentimentModel model(model_path, executor);
+    ScoringServer server(preprocessor, encoder, model, options);
+
+    // Responses go to stdout in stdio mode, so everything else goes to cerr.
+    if (socket_path.empty()) {
+        server.serve_stdio(cin, cout);
+    } else {
+        active_server = &server;
+        signal(SIGINT, stop_active_server);
+        signal(SIGTERM, stop_active_server);
+        cerr << "Listening on " << socket_path << endl;
+        server.serve_socket(socket_path);
+        active_server = nullptr;
+    }
+    cerr << "Served " << server.stats().summary() << endl;
+    return 0;
+}
+
+// Options of the --shard-* commands. forwarded keeps the ones a worker
+// needs, so the --shard-run driver can hand them on.
+struct ShardArgs {
+    string input;
+    string workdir;
+    size_t shard = 0;
+    size_t shards = 0;
+    bool shard_given = false;
+    size_t vocab_size = 5000;
+    int threads = omp_get_max_threads();
+    bool threads_given = false;
+    FeatureHashing hashing;
+    TokenNormalization normalization;
+    StreamingOptions options;
+    vector<string> forwarded;
+};
+
+bool parse_shard_args(const vector<string>& args, size_t first, ShardArgs& shard) {
+    for (size_t i = first; i < args.size(); i++) {
+        size_t start = i;
+        bool forward = true;
+        if (parse_hashing_option(args, i, shard.hashing) ||
+            parse_normalization_option(args, i, shard.normalization)) {
+        } else if (args[i] == "--raw") {
+            shard.options.schema = TweetSchema::twitter_raw();
+        } else if (args[i] == "--bits") {
+            shard.options.layout = EmbeddingLayout::ONEHOT_BITS;
+        } else if (args[i] == "--batch" && i + 1 < args.size()) {
+            shard.options.batch_size = stoul(args[++i]);
+        } else if (args[i] == "--dedup" && i + 1 < args.size()) {
+            shard.options.dedup_bytes = stoul(args[++i]) << 20;
+        } else if (args[i] == "--vocab-size" && i + 1 < args.size()) {
+            shard.vocab_size = stoul(args[++i]);
+        } else if (args[i] == "--shards" && i + 1 < args.size()) {
+            shard.shards = stoul(args[++i]);
+            forward = false;
+        } else if (args[i] == "--shard" && i + 1 < args.size()) {
+            shard.shard = stoul(args[++i]);
+            shard.shard_given = true;
+            forward = false;
+        } else if (parse_threads_option(args, i, shard.threads)) {
+            shard.threads_given = true;
+            forward = false;
+        } else {
+            cerr << "Unknown option: " << args[i] << endl;
+            return false;
         }
+        if (forward) shard.forwarded.insert(shard.forwarded.end(), args.begin() + start, args.begin() + i + 1);
+    }
+    if (shard.shards == 0) {
+        cerr << "--shards N is required" << endl;
+        return false;
     }
-    file.close();
+    return true;
 }
 
-void save_embeddings(const string& filename, const vector<vector<float>>& embeddings) {
-    ofstream file(filename, ios::binary);
-    if (!file.is_open()) {
-        cerr << "Error: Cannot open output file " << filename << endl;
-        return;
+// Start one process of this executable per command line and wait for all
+// of them. Returns false if any could not start or did not exit with 0.
+bool run_workers(const string& self, const vector<vector<string>>& commands) {
+    vector<pid_t> pids;
+    bool ok = true;
+    for (const auto& command : commands) {
+        vector<char*> argv;
+        for (const auto& arg : command) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        pid_t pid;
+        int error = posix_spawnp(&pid, self.c_str(), nullptr, nullptr, argv.data(), environ);
+        if (error != 0) {
+            cerr << "Cannot start worker " << self << ": " << strerror(error) << endl;
+            ok = false;
+            continue;
+        }
+        pids.push_back(pid);
     }
-    
-    // Save number of embeddings and embedding size
-    size_t num_embeddings = embeddings.size();
-    size_t embedding_size = embeddings.empty() ? 0 : embeddings[0].size();
-    
-    file.write(reinterpret_cast<const char*>(&num_embeddings), sizeof(num_embeddings));
-    file.write(reinterpret_cast<const char*>(&embedding_size), sizeof(embedding_size));
-    
-    // Save embeddings
-    for (const auto& embedding : embeddings) {
-        file.write(reinterpret_cast<const char*>(embedding.data()), 
-                  embedding.size() * sizeof(float));
+    for (pid_t pid : pids) {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            cerr << "Worker " << pid << " failed" << endl;
+            ok = false;
+        }
     }
-    
-    cout << "Saved " << num_embeddings << " embeddings of size " 
-         << embedding_size << " to " << filename << endl;
+    return ok;
 }
 
-int main() {
+// Sharded multi-process encoding (see shard_mode.hpp). The phases can run
+// as separate commands on any machine that sees input and workdir:
+//   --shard-plan     <input.csv> <workdir> --shards N
+//   --shard-count    <input.csv> <workdir> --shard I --shards N [--raw] [--batch N]
+//                    [--stop-words] [--stem]
+//   --shard-merge    <input.csv> <workdir> --shards N [--vocab-size K]
+//   --shard-encode   <input.csv> <workdir> --shard I --shards N [--raw] [--batch N]
+//                    [--bits] [--dedup MB] [--hash DIM [--hash-seed S] [--signed]]
+//                    [--stop-words] [--stem]
+//   --shard-manifest <input.csv> <workdir> --shards N
+// or all at once with N local worker processes per phase:
+//   --shard-run      <input.csv> <workdir> --shards N [any of the above options]
+// --threads T sets each process's thread budget (--shard-run divides the
+// cores between its workers by default).
+int run_shard_mode(const vector<string>& args, const string& self) {
+    const string& command = args[0];
+    ShardArgs shard;
+    if (args.size() < 3 || !parse_shard_args(args, 3, shard)) {
+        cerr << "Usage: parallel_processor " << command << " <input.csv> <workdir> --shards N "
+             << "[--shard I] [--raw] [--batch N] [--bits] [--dedup MB] [--vocab-size K] "
+             << "[--hash DIM [--hash-seed S] [--signed]] [--stop-words] [--stem] [--threads T]" << endl;
+        return 1;
+    }
+    shard.input = args[1];
+    shard.workdir = args[2];
+    bool per_shard = command == "--shard-count" || command == "--shard-encode";
+    if (per_shard && (!shard.shard_given || shard.shard >= shard.shards)) {
+        cerr << command << " needs --shard I with I < " << shard.shards << endl;
+        return 1;
+    }
+    if (command != "--shard-run") {
+        mkdir(shard.workdir.c_str(), 0755);
+    }
 
-    
-    
+    Executor executor(shard.threads);
+    TextPreprocessor preprocessor(executor);
+    preprocessor.set_normalization(shard.normalization);
+
+    if (command == "--shard-plan") {
+        write_shard_ranges(shard.input, shard.workdir, shard.shards);
+        cout << "Saved shard ranges to: " << shard_ranges_path(shard.workdir) << endl;
+        return 0;
+    }
+    if (command == "--shard-count") {
+        size_t tweets = count_shard(shard.input, shard.workdir, shard.shard, shard.shards,
+                                    shard.options.schema, preprocessor, shard.options.batch_size);
+        cout << "Shard " << shard.shard << ": counted " << tweets << " tweets" << endl;
+        return 0;
+    }
+    if (command == "--shard-merge") {
+        FrozenVocabulary vocabulary = merge_shard_counts(shard.workdir, shard.shards,
+                                                         shard.vocab_size, executor);
+        cout << "Merged " << shard.shards << " shards into " << vocabulary.size()
+             << " words: " << shard_vocabulary_path(shard.workdir) << endl;
+        return 0;
+    }
+    if (command == "--shard-encode") {
+        executor.share({Stage::CLEAN, Stage::ENCODE});
+        ParallelEncoder encoder(static_cast<int>(shard.vocab_size), executor);
+        if (shard.hashing.enabled()) {
+            encoder.set_feature_hashing(shard.hashing);
+        } else {
+            encoder.load_vocabulary(shard_vocabulary_path(shard.workdir));
+        }
+        encoder.set_verbose(false);
+        auto stats = encode_shard(shard.input, shard.workdir, shard.shard, shard.shards,
+                                  preprocessor, encoder, shard.options);
+        cout << "Shard " << shard.shard << ": encoded " << stats.tweets << " tweets in "
+             << stats.elapsed_ms << " ms" << endl;
+        return 0;
+    }
+    if (command == "--shard-manifest") {
+        write_shard_manifest(shard.input, shard.workdir, shard.shards);
+        cout << "Saved manifest to: " << shard_manifest_path(shard.workdir) << endl;
+        return 0;
+    }
+    if (command != "--shard-run") {
+        cerr << "Unknown command: " << command << endl;
+        return 1;
+    }
+
+    // Driver: one local process per shard and phase, sharing the cores.
+    mkdir(shard.workdir.c_str(), 0755);
+    int threads = shard.threads_given
+        ? shard.threads
+        : max(1, omp_get_num_procs() / static_cast<int>(shard.shards));
+    auto worker_commands = [&](const string& phase) {
+        vector<vector<string>> commands;
+        for (size_t i = 0; i < shard.shards; i++) {
+            vector<string> command{self, phase, shard.input, shard.workdir,
+                                   "--shard", to_string(i), "--shards", to_string(shard.shards),
+                                   "--threads", to_string(threads)};
+            command.insert(command.end(), shard.forwarded.begin(), shard.forwarded.end());
+            commands.push_back(move(command));
+        }
+        return commands;
+    };
+
+    auto start_time = high_resolution_clock::now();
+    write_shard_ranges(shard.input, shard.workdir, shard.shards);
+    if (!shard.hashing.enabled()) {
+        if (!run_workers(self, worker_commands("--shard-count"))) return 1;
+        FrozenVocabulary vocabulary = merge_shard_counts(shard.workdir, shard.shards,
+                                                         shard.vocab_size, executor);
+        cout << "Merged vocabulary: " << vocabulary.size() << " words" << endl;
+    }
+    if (!run_workers(self, worker_commands("--shard-encode"))) return 1;
+    write_shard_manifest(shard.input, shard.workdir, shard.shards);
+    auto elapsed = duration_cast<milliseconds>(high_resolution_clock::now() - start_time).count();
+    cout << "Sharded run of " << shard.shards << " workers took " << elapsed << " ms" << endl;
+    cout << "Saved manifest to: " << shard_manifest_path(shard.workdir) << endl;
+    return 0;
+}
+
+// Incremental processing of a growing input (see incremental.hpp):
+//   --incremental <input.csv> <workdir> [--raw] [--batch N] [--vocab-size N] [--threads T]
+//                 [--trace FILE]
+// encodes only the records appended since the last run into
+// <workdir>/embeddings-<v>.bin and adds their tokens to the saved counts;
+//   --refreeze <workdir> [--vocab-size N] [--batch N] [--threads T]
+// freezes vocabulary version v + 1 from those counts and re-encodes the
+// input so far against it. --vocab-size (default 5000) is fixed by the
+// first run until a refreeze changes it.
+int run_incremental_mode(const vector<string>& args) {
+    bool refreeze = args[0] == "--refreeze";
+    size_t first = refreeze ? 2 : 3;
+    if (args.size() < first) {
+        cerr << "Usage: parallel_processor --incremental <input.csv> <workdir> [--raw] "
+             << "[--batch N] [--vocab-size N] [--threads T] [--trace FILE]" << endl
+             << "       parallel_processor --refreeze <workdir> [--vocab-size N] [--batch N] "
+             << "[--threads T]" << endl;
+        return 1;
+    }
+
+    int num_threads = omp_get_max_threads();
+    size_t vocab_size = refreeze ? 0 : 5000;
+    string schema_name = "cpp_export";
+    string trace_path;
+    StreamingOptions options;
+    for (size_t i = first; i < args.size(); i++) {
+        if (parse_threads_option(args, i, num_threads)) {
+            continue;
+        } else if (args[i] == "--raw" && !refreeze) {
+            schema_name = "twitter_raw";
+        } else if (args[i] == "--batch" && i + 1 < args.size()) {
+            options.batch_size = stoul(args[++i]);
+        } else if (args[i] == "--vocab-size" && i + 1 < args.size()) {
+            vocab_size = stoul(args[++i]);
+        } else if (args[i] == "--trace" && i + 1 < args.size() && !refreeze) {
+            trace_path = args[++i];
+        } else {
+            cerr << "Unknown option: " << args[i] << endl;
+            return 1;
+        }
+    }
+
+    Executor executor(num_threads);
+    executor.share({Stage::CLEAN, Stage::ENCODE});
+    TextPreprocessor preprocessor(executor);
+    ParallelEncoder encoder(5000, executor);
+    encoder.set_verbose(false);
+
+    if (refreeze) {
+        Checkpoint checkpoint = refreeze_vocabulary(args[1], preprocessor, encoder, options, vocab_size);
+        cout << "Froze vocabulary version " << checkpoint.vocab_version << ": "
+             << encoder.get_vocab_size() << " words, " << checkpoint.rows << " rows re-encoded" << endl;
+        cout << "Saved encodings to: " << incremental_output_path(args[1], checkpoint.vocab_version)
+             << endl;
+        return 0;
+    }
+
+    auto stats = run_incremental(args[1], args[2], preprocessor, encoder, options, schema_name,
+                                 vocab_size);
+    const Checkpoint& checkpoint = stats.checkpoint;
+    if (stats.records == 0) {
+        cout << "No new records after offset " << checkpoint.offset << " of " << args[1] << endl;
+        return 0;
+    }
+    if (stats.first_run) {
+        cout << "Froze vocabulary version 1: " << encoder.get_vocab_size() << " words" << endl;
+    }
+    cout << "Processed " << stats.records << " new records (" << stats.new_bytes << " bytes) in "
+         << stats.stream.elapsed_ms << " ms; " << checkpoint.rows << " rows against vocabulary version "
+         << checkpoint.vocab_version << endl;
+    cout << "Saved encodings to: " << incremental_output_path(args[2], checkpoint.vocab_version) << endl;
+
+    if (!trace_path.empty()) {
+        instrumentation::print_summary();
+        instrumentation::write_chrome_trace(trace_path);
+        cout << "Saved trace to: " << trace_path << endl;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    vector<string> args(argv + 1, argv + argc);
     
     try {
+        if (!args.empty() && (args[0] == "--stream" || args[0] == "--ring")) {
+            return run_stream_mode(args);
+        }
+        if (!args.empty() && args[0] == "--classify") {
+            return run_classify_mode(args);
+        }
+        if (!args.empty() && args[0] == "--serve") {
+            return run_serve_mode(args);
+        }
+        if (!args.empty() && args[0].rfind("--shard-", 0) == 0) {
+            return run_shard_mode(args, argv[0]);
+        }
+        if (!args.empty() && (args[0] == "--incremental" || args[0] == "--refreeze")) {
+            return run_incremental_mode(args);
+        }
+
         cout << "RAGHAV SHARMA 2023BCS0050 GAURAV JHALANI 2023BCS0032" << endl;
         const string train_path = "data/raw/train_for_cpp.csv";
         const string test_path = "data/raw/test_for_cpp.csv";
 
+        // --vocab FILE encodes every subset against one saved vocabulary
+        // instead of rebuilding it per size; --processed FILE saves the
+        // cleaned tweets of the largest subset as CSV; --threads T sets the
+        // budget.
+        string vocab_path;
+        string processed_path;
+        int num_threads = omp_get_max_threads();
+        for (size_t i = 0; i < args.size(); i++) {
+            if (parse_threads_option(args, i, num_threads)) {
+                continue;
+            } else if (args[i] == "--vocab" && i + 1 < args.size()) {
+                vocab_path = args[++i];
+            } else if (args[i] == "--processed" && i + 1 < args.size()) {
+                processed_path = args[++i];
+            } else {
+                cerr << "Unknown option: " << args[i] << endl;
+                return 1;
+            }
+        }
+
         // sizes to test (number of tweets to process)
         vector<size_t> sizes = {100, 1000, 10000};
-        const int num_threads = 8;
+        Executor executor(num_threads);
 
         // load full training set once
         cout << "Processing training data..." << endl;
-        auto train_tweets = load_tweets(train_path);
+        TweetBatch train_tweets = load_tweet_batch(train_path, TweetSchema(), executor);
         if (train_tweets.empty()) {
             cerr << "No training tweets loaded" << endl;
             return 1;
         }
 
+        // One cleaned batch and workspace, refilled for every size.
+        TokenizedBatch cleaned;
+        CleanWorkspace clean_workspace;
         for (size_t n : sizes) {
             size_t use_n = min(n, train_tweets.size());
             cout << "\n=== Testing dataset size: " << use_n << " ===" << endl;
 
-            // prepare subset of tweets
-            vector<Tweet> subset_tweets(train_tweets.begin(), train_tweets.begin() + use_n);
+            // subset of tweets, as a view (nothing is copied)
+            TweetBatchView subset_tweets = train_tweets.slice(0, use_n);
 
-            // 1) Parallel preprocessing timing
-            TextPreprocessor preprocessor(num_threads);
+            // 1) Parallel preprocessing timing (cleaning and tokenizing)
+            TextPreprocessor preprocessor(executor);
             auto t_pre_start = high_resolution_clock::now();
-            vector<string> processed_texts = preprocessor.preprocess_batch(subset_tweets);
+            preprocessor.preprocess_tokenized(subset_tweets, cleaned, clean_workspace);
             auto t_pre_end = high_resolution_clock::now();
             auto pre_ms = duration_cast<milliseconds>(t_pre_end - t_pre_start).count();
 
             cout << "Parallel preprocessing time: " << pre_ms << " ms" << endl;
+            if (!processed_path.empty() && n == sizes.back()) {
+                save_processed_tweets(processed_path, subset_tweets, cleaned, executor);
+            }
 
             // 2) Parallel one-hot vocabulary build + embedding timing
-            ParallelEncoder encoder(5000, num_threads);
-            encoder.build_vocabulary(processed_texts); // build vocab from preprocessed texts
+            ParallelEncoder encoder(5000, executor);
+            if (!vocab_path.empty()) {
+                encoder.load_vocabulary(vocab_path);
+            } else {
+                encoder.build_vocabulary(cleaned); // build vocab from the token spans
+            }
 
             auto t_emb_start = high_resolution_clock::now();
-            auto encodings = encoder.encode_parallel(processed_texts);
+            SparseEncodings encodings = encoder.encode_sparse(cleaned);
             auto t_emb_end = high_resolution_clock::now();
             auto emb_ms = duration_cast<milliseconds>(t_emb_end - t_emb_start).count();
 
             cout << "Parallel embedding time: " << emb_ms << " ms" << endl;
             cout << "Vocabulary size used: " << encoder.get_vocab_size() << endl;
-            cout << "Encoded vectors: " << encodings.size() << " x " 
-                 << (encodings.empty() ? 0 : encodings[0].size()) << endl;
+            cout << "Encoded vectors: " << encodings.rows() << " x " << encodings.num_cols
+                 << " (" << encodings.nnz() << " non-zeros)" << endl;
         }
 
     } catch (const exception& e) {
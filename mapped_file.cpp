@@ -0,0 +1,72 @@
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Cannot open file: " + filename);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw runtime_error("Cannot stat file: " + filename);
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Cannot mmap file: " + filename);
+        }
+        madvise(addr, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(addr);
+    }
+    close(fd);
+    opened_ = true;
+}
+
+MappedFile::~MappedFile() {
+    release();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(other.data_), size_(other.size_), opened_(other.opened_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.opened_ = false;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        release();
+        swap(data_, other.data_);
+        swap(size_, other.size_);
+        swap(opened_, other.opened_);
+    }
+    return *this;
+}
+
+void MappedFile::drop_prefix(size_t bytes) const {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t length = min(bytes, size_) / page * page;
+    if (data_ && length > 0) {
+        madvise(const_cast<char*>(data_), length, MADV_DONTNEED);
+    }
+}
+
+void MappedFile::release() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    opened_ = false;
+}
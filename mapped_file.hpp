@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+// Read-only memory mapping of a whole file. Empty files map to a null
+// pointer with size 0. Throws runtime_error if the file cannot be mapped.
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool is_open() const { return opened_; }
+
+    // Tell the kernel the first `bytes` bytes will not be read again.
+    void drop_prefix(size_t bytes) const;
+
+private:
+    void release();
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool opened_ = false;
+};
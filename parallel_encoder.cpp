@@ -1,91 +1,375 @@
 #include "parallel_encoder.hpp"
+#include "embedding_io.hpp"
+#include "instrumentation.hpp"
+#include "parallel_utils.hpp"
+#include "token_counter.hpp"
 #include <algorithm>
-#include <regex>
+#include <atomic>
 #include <iostream>
 #include <chrono>
+#include <stdexcept>
 
 using namespace std::chrono;
 
-ParallelEncoder::ParallelEncoder(int vocab_size, int threads) 
-    : max_vocab_size(vocab_size), num_threads(threads) {
-    omp_set_num_threads(num_threads);
+namespace {
+
+// Calls emit(column, value) once per distinct column of one row's token ids,
+// in ascending column order, sorting ids in place. value is 1, or the number
+// of occurrences with_counts; signed ids with NEGATIVE_TOKEN count negative,
+// and a column whose signs cancel out is skipped.
+template <typename Emit>
+void for_each_column(vector<uint32_t>& ids, bool signed_ids, bool with_counts, Emit&& emit) {
+    if (signed_ids) {
+        // Move the sign below the column so both signs of a column sort together
+        for (auto& id : ids) id = (id & ~NEGATIVE_TOKEN) << 1 | id >> 31;
+    }
+    sort(ids.begin(), ids.end());
+
+    int shift = signed_ids ? 1 : 0;
+    for (size_t k = 0; k < ids.size();) {
+        uint32_t column = ids[k] >> shift;
+        float value = 0.0f;
+        while (k < ids.size() && ids[k] >> shift == column) {
+            size_t run = k;
+            while (k < ids.size() && ids[k] == ids[run]) k++;
+            float occurrences = with_counts ? static_cast<float>(k - run) : 1.0f;
+            value += signed_ids && (ids[run] & 1) ? -occurrences : occurrences;
+        }
+        if (value != 0.0f) emit(column, value);
+    }
 }
 
-vector<string> ParallelEncoder::tokenize(const string& text) const {
-    string cleaned = text;
-    transform(cleaned.begin(), cleaned.end(), cleaned.begin(), ::tolower);
-    
-    regex pattern("[^a-z0-9 ]");
-    cleaned = regex_replace(cleaned, pattern, " ");
-    
-    vector<string> tokens;
-    size_t start = 0, end = 0;
-    while ((end = cleaned.find(" ", start)) != string::npos) {
-        if (end > start) {
-            tokens.push_back(cleaned.substr(start, end - start));
+} // namespace
+
+ParallelEncoder::ParallelEncoder(int vocab_size, const Executor& executor)
+    : max_vocab_size(vocab_size), executor_(executor) {}
+
+void ParallelEncoder::set_feature_hashing(const FeatureHashing& hashing) {
+    if (hashing.dim > NEGATIVE_TOKEN) {
+        throw invalid_argument("Feature hashing dimension too large: " + to_string(hashing.dim));
+    }
+    hashing_ = hashing;
+}
+
+uint64_t ParallelEncoder::vocabulary_hash() const {
+    if (!hashing_.enabled()) return vocabulary.content_hash();
+    string scheme = "hashing v" + to_string(HASH_BYTES_VERSION) + " dim " + to_string(hashing_.dim) +
+                    " seed " + to_string(hashing_.seed) + (hashing_.signed_hash ? " signed" : "");
+    return hash_bytes(scheme);
+}
+
+void ParallelEncoder::save_vocabulary(const string& filename) const {
+    if (hashing_.enabled()) {
+        throw runtime_error("Feature hashing has no vocabulary to save: " + filename);
+    }
+    vocabulary.save(filename);
+}
+
+template <typename ForEachToken>
+void ParallelEncoder::build_approximate_vocabulary(const RowTasks& tasks,
+                                                   ForEachToken&& for_each_token) {
+    auto for_each_row = [&](auto&& visit) {
+        #pragma omp parallel num_threads(tasks.threads)
+        {
+            int tid = omp_get_thread_num();
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t t = 0; t < tasks.size(); t++) {
+                for (size_t i = tasks.begin(t); i < tasks.end(t); i++) visit(tid, i);
+            }
+        }
+    };
+
+    vector<SpaceSavingCounter> summaries;
+    size_t share = SpaceSavingCounter::capacity_for(vocabulary_budget_ / tasks.threads);
+    for (int t = 0; t < tasks.threads; t++) summaries.emplace_back(share);
+    {
+        TRACE_SCOPE("vocab_summarize");
+        for_each_row([&](int tid, size_t i) {
+            for_each_token(tid, i, [&](string_view token) { summaries[tid].add(token); });
+        });
+    }
+
+    // The merged summary only lives until its words are taken out, so the
+    // recount below does not run on top of it.
+    vector<SpaceSavingCounter::Entry> candidates;
+    estimate_ = VocabularyEstimate();
+    {
+        SpaceSavingCounter merged(SpaceSavingCounter::capacity_for(vocabulary_budget_));
+        TRACE_SCOPE("vocab_merge");
+        for (auto& summary : summaries) {
+            merged.merge(summary);
+            summary = SpaceSavingCounter(1);
+        }
+        estimate_.capacity = merged.capacity();
+        estimate_.tokens = merged.total();
+        estimate_.floor = merged.floor();
+        candidates = move(merged).take_ranked();
+    }
+    for (size_t i = 0; i < min(candidates.size(), size_t(max_vocab_size)); i++) {
+        estimate_.max_error = max(estimate_.max_error, candidates[i].error);
+    }
+    size_t keep = min(candidates.size(), size_t(max_vocab_size));
+    vector<string> words;
+    vector<uint64_t> counts;
+
+    if (estimate_.floor == 0) {
+        // Nothing was evicted or pruned, so every estimate is a true count
+        // and the candidates are already ranked.
+        for (size_t i = 0; i < keep; i++) {
+            words.push_back(move(candidates[i].word));
+            counts.push_back(candidates[i].count);
+        }
+    } else {
+        TRACE_SCOPE("vocab_recount");
+        // Intern the candidates and drop every other copy of them, then
+        // count into one shared array rather than one per thread.
+        FrozenVocabulary table;
+        {
+            vector<string> candidate_words;
+            candidate_words.reserve(candidates.size());
+            for (auto& entry : candidates) candidate_words.push_back(move(entry.word));
+            candidates = {};
+            table = FrozenVocabulary(candidate_words);
+        }
+        vector<atomic<uint64_t>> exact(table.size());
+        for_each_row([&](int tid, size_t i) {
+            for_each_token(tid, i, [&](string_view token) {
+                int id = table.find(token);
+                if (id >= 0) exact[id].fetch_add(1, memory_order_relaxed);
+            });
+        });
+
+        vector<uint32_t> ranked(table.size());
+        for (size_t id = 0; id < ranked.size(); id++) ranked[id] = static_cast<uint32_t>(id);
+        partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end(), [&](uint32_t a, uint32_t b) {
+            uint64_t count_a = exact[a].load(memory_order_relaxed);
+            uint64_t count_b = exact[b].load(memory_order_relaxed);
+            return count_a != count_b ? count_a > count_b : table.word(a) < table.word(b);
+        });
+        for (size_t i = 0; i < keep; i++) {
+            words.emplace_back(table.word(ranked[i]));
+            counts.push_back(exact[ranked[i]].load(memory_order_relaxed));
         }
-        start = end + 1;
+        estimate_.recounted = true;
     }
-    if (start < cleaned.length()) {
-        tokens.push_back(cleaned.substr(start));
+
+    estimate_.exact = estimate_.floor == 0 ||
+                      (keep == size_t(max_vocab_size) && keep > 0 && counts[keep - 1] > estimate_.floor);
+    vocabulary = FrozenVocabulary(words, counts);
+
+    if (verbose_) {
+        cout << "Approximate vocabulary: " << estimate_.tokens << " tokens, " << estimate_.capacity
+             << " words monitored, none left out above " << estimate_.floor << " occurrences ("
+             << (estimate_.exact ? "exact" : "not provably exact") << ")" << endl;
     }
-    return tokens;
 }
 
-void ParallelEncoder::build_vocabulary(const vector<string>& texts) {
-    unordered_map<string, int> word_freq;
-    
-    #pragma omp parallel
+void ParallelEncoder::build_vocabulary(const vector<string>& texts, TokenCache* cache) {
+    TRACE_SCOPE("build_vocabulary");
+    if (hashing_.enabled()) {
+        if (cache) *cache = lookup_tokens(texts);
+        return;
+    }
+    if (vocabulary_budget_ > 0) {
+        RowTasks tasks = executor_.plan(Stage::COUNT, texts.size(),
+                                        [&](size_t i) { return texts[i].size(); });
+        vector<string> scratch(tasks.threads);
+        build_approximate_vocabulary(tasks, [&](int tid, size_t i, auto&& emit) {
+            Tokenizer::for_each(texts[i], scratch[tid], emit);
+        });
+        if (cache) *cache = lookup_tokens(texts);
+        return;
+    }
+
+    RowTasks tasks = executor_.plan(Stage::COUNT, texts.size(),
+                                    [&](size_t i) { return texts[i].size(); });
+    ShardedTokenCounter counter(tasks.threads);
+    vector<string> scratch(tasks.threads);
+
+    // One tokenization pass: count into per-thread shards and keep the token
+    // spans so the cache can be resolved once the vocabulary is known.
+    vector<uint64_t> span_offsets;
+    vector<TokenSpan> spans;
+    gather_rows(tasks, span_offsets, spans,
+                [&](size_t i, vector<TokenSpan>& out, int tid) {
+                    string_view text(texts[i]);
+                    string& lower = scratch[tid];
+                    Tokenizer::for_each_span(text, [&](size_t offset, size_t length) {
+                        string_view token = Tokenizer::lowercase(text.substr(offset, length), lower);
+                        counter.add(tid, token, 1, token.data() != lower.data());
+                        if (cache) {
+                            out.push_back({static_cast<uint32_t>(offset),
+                                           static_cast<uint32_t>(length)});
+                        }
+                    });
+                }, "vocab_count");
+
+    vector<string> words;
+    vector<uint64_t> counts;
+    {
+        TRACE_SCOPE("vocab_merge");
+        counter.merge();
+    }
     {
-        unordered_map<string, int> local_freq;
-        
-        #pragma omp for schedule(dynamic)
-        for (const auto& text : texts) {
-            auto tokens = tokenize(text);
-            for (const auto& token : tokens) {
-                local_freq[token]++;
+        TRACE_SCOPE("vocab_top_k");
+        for (auto& entry : counter.top_k(max_vocab_size)) {
+            words.push_back(move(entry.first));
+            counts.push_back(entry.second);
+        }
+        vocabulary = FrozenVocabulary(words, counts);
+    }
+
+    if (!cache) return;
+    cache->tokens = spans.size();
+    RowTasks lookup_tasks = executor_.plan(Stage::ENCODE, texts.size(), [&](size_t i) {
+        return span_offsets[i + 1] - span_offsets[i];
+    });
+    scratch.resize(lookup_tasks.threads);
+    gather_rows(lookup_tasks, cache->row_offsets, cache->ids,
+                [&](size_t i, vector<uint32_t>& out, int tid) {
+                    string_view text(texts[i]);
+                    for (uint64_t k = span_offsets[i]; k < span_offsets[i + 1]; k++) {
+                        string_view token = text.substr(spans[k].offset, spans[k].length);
+                        int64_t id = lookup(Tokenizer::lowercase(token, scratch[tid]));
+                        if (id >= 0) out.push_back(static_cast<uint32_t>(id));
+                    }
+                }, "lookup");
+    TRACE_COUNT(TOKENS, cache->tokens);
+    TRACE_COUNT(OOV_TOKENS, cache->tokens - cache->ids.size());
+}
+
+void ParallelEncoder::build_vocabulary(const TokenizedBatch& batch, TokenCache* cache) {
+    TRACE_SCOPE("build_vocabulary");
+    if (!hashing_.enabled() && vocabulary_budget_ > 0) {
+        RowTasks tasks = executor_.plan(Stage::COUNT, batch.rows(), [&](size_t i) {
+            return batch.span_offsets[i + 1] - batch.span_offsets[i];
+        });
+        build_approximate_vocabulary(tasks, [&](int, size_t i, auto&& emit) {
+            size_t num_tokens = batch.span_offsets[i + 1] - batch.span_offsets[i];
+            for (size_t k = 0; k < num_tokens; k++) emit(batch.token(i, k));
+        });
+    } else if (!hashing_.enabled()) {
+        RowTasks tasks = executor_.plan(Stage::COUNT, batch.rows(), [&](size_t i) {
+            return batch.span_offsets[i + 1] - batch.span_offsets[i];
+        });
+        ShardedTokenCounter counter(tasks.threads);
+
+        // Tokens are views into the batch, which outlives the counter.
+        #pragma omp parallel num_threads(tasks.threads)
+        {
+            TRACE_SCOPE("vocab_count");
+            int tid = omp_get_thread_num();
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t t = 0; t < tasks.size(); t++) {
+                for (size_t i = tasks.begin(t); i < tasks.end(t); i++) {
+                    size_t num_tokens = batch.span_offsets[i + 1] - batch.span_offsets[i];
+                    for (size_t k = 0; k < num_tokens; k++) counter.add(tid, batch.token(i, k));
+                }
             }
         }
-        
-        #pragma omp critical
+
+        vector<string> words;
+        vector<uint64_t> counts;
         {
-            for (const auto& pair : local_freq) {
-                word_freq[pair.first] += pair.second;
+            TRACE_SCOPE("vocab_merge");
+            counter.merge();
+        }
+        {
+            TRACE_SCOPE("vocab_top_k");
+            for (auto& entry : counter.top_k(max_vocab_size)) {
+                words.push_back(move(entry.first));
+                counts.push_back(entry.second);
             }
+            vocabulary = FrozenVocabulary(words, counts);
         }
     }
-    
-    vector<pair<string, int>> word_list(word_freq.begin(), word_freq.end());
-    sort(word_list.begin(), word_list.end(),
-         [](const auto& a, const auto& b) { return a.second > b.second; });
-    
-    vocabulary.clear();
-    for (size_t i = 0; i < min(static_cast<size_t>(max_vocab_size), word_list.size()); i++) {
-        vocabulary[word_list[i].first] = i;
-    }
+    if (cache) *cache = lookup_tokens(batch);
+}
+
+TokenCache ParallelEncoder::lookup_tokens(const vector<string>& texts) const {
+    TRACE_SCOPE("lookup_tokens");
+    TokenCache cache;
+    RowTasks tasks = executor_.plan(Stage::ENCODE, texts.size(),
+                                    [&](size_t i) { return texts[i].size(); });
+    vector<size_t> thread_tokens(tasks.threads, 0);
+    vector<string> scratch(tasks.threads);
+    gather_rows(tasks, cache.row_offsets, cache.ids,
+                [&](size_t i, vector<uint32_t>& out, int tid) {
+                    Tokenizer::for_each(texts[i], scratch[tid], [&](string_view token) {
+                        thread_tokens[tid]++;
+                        int64_t id = lookup(token);
+                        if (id >= 0) out.push_back(static_cast<uint32_t>(id));
+                    });
+                }, "lookup");
+    for (size_t count : thread_tokens) cache.tokens += count;
+    TRACE_COUNT(TOKENS, cache.tokens);
+    TRACE_COUNT(OOV_TOKENS, cache.tokens - cache.ids.size());
+    return cache;
+}
+
+TokenCache ParallelEncoder::lookup_tokens(const TokenizedBatch& batch) const {
+    TRACE_SCOPE("lookup_tokens");
+    TokenCache cache;
+    cache.tokens = batch.spans.size();
+    RowTasks tasks = executor_.plan(Stage::ENCODE, batch.rows(), [&](size_t i) {
+        return batch.span_offsets[i + 1] - batch.span_offsets[i];
+    });
+    gather_rows(tasks, cache.row_offsets, cache.ids,
+                [&](size_t i, vector<uint32_t>& out, int) {
+                    size_t num_tokens = batch.span_offsets[i + 1] - batch.span_offsets[i];
+                    for (size_t k = 0; k < num_tokens; k++) {
+                        int64_t id = lookup(batch.token(i, k));
+                        if (id >= 0) out.push_back(static_cast<uint32_t>(id));
+                    }
+                }, "lookup");
+    TRACE_COUNT(TOKENS, cache.tokens);
+    TRACE_COUNT(OOV_TOKENS, cache.tokens - cache.ids.size());
+    return cache;
 }
 
 vector<vector<float>> ParallelEncoder::encode_parallel(const vector<string>& texts) {
+    TRACE_SCOPE("encode_parallel");
     auto start_time = high_resolution_clock::now();
     
-    vector<vector<float>> encodings(texts.size(), vector<float>(vocabulary.size(), 0.0f));
+    vector<vector<float>> encodings(texts.size(), vector<float>(get_vocab_size(), 0.0f));
+    ProgressReporter progress("texts", 1000, verbose_);
+    RowTasks tasks = executor_.plan(Stage::ENCODE, texts.size(),
+                                    [&](size_t i) { return texts[i].size(); });
     
-    #pragma omp parallel for schedule(dynamic)
-    for (size_t i = 0; i < texts.size(); i++) {
-        auto tokens = tokenize(texts[i]);
-        for (const auto& token : tokens) {
-            auto it = vocabulary.find(token);
-            if (it != vocabulary.end()) {
-                encodings[i][it->second] = 1.0f;
-            }
-        }
-        
-        #pragma omp critical
-        {
-            if (i % 1000 == 0) {
-                cout << "Processed " << i << " texts..." << endl;
+    #pragma omp parallel num_threads(tasks.threads)
+    {
+        TRACE_SCOPE("encode_rows");
+        string scratch;
+        vector<uint32_t> ids;
+        size_t pending = 0;
+        size_t tokens = 0, oov = 0;
+
+        #pragma omp for schedule(dynamic, 1) nowait
+        for (size_t t = 0; t < tasks.size(); t++) {
+            for (size_t i = tasks.begin(t); i < tasks.end(t); i++) {
+                ids.clear();
+                Tokenizer::for_each(texts[i], scratch, [&](string_view token) {
+                    int64_t id = lookup(token);
+                    tokens++;
+                    if (id >= 0) {
+                        ids.push_back(static_cast<uint32_t>(id));
+                    } else {
+                        oov++;
+                    }
+                });
+                for_each_column(ids, hashing_.signed_hash, false,
+                                [&](uint32_t column, float value) { encodings[i][column] = value; });
+
+                // Report in chunks so the shared counter is touched rarely.
+                if (++pending == 256) {
+                    progress.add(pending);
+                    pending = 0;
+                }
             }
         }
+        progress.add(pending);
+        TRACE_COUNT(TOKENS, tokens);
+        TRACE_COUNT(OOV_TOKENS, oov);
     }
     
     auto end_time = high_resolution_clock::now();
@@ -96,18 +380,23 @@ vector<vector<float>> ParallelEncoder::encode_parallel(const vector<string>& tex
 }
 
 vector<vector<float>> ParallelEncoder::encode_sequential(const vector<string>& texts) {
+    TRACE_SCOPE("encode_sequential");
     auto start_time = high_resolution_clock::now();
     
-    vector<vector<float>> encodings(texts.size(), vector<float>(vocabulary.size(), 0.0f));
+    vector<vector<float>> encodings(texts.size(), vector<float>(get_vocab_size(), 0.0f));
     
+    string scratch;
+    vector<uint32_t> ids;
     for (size_t i = 0; i < texts.size(); i++) {
-        auto tokens = tokenize(texts[i]);
-        for (const auto& token : tokens) {
-            auto it = vocabulary.find(token);
-            if (it != vocabulary.end()) {
-                encodings[i][it->second] = 1.0f;
+        ids.clear();
+        Tokenizer::for_each(texts[i], scratch, [&](string_view token) {
+            int64_t id = lookup(token);
+            if (id >= 0) {
+                ids.push_back(static_cast<uint32_t>(id));
             }
-        }
+        });
+        for_each_column(ids, hashing_.signed_hash, false,
+                        [&](uint32_t column, float value) { encodings[i][column] = value; });
     }
     
     auto end_time = high_resolution_clock::now();
@@ -115,4 +404,108 @@ vector<vector<float>> ParallelEncoder::encode_sequential(const vector<string>& t
     cout << "Sequential encoding took: " << duration.count() << " milliseconds" << endl;
     
     return encodings;
-}
\ No newline at end of file
+}
+
+SparseEncodings ParallelEncoder::encode_sparse(const vector<string>& texts, bool with_counts) {
+    return encode_sparse(lookup_tokens(texts), with_counts);
+}
+
+SparseEncodings ParallelEncoder::encode_sparse(const TokenizedBatch& batch, bool with_counts) {
+    return encode_sparse(lookup_tokens(batch), with_counts);
+}
+
+SparseEncodings ParallelEncoder::encode_sparse(const TokenCache& cache, bool with_counts) {
+    TRACE_SCOPE("encode_sparse");
+    auto start_time = high_resolution_clock::now();
+
+    SparseEncodings result;
+    result.num_cols = get_vocab_size();
+
+    // Signed hashing needs values even without counts.
+    const bool signed_ids = hashing_.signed_hash;
+    const bool with_values = with_counts || signed_ids;
+
+    // One pass: every row's ids are sorted once into a per-thread buffer and
+    // its columns appended to the thread's chunk, then the chunks are
+    // gathered in row order.
+    RowTasks tasks = executor_.plan(Stage::ENCODE, cache.rows(), [&](size_t i) {
+        return cache.row_offsets[i + 1] - cache.row_offsets[i];
+    });
+    vector<vector<uint32_t>> thread_ids(tasks.threads);
+    auto row_ids = [&](size_t row, int tid) -> vector<uint32_t>& {
+        auto& ids = thread_ids[tid];
+        ids.assign(cache.ids.begin() + cache.row_offsets[row],
+                   cache.ids.begin() + cache.row_offsets[row + 1]);
+        return ids;
+    };
+
+    if (with_values) {
+        vector<uint64_t> value_offsets;  // same as row_offsets
+        gather_rows(tasks, result.row_offsets, result.indices, value_offsets, result.counts,
+                    [&](size_t i, vector<uint32_t>& columns, vector<float>& values, int tid) {
+                        for_each_column(row_ids(i, tid), signed_ids, with_counts,
+                                        [&](uint32_t column, float value) {
+                                            columns.push_back(column);
+                                            values.push_back(value);
+                                        });
+                    }, "encode_rows");
+    } else {
+        gather_rows(tasks, result.row_offsets, result.indices,
+                    [&](size_t i, vector<uint32_t>& columns, int tid) {
+                        for_each_column(row_ids(i, tid), false, false,
+                                        [&](uint32_t column, float) { columns.push_back(column); });
+                    }, "encode_rows");
+    }
+
+    auto end_time = high_resolution_clock::now();
+    auto duration = duration_cast<milliseconds>(end_time - start_time);
+    if (verbose_) {
+        cout << "Sparse encoding took: " << duration.count() << " milliseconds" << endl;
+    }
+
+    return result;
+}
+
+void SparseEncodings::dense_row(size_t row, float* out) const {
+    fill(out, out + num_cols, 0.0f);
+    for (uint64_t k = row_offsets[row]; k < row_offsets[row + 1]; k++) {
+        out[indices[k]] = has_counts() ? counts[k] : 1.0f;
+    }
+}
+
+vector<vector<float>> SparseEncodings::to_dense(const Executor& executor) const {
+    vector<vector<float>> dense(rows(), vector<float>(num_cols, 0.0f));
+
+    #pragma omp parallel for schedule(static) num_threads(executor.threads_for(Stage::ENCODE, rows()))
+    for (size_t i = 0; i < rows(); i++) {
+        dense_row(i, dense[i].data());
+    }
+    return dense;
+}
+
+void ParallelEncoder::load_vocabulary(const string& filename) {
+    auto start_time = high_resolution_clock::now();
+    vocabulary = FrozenVocabulary::load(filename);
+    hashing_ = FeatureHashing();
+    auto end_time = high_resolution_clock::now();
+    if (verbose_) {
+        cout << "Loaded " << vocabulary.size() << " words from " << filename << " in "
+             << duration_cast<microseconds>(end_time - start_time).count() << " us" << endl;
+    }
+}
+
+void ParallelEncoder::save_encodings(const string& filename,
+                                     const vector<vector<float>>& encodings) const {
+    write_embeddings(filename, encodings, vocabulary_hash(), executor_);
+}
+
+void ParallelEncoder::save_sparse_encodings(const string& filename,
+                                            const SparseEncodings& encodings,
+                                            bool bit_packed) const {
+    if (bit_packed && encodings.has_counts() && hashing_.signed_hash) {
+        throw runtime_error("Signed hashing values cannot be bit-packed: " + filename);
+    }
+    write_embeddings(filename, encodings,
+                     bit_packed ? EmbeddingLayout::ONEHOT_BITS : EmbeddingLayout::SPARSE_CSR,
+                     vocabulary_hash(), executor_);
+}
@@ -1,40 +1,151 @@
 #pragma once
 #include <string>
 #include <vector>
-#include <unordered_map>
 #include <omp.h>
 #include <fstream>
+#include <cstdint>
+#include "tokenizer.hpp"
+#include "executor.hpp"
+#include "frozen_vocabulary.hpp"
+#include "hash_utils.hpp"
 
 using namespace std;
 
+// Vocabulary-free encoding: every token goes straight to one of dim columns
+// by hash, so there is no counting pass and no shared table, and shards
+// encoded separately agree on the columns as long as dim and seed match.
+// With signed_hash another hash bit makes a token count +1 or -1, so
+// colliding tokens tend to cancel instead of piling up.
+struct FeatureHashing {
+    size_t dim = 0;            // 0 selects the vocabulary
+    uint64_t seed = 0;
+    bool signed_hash = false;
+
+    bool enabled() const { return dim > 0; }
+};
+
+// Set on a signed-hashing token id whose token counts -1.
+constexpr uint32_t NEGATIVE_TOKEN = 1u << 31;
+
+// In-vocabulary token ids of a batch, in text order with repeats (hashed
+// columns, possibly with NEGATIVE_TOKEN, in hashing mode). Row i owns
+// ids[row_offsets[i] .. row_offsets[i + 1]). Built once so that encoding
+// does not have to tokenize again.
+struct TokenCache {
+    vector<uint64_t> row_offsets{0};
+    vector<uint32_t> ids;
+    size_t tokens = 0;  // every token seen, including out-of-vocabulary ones
+
+    size_t rows() const { return row_offsets.size() - 1; }
+};
+
+// Compressed sparse row form of a one-hot batch. Row i owns
+// indices[row_offsets[i] .. row_offsets[i + 1]), sorted ascending.
+// counts is parallel to indices and only filled when requested, or with
+// signed hashing, where it holds each column's sum of +1/-1.
+struct SparseEncodings {
+    size_t num_cols = 0;
+    vector<uint64_t> row_offsets{0};
+    vector<uint32_t> indices;
+    vector<float> counts;
+
+    size_t rows() const { return row_offsets.size() - 1; }
+    size_t nnz() const { return indices.size(); }
+    bool has_counts() const { return !counts.empty(); }
+
+    // Write row `row` as a dense vector of num_cols floats into out.
+    void dense_row(size_t row, float* out) const;
+    vector<vector<float>> to_dense(const Executor& executor = Executor::global()) const;
+};
+
+// How the last approximate vocabulary build went (see
+// ParallelEncoder::set_vocabulary_budget).
+struct VocabularyEstimate {
+    size_t capacity = 0;     // words the merged summary could monitor
+    uint64_t tokens = 0;     // tokens counted
+    uint64_t floor = 0;      // no word left out of the summary occurred more often
+    uint64_t max_error = 0;  // largest overcount among the chosen words' estimates
+    bool recounted = false;  // candidates were counted again exactly
+    bool exact = false;      // provably the vocabulary an exact count would pick
+};
+
 class ParallelEncoder {
 public:
-    ParallelEncoder(int vocab_size = 5000, int num_threads = 8);
-    void build_vocabulary(const vector<string>& texts);
+    // Parallel regions run on executor, which must outlive the encoder.
+    explicit ParallelEncoder(int vocab_size = 5000, const Executor& executor = Executor::global());
+    // Switch to feature hashing (or back to the vocabulary with dim 0).
+    // Throws invalid_argument if dim does not fit a column index.
+    void set_feature_hashing(const FeatureHashing& hashing);
+    const FeatureHashing& feature_hashing() const { return hashing_; }
+    // When cache is given it is filled with the token ids of texts against
+    // the new vocabulary, from the same tokenization pass used for counting.
+    // With feature hashing there is nothing to build; only the cache is filled.
+    void build_vocabulary(const vector<string>& texts, TokenCache* cache = nullptr);
+    // Same from texts cleaned and tokenized already; counts the spans.
+    void build_vocabulary(const TokenizedBatch& batch, TokenCache* cache = nullptr);
     vector<vector<float>> encode_parallel(const vector<string>& texts);
     vector<vector<float>> encode_sequential(const vector<string>& texts);
-    int get_vocab_size() const { return vocabulary.size(); }
-    void save_encodings(const string& filename, const vector<vector<float>>& encodings) const {
-        ofstream file(filename, ios::binary);
-        if (!file) {
-            throw runtime_error("Cannot open file for writing: " + filename);
-        }
-        
-        size_t n = encodings.size();
-        size_t dim = encodings.empty() ? 0 : encodings[0].size();
-        
-        file.write(reinterpret_cast<const char*>(&n), sizeof(n));
-        file.write(reinterpret_cast<const char*>(&dim), sizeof(dim));
-        
-        for (const auto& encoding : encodings) {
-            file.write(reinterpret_cast<const char*>(encoding.data()), 
-                      encoding.size() * sizeof(float));
-        }
+    SparseEncodings encode_sparse(const vector<string>& texts, bool with_counts = false);
+    SparseEncodings encode_sparse(const TokenCache& cache, bool with_counts = false);
+    SparseEncodings encode_sparse(const TokenizedBatch& batch, bool with_counts = false);
+    // Build vocabularies in at most about bytes of counting memory instead
+    // of counting every distinct token (0, the default). Each thread keeps a
+    // Space-Saving summary in its share of the budget; the summaries are
+    // merged into one of the whole budget, and unless nothing was evicted
+    // its candidates are counted again exactly, so the result is exact
+    // whenever the last word chosen occurred more often than any word the
+    // summary lost. Peak use is about twice the budget while the per-thread
+    // summaries are merged into one. The merged summary is released before
+    // the recount, which holds the candidates interned (and, while the table
+    // is built, as strings) plus 12 bytes each for one shared count array
+    // and the ranking: under 1.5 times the budget even if every candidate
+    // were as long as SpaceSavingCounter::MAX_WORD_BYTES, about half of it
+    // for tweet-sized words.
+    void set_vocabulary_budget(size_t bytes) { vocabulary_budget_ = bytes; }
+    const VocabularyEstimate& vocabulary_estimate() const { return estimate_; }
+    TokenCache lookup_tokens(const vector<string>& texts) const;
+    TokenCache lookup_tokens(const TokenizedBatch& batch) const;
+    // Number of columns: the vocabulary size, or the hashing dimension.
+    int get_vocab_size() const {
+        return hashing_.enabled() ? static_cast<int>(hashing_.dim) : vocabulary.size();
     }
+    const FrozenVocabulary& get_vocabulary() const { return vocabulary; }
+    // Per-call timing lines on cout; streaming callers turn them off.
+    void set_verbose(bool verbose) { verbose_ = verbose; }
+    // Stable fingerprint of the id -> word mapping, stored in embedding files
+    // so encodings built against different vocabularies can be told apart.
+    // In hashing mode it covers dim, seed, sign and the hash version instead.
+    uint64_t vocabulary_hash() const;
+    // Persist the vocabulary with its word frequencies, or replace it with
+    // one saved earlier so other data can be encoded against the same
+    // columns without a counting pass. Both throw runtime_error; loading
+    // leaves hashing mode.
+    void save_vocabulary(const string& filename) const;
+    void load_vocabulary(const string& filename);
+    void save_encodings(const string& filename, const vector<vector<float>>& encodings) const;
+    void save_sparse_encodings(const string& filename, const SparseEncodings& encodings,
+                               bool bit_packed = false) const;
 
 private:
-    vector<string> tokenize(const string& text) const;
-    unordered_map<string, int> vocabulary;
+    // Token id, or -1 when out of vocabulary. Hashed columns come from the
+    // high bits of the hash (multiply-shift), the sign from the lowest.
+    int64_t lookup(string_view token) const {
+        if (!hashing_.enabled()) return vocabulary.find(token);
+        uint64_t h = hash_bytes(token, hashing_.seed);
+        auto column = static_cast<uint32_t>((static_cast<unsigned __int128>(h) * hashing_.dim) >> 64);
+        if (hashing_.signed_hash && (h & 1)) column |= NEGATIVE_TOKEN;
+        return column;
+    }
+    // for_each_token(thread, row, emit) calls emit(token) for every token of
+    // row; thread indexes per-thread scratch space.
+    template <typename ForEachToken>
+    void build_approximate_vocabulary(const RowTasks& tasks, ForEachToken&& for_each_token);
+
+    FrozenVocabulary vocabulary;
+    FeatureHashing hashing_;
+    size_t vocabulary_budget_ = 0;
+    VocabularyEstimate estimate_;
     int max_vocab_size;
-    int num_threads;
+    const Executor& executor_;
+    bool verbose_ = true;
 };
\ No newline at end of file
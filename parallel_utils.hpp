@@ -0,0 +1,147 @@
+#pragma once
+#include "executor.hpp"
+#include "instrumentation.hpp"
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Working arrays of gather_rows: each thread's items and where every row
+// landed in them. Passing the same space to every call keeps their
+// capacity, so gathering batches of a steady size stops allocating.
+template <typename A, typename B = A>
+struct GatherSpace {
+    vector<vector<A>> thread_a;
+    vector<vector<B>> thread_b;
+    vector<int> owner;
+    vector<uint64_t> local_a;
+    vector<uint64_t> local_b;
+
+    void prepare(int threads, size_t rows, bool two_pairs) {
+        thread_a.resize(threads);
+        for (auto& out : thread_a) out.clear();
+        if (two_pairs) {
+            thread_b.resize(threads);
+            for (auto& out : thread_b) out.clear();
+            local_b.resize(rows);
+        }
+        owner.resize(rows);
+        local_a.resize(rows);
+    }
+};
+
+// Build a CSR-style (offsets, items) pair in parallel without per-row
+// allocations. produce(row, out, thread) appends the row's items to out,
+// which is a buffer private to the calling thread; rows are then gathered
+// in order so row i owns items[offsets[i] .. offsets[i + 1]). tasks (see
+// Executor::plan) decides the team size and how rows are split. stage
+// names each thread's share of the work in traces.
+template <typename T, typename Produce>
+void gather_rows(GatherSpace<T>& space, const RowTasks& tasks, vector<uint64_t>& offsets,
+                 vector<T>& items, Produce produce, const char* stage = "gather_rows") {
+    size_t num_rows = tasks.rows();
+    offsets.assign(num_rows + 1, 0);
+    space.prepare(tasks.threads, num_rows, false);
+    auto& thread_items = space.thread_a;
+    auto& owner = space.owner;
+    auto& local_offset = space.local_a;
+
+    #pragma omp parallel num_threads(tasks.threads)
+    {
+        TRACE_SCOPE(stage);
+        int tid = omp_get_thread_num();
+        auto& local = thread_items[tid];
+
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t t = 0; t < tasks.size(); t++) {
+            for (size_t i = tasks.begin(t); i < tasks.end(t); i++) {
+                owner[i] = tid;
+                local_offset[i] = local.size();
+                produce(i, local, tid);
+                offsets[i + 1] = local.size() - local_offset[i];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < num_rows; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    items.resize(offsets.back());
+
+    #pragma omp parallel for schedule(static) num_threads(tasks.threads)
+    for (size_t i = 0; i < num_rows; i++) {
+        const T* src = thread_items[owner[i]].data() + local_offset[i];
+        copy(src, src + (offsets[i + 1] - offsets[i]), items.begin() + offsets[i]);
+    }
+}
+
+// gather_rows with working arrays of its own for this call.
+template <typename T, typename Produce>
+void gather_rows(const RowTasks& tasks, vector<uint64_t>& offsets, vector<T>& items,
+                 Produce produce, const char* stage = "gather_rows") {
+    GatherSpace<T> space;
+    gather_rows(space, tasks, offsets, items, produce, stage);
+}
+
+// gather_rows for two CSR pairs filled in the same pass over the rows:
+// produce(row, out_a, out_b, thread) appends the row's items of each kind,
+// e.g. the bytes of a cleaned text and the token spans inside it.
+template <typename A, typename B, typename Produce>
+void gather_rows(GatherSpace<A, B>& space, const RowTasks& tasks, vector<uint64_t>& offsets_a,
+                 vector<A>& items_a, vector<uint64_t>& offsets_b, vector<B>& items_b,
+                 Produce produce, const char* stage = "gather_rows") {
+    size_t num_rows = tasks.rows();
+    offsets_a.assign(num_rows + 1, 0);
+    offsets_b.assign(num_rows + 1, 0);
+    space.prepare(tasks.threads, num_rows, true);
+    auto& thread_a = space.thread_a;
+    auto& thread_b = space.thread_b;
+    auto& owner = space.owner;
+    auto& local_a = space.local_a;
+    auto& local_b = space.local_b;
+
+    #pragma omp parallel num_threads(tasks.threads)
+    {
+        TRACE_SCOPE(stage);
+        int tid = omp_get_thread_num();
+        auto& out_a = thread_a[tid];
+        auto& out_b = thread_b[tid];
+
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t t = 0; t < tasks.size(); t++) {
+            for (size_t i = tasks.begin(t); i < tasks.end(t); i++) {
+                owner[i] = tid;
+                local_a[i] = out_a.size();
+                local_b[i] = out_b.size();
+                produce(i, out_a, out_b, tid);
+                offsets_a[i + 1] = out_a.size() - local_a[i];
+                offsets_b[i + 1] = out_b.size() - local_b[i];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < num_rows; i++) {
+        offsets_a[i + 1] += offsets_a[i];
+        offsets_b[i + 1] += offsets_b[i];
+    }
+    items_a.resize(offsets_a.back());
+    items_b.resize(offsets_b.back());
+
+    #pragma omp parallel for schedule(static) num_threads(tasks.threads)
+    for (size_t i = 0; i < num_rows; i++) {
+        const A* src_a = thread_a[owner[i]].data() + local_a[i];
+        copy(src_a, src_a + (offsets_a[i + 1] - offsets_a[i]), items_a.begin() + offsets_a[i]);
+        const B* src_b = thread_b[owner[i]].data() + local_b[i];
+        copy(src_b, src_b + (offsets_b[i + 1] - offsets_b[i]), items_b.begin() + offsets_b[i]);
+    }
+}
+
+template <typename A, typename B, typename Produce>
+void gather_rows(const RowTasks& tasks, vector<uint64_t>& offsets_a, vector<A>& items_a,
+                 vector<uint64_t>& offsets_b, vector<B>& items_b, Produce produce,
+                 const char* stage = "gather_rows") {
+    GatherSpace<A, B> space;
+    gather_rows(space, tasks, offsets_a, items_a, offsets_b, items_b, produce, stage);
+}
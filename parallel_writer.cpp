@@ -0,0 +1,74 @@
+#include "parallel_writer.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+PositionalFile::PositionalFile(const string& filename) : filename_(filename) {
+    fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw runtime_error("Cannot open file for writing: " + filename);
+    }
+}
+
+PositionalFile::~PositionalFile() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void PositionalFile::write_at(uint64_t offset, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = pwrite(fd_, p, size, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            throw runtime_error("Failed writing " + filename_ + ": " + strerror(errno));
+        }
+        p += written;
+        offset += written;
+        size -= written;
+    }
+}
+
+void PositionalFile::close() {
+    if (fd_ < 0) return;
+    int result = ::close(fd_);
+    fd_ = -1;
+    if (result != 0) {
+        throw runtime_error("Failed writing " + filename_ + ": " + strerror(errno));
+    }
+}
+
+void write_block(PositionalFile& file, uint64_t offset, const void* data, size_t size,
+                 const Executor& executor) {
+    const char* bytes = static_cast<const char*>(data);
+    size_t pieces = max<size_t>(1, min<size_t>(executor.threads_for(Stage::WRITE),
+                                               size / WRITE_CHUNK_BYTES));
+    size_t piece = (size + pieces - 1) / pieces;
+    exception_ptr failure;
+
+    #pragma omp parallel for schedule(static) num_threads(static_cast<int>(pieces))
+    for (size_t p = 0; p < pieces; p++) {
+        size_t begin = min(size, p * piece);
+        size_t end = min(size, begin + piece);
+        try {
+            file.write_at(offset + begin, bytes + begin, end - begin);
+        } catch (...) {
+            #pragma omp critical
+            if (!failure) failure = current_exception();
+        }
+    }
+    if (failure) rethrow_exception(failure);
+}
+
+void append_csv_field(string& out, string_view field) {
+    out += '"';
+    size_t start = 0, quote;
+    while ((quote = field.find('"', start)) != string_view::npos) {
+        out.append(field.data() + start, quote + 1 - start);
+        out += '"';
+        start = quote + 1;
+    }
+    out.append(field.data() + start, field.size() - start);
+    out += '"';
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "executor.hpp"
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Output file written with positional writes (pwrite), so threads can fill
+// disjoint ranges at the same time without sharing a file position. The
+// file is created or truncated on open; ranges never written read as zeros.
+// Throws runtime_error when the file cannot be opened or written.
+class PositionalFile {
+public:
+    explicit PositionalFile(const string& filename);
+    ~PositionalFile();
+
+    PositionalFile(const PositionalFile&) = delete;
+    PositionalFile& operator=(const PositionalFile&) = delete;
+
+    void write_at(uint64_t offset, const void* data, size_t size);
+    // Reports errors the kernel only returns on close.
+    void close();
+    const string& filename() const { return filename_; }
+
+private:
+    string filename_;
+    int fd_ = -1;
+};
+
+// Write size bytes of data at offset, in pieces spread over up to
+// executor.threads_for(Stage::WRITE) threads.
+void write_block(PositionalFile& file, uint64_t offset, const void* data, size_t size,
+                 const Executor& executor);
+
+// Append field to out as a quoted CSV field, doubling embedded quotes, so
+// commas, quotes and newlines in the text survive a round trip.
+void append_csv_field(string& out, string_view field);
+
+// Write rows back to back from offset, on up to
+// executor.threads_for(Stage::WRITE, rows) threads, and return the offset
+// after the last one. Rows are cut into chunks of about WRITE_CHUNK_BYTES by
+// estimate(row), the expected formatted size. Every thread formats whole
+// chunks with format(row, out), appending to a buffer of its own; a prefix
+// sum over the buffer sizes then places each chunk, and the same threads
+// write their buffers with write_at. Chunks go in rounds of a few per
+// thread, so only one round of output is held in memory.
+constexpr size_t WRITE_CHUNK_BYTES = 4 << 20;
+constexpr size_t WRITE_CHUNKS_PER_THREAD = 2;
+
+template <typename Estimate, typename Format>
+uint64_t write_rows(PositionalFile& file, uint64_t offset, size_t rows, const Executor& executor,
+                    Estimate estimate, Format format) {
+    vector<size_t> bounds{0};
+    size_t load = 0;
+    for (size_t i = 0; i < rows; i++) {
+        load += estimate(i);
+        if (load >= WRITE_CHUNK_BYTES) {
+            bounds.push_back(i + 1);
+            load = 0;
+        }
+    }
+    if (bounds.back() < rows) bounds.push_back(rows);
+    size_t num_chunks = bounds.size() - 1;
+    int threads = max(1, min<int>(executor.threads_for(Stage::WRITE, rows), static_cast<int>(num_chunks)));
+
+    size_t round_size = threads * WRITE_CHUNKS_PER_THREAD;
+    vector<string> buffers(round_size);
+    vector<uint64_t> starts(round_size + 1);
+    exception_ptr failure;
+
+    for (size_t first = 0; first < num_chunks; first += round_size) {
+        size_t count = min(round_size, num_chunks - first);
+
+        #pragma omp parallel num_threads(threads)
+        {
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t c = 0; c < count; c++) {
+                string& out = buffers[c];
+                out.clear();
+                for (size_t i = bounds[first + c]; i < bounds[first + c + 1]; i++) {
+                    format(i, out);
+                }
+            }
+
+            #pragma omp single
+            {
+                starts[0] = offset;
+                for (size_t c = 0; c < count; c++) starts[c + 1] = starts[c] + buffers[c].size();
+            }
+
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t c = 0; c < count; c++) {
+                try {
+                    file.write_at(starts[c], buffers[c].data(), buffers[c].size());
+                } catch (...) {
+                    #pragma omp critical
+                    if (!failure) failure = current_exception();
+                }
+            }
+        }
+
+        if (failure) rethrow_exception(failure);
+        offset = starts[count];
+    }
+    return offset;
+}
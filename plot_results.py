@@ -1,83 +1,104 @@
+import json
+import sys
+from collections import defaultdict
+
 import matplotlib.pyplot as plt
-import numpy as np
 
-# Data points (dataset sizes)
-sizes = [100, 1000, 10000]
+# Results written by the benchmark executable:
+#   ./benchmark --out benchmark_results.json
+#   python3 plot_results.py [benchmark_results.json]
+RESULTS_PATH = sys.argv[1] if len(sys.argv) > 1 else 'benchmark_results.json'
 
-# Sequential times (in milliseconds)
-sequential_preprocessing = [48, 417, 3678]  # from your sequential output
-sequential_embedding = [16, 138, 1276]
+STAGES = ['load', 'clean', 'tokenize', 'vocab', 'encode', 'save']
 
-# Parallel times (in milliseconds)
-parallel_preprocessing = [16, 111, 1012]  # from your parallel output
-parallel_embedding = [2, 20, 241]
 
-def create_comparison_plot():
-    plt.figure(figsize=(12, 6))
-    
+def load_results(path):
+    with open(path) as f:
+        return json.load(f)['results']
+
+
+def by_stage(results):
+    """stage -> threads -> sorted [(size, result)]"""
+    grouped = defaultdict(lambda: defaultdict(list))
+    for r in results:
+        grouped[r['stage']][r['threads']].append((r['size'], r))
+    for stage in grouped.values():
+        for runs in stage.values():
+            runs.sort(key=lambda item: item[0])
+    return grouped
+
+
+def create_comparison_plot(results):
+    grouped = by_stage(results)
+    stages = [s for s in STAGES if s in grouped]
+
+    plt.figure(figsize=(6 * len(stages) / 2, 9))
+
     # Add inscription text
     inscription = "Parallel vs Sequential Sentiment Analysis\nRaghav Sharma (2023BCS50) & Gaurav Jhalani (2023BCS32)"
     plt.figtext(0.5, 1.05, inscription, ha='center', va='center', fontsize=12, fontweight='bold')
-    
-    # Preprocessing comparison
-    plt.subplot(1, 2, 1)
-    plt.plot(sizes, sequential_preprocessing, 'ro-', label='Sequential')
-    plt.plot(sizes, parallel_preprocessing, 'bo-', label='Parallel')
-    plt.title('Preprocessing Time Comparison')
-    plt.xlabel('Dataset Size')
-    plt.ylabel('Time (ms)')
-    plt.xscale('log')
-    plt.yscale('log')
-    plt.grid(True)
-    plt.legend()
-    
-    # Embedding comparison
-    plt.subplot(1, 2, 2)
-    plt.plot(sizes, sequential_embedding, 'ro-', label='Sequential')
-    plt.plot(sizes, parallel_embedding, 'bo-', label='Parallel')
-    plt.title('Embedding Time Comparison')
-    plt.xlabel('Dataset Size')
-    plt.ylabel('Time (ms)')
-    plt.xscale('log')
-    plt.yscale('log')
-    plt.grid(True)
-    plt.legend()
-    
-    plt.suptitle('Sequential vs Parallel Processing Times\nRaghav Sharma 2023BCS0050', y=1.05)
+
+    for i, stage in enumerate(stages):
+        plt.subplot(2, (len(stages) + 1) // 2, i + 1)
+        for threads, runs in sorted(grouped[stage].items()):
+            sizes = [size for size, _ in runs]
+            medians = [r['median_ms'] for _, r in runs]
+            p95 = [r['p95_ms'] for _, r in runs]
+            line, = plt.plot(sizes, medians, 'o-', label=f'{threads} threads')
+            plt.fill_between(sizes, medians, p95, color=line.get_color(), alpha=0.15)
+        plt.title(f'{stage.capitalize()} Time (median, p95 band)')
+        plt.xlabel('Dataset Size')
+        plt.ylabel('Time (ms)')
+        plt.xscale('log')
+        plt.yscale('log')
+        plt.grid(True)
+        plt.legend()
+
+    plt.suptitle('Per-Stage Processing Times\nRaghav Sharma 2023BCS0050', y=1.05)
     plt.tight_layout()
-    
+
     # Save the plot
     plt.savefig('performance_comparison.png', bbox_inches='tight', dpi=300)
     plt.close()
 
-def create_speedup_plot():
-    # Calculate speedup
-    preprocessing_speedup = [s/p for s, p in zip(sequential_preprocessing, parallel_preprocessing)]
-    embedding_speedup = [s/p for s, p in zip(sequential_embedding, parallel_embedding)]
-    
-    plt.figure(figsize=(10, 6))
-    
+
+def create_speedup_plot(results):
+    # Speedup at the largest dataset size of every stage
+    grouped = by_stage(results)
+    stages = [s for s in STAGES if s in grouped]
+
+    plt.figure(figsize=(12, 6))
+
     # Add inscription text
     inscription = "Speedup Analysis\nRaghav Sharma (2023BCS50) & Gaurav Jhalani (2023BCS32)"
     plt.figtext(0.5, 1.05, inscription, ha='center', va='center', fontsize=12, fontweight='bold')
-    
-    plt.plot(sizes, preprocessing_speedup, 'ro-', label='Preprocessing')
-    plt.plot(sizes, embedding_speedup, 'bo-', label='Embedding')
-    plt.title('Speedup Analysis\nRaghav Sharma 2023BCS0050')
-    plt.xlabel('Dataset Size')
-    plt.ylabel('Speedup (Sequential/Parallel)')
-    plt.xscale('log')
-    plt.grid(True)
-    plt.legend()
-    
+
+    for column, metric in enumerate(['speedup', 'efficiency']):
+        plt.subplot(1, 2, column + 1)
+        for stage in stages:
+            points = []
+            for threads, runs in sorted(grouped[stage].items()):
+                points.append((threads, runs[-1][1][metric]))
+            plt.plot([t for t, _ in points], [v for _, v in points], 'o-', label=stage)
+        if metric == 'speedup':
+            all_threads = sorted({r['threads'] for r in results})
+            plt.plot(all_threads, [t / all_threads[0] for t in all_threads], 'k--', label='Ideal')
+        plt.title(f'Parallel {metric.capitalize()} (largest size)')
+        plt.xlabel('Threads')
+        plt.ylabel(metric.capitalize())
+        plt.grid(True)
+        plt.legend()
+
     plt.tight_layout()
     plt.subplots_adjust(top=0.85)  # Adjust top margin for inscription
-    
+
     # Save plots with higher resolution
     plt.savefig('speedup_analysis.png', bbox_inches='tight', dpi=300)
     plt.close()
 
+
 if __name__ == "__main__":
-    create_comparison_plot()
-    create_speedup_plot()
-    print("Plots have been saved as 'performance_comparison.png' and 'speedup_analysis.png'")
\ No newline at end of file
+    results = load_results(RESULTS_PATH)
+    create_comparison_plot(results)
+    create_speedup_plot(results)
+    print("Plots have been saved as 'performance_comparison.png' and 'speedup_analysis.png'")
@@ -1,77 +1,360 @@
 #include "preprocessor.hpp"
+#include "parallel_utils.hpp"
+#include "utf8.hpp"
 #include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-TextPreprocessor::TextPreprocessor(int num_threads) : num_threads_(num_threads) {
-    if (num_threads_ <= 0) num_threads_ = 1;
-    omp_set_num_threads(num_threads_);
+namespace {
+
+// Byte classification for the single-pass cleaner. The rules mirror the old
+// regex pipeline: URLs, then mentions, then lowercase, then everything outside
+// [\w\s.,!?-] becomes a space, then whitespace runs collapse and get trimmed.
+struct CharTables {
+    bool space[256];  // std::regex \s in the classic locale
+    bool word[256];   // std::regex \w: [A-Za-z0-9_]
+    char out[256];    // lowercased byte to emit, or 0 for a separator
+
+    CharTables() {
+        for (int c = 0; c < 256; c++) {
+            space[c] = c == ' ' || c == '\t' || c == '\n' ||
+                       c == '\v' || c == '\f' || c == '\r';
+            word[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                      (c >= '0' && c <= '9') || c == '_';
+            out[c] = 0;
+            if (word[c] || c == '.' || c == ',' || c == '!' || c == '?' || c == '-') {
+                out[c] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c + 32)
+                                                : static_cast<char>(c);
+            }
+        }
+    }
+};
+
+const CharTables tables;
+
+inline unsigned char byte_at(const char* s, size_t i) {
+    return static_cast<unsigned char>(s[i]);
+}
+
+// If a URL ((https?://|www.)\S+) starts at pos, return the index just past it,
+// otherwise return pos unchanged.
+inline size_t skip_url(const char* s, size_t len, size_t pos) {
+    if (pos >= len) return pos;
+
+    size_t rem = len - pos;
+    const char* p = s + pos;
+    size_t prefix = 0;
+    if (p[0] == 'h') {
+        if (rem >= 7 && memcmp(p, "http://", 7) == 0) prefix = 7;
+        else if (rem >= 8 && memcmp(p, "https://", 8) == 0) prefix = 8;
+    } else if (p[0] == 'w') {
+        if (rem >= 4 && memcmp(p, "www.", 4) == 0) prefix = 4;
+    }
+    if (prefix == 0 || prefix >= rem || tables.space[byte_at(p, prefix)]) return pos;
+
+    size_t end = pos + prefix + 1;
+    while (end < len && !tables.space[byte_at(s, end)]) end++;
+    return end;
+}
+
+#ifdef __SSE2__
+// One 16-byte block of pure ASCII input, classified with SSE2: kept has a
+// bit for every byte the cleaner keeps, token for those that are token
+// characters, and lower receives the block with A-Z lowercased. Returns
+// false if a byte is non-ASCII or the block may start a URL or a mention;
+// those blocks take the byte loop.
+inline bool classify_ascii_block(const char* text, size_t len, size_t pos, char* lower,
+                                 uint32_t& kept, uint32_t& token) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+    if (_mm_movemask_epi8(v) != 0) return false;
+
+    auto eq = [&](char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); };
+    auto in_range = [&](char lo, char hi) {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                             _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+    };
+
+    if (_mm_movemask_epi8(eq('@')) != 0) return false;
+    uint32_t candidates = _mm_movemask_epi8(_mm_or_si128(eq('h'), eq('w')));
+    while (candidates) {
+        size_t at = pos + __builtin_ctz(candidates);
+        if (skip_url(text, len, at) != at) return false;
+        candidates &= candidates - 1;
+    }
+
+    __m128i upper = in_range('A', 'Z');
+    __m128i tokens = _mm_or_si128(_mm_or_si128(upper, in_range('a', 'z')), in_range('0', '9'));
+    __m128i punct = _mm_or_si128(_mm_or_si128(eq('_'), eq('.')),
+                                 _mm_or_si128(_mm_or_si128(eq(','), eq('!')),
+                                              _mm_or_si128(eq('?'), eq('-'))));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lower),
+                     _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+    token = _mm_movemask_epi8(tokens);
+    kept = token | _mm_movemask_epi8(punct);
+    return true;
+}
+#endif
+
+// The cleaning scanner. With Tokens set it also records token spans of the
+// output as it is written, so no second pass over the text is needed.
+// Pure-ASCII blocks go through classify_ascii_block and are written run by
+// run; the rest, UTF-8 included, goes byte by byte (code point by code
+// point): letters are case-folded, every emoji becomes a token of its own,
+// invalid sequences and other symbols separate words.
+template <bool Tokens>
+size_t clean_scan(const char* text, size_t len, string& out, vector<TokenSpan>* spans) {
+    // Every emitted byte consumes at least one input byte, so the input length
+    // is an upper bound and the buffer never grows inside the loop -- except
+    // for the spaces that set emoji apart, which make room for themselves.
+    out.resize(len);
+    char* dst = len ? &out[0] : nullptr;
+    size_t n = 0;
+    bool pending_space = false;
+    size_t token_start = 0;
+    bool in_token = false;
+    auto close_token = [&](size_t end) {
+        if (Tokens && in_token) {
+            spans->push_back({static_cast<uint32_t>(token_start),
+                              static_cast<uint32_t>(end - token_start)});
+            in_token = false;
+        }
+    };
+    auto emit = [&](char k) {
+        if (pending_space && n > 0) {
+            close_token(n);
+            dst[n++] = ' ';
+        }
+        pending_space = false;
+        if (Tokens) {
+            if (!Tokenizer::is_token_char(static_cast<unsigned char>(k))) {
+                close_token(n);
+            } else if (!in_token) {
+                token_start = n;
+                in_token = true;
+            }
+        }
+        dst[n++] = k;
+    };
+
+    size_t i = 0;
+    size_t scalar_until = 0;
+    while (i < len) {
+#ifdef __SSE2__
+        if (i >= scalar_until && i + 16 <= len) {
+            alignas(16) char lower[16];
+            uint32_t kept, token;
+            if (classify_ascii_block(text, len, i, lower, kept, token)) {
+                // Same effect as emit() per kept byte, but per run of them
+                uint32_t pos = 0;
+                while (pos < 16) {
+                    uint32_t rest = kept >> pos;
+                    if (rest == 0) {
+                        pending_space = true;
+                        break;
+                    }
+                    uint32_t skip = __builtin_ctz(rest);
+                    if (skip) pending_space = true;
+                    pos += skip;
+                    uint32_t run = __builtin_ctz(~(kept >> pos));
+
+                    if (pending_space && n > 0) {
+                        close_token(n);
+                        dst[n++] = ' ';
+                    }
+                    pending_space = false;
+                    memcpy(dst + n, lower + pos, run);
+                    if (Tokens) {
+                        uint32_t t = (token >> pos) & ((1u << run) - 1);
+                        for (uint32_t q = 0; q < run;) {
+                            if (!((t >> q) & 1)) {
+                                close_token(n + q);
+                                q = (t >> q) ? q + __builtin_ctz(t >> q) : run;
+                                continue;
+                            }
+                            if (!in_token) {
+                                token_start = n + q;
+                                in_token = true;
+                            }
+                            q += __builtin_ctz(~(t >> q));
+                        }
+                    }
+                    n += run;
+                    pos += run;
+                }
+                i += 16;
+                continue;
+            }
+            scalar_until = i + 16;
+        }
+#endif
+        unsigned char c = byte_at(text, i);
+
+        if (c >= 0x80) {
+            uint32_t cp;
+            size_t used = decode_utf8(text + i, len - i, cp);
+            if (used == 0) {
+                pending_space = true;
+                i++;
+                continue;
+            }
+            i += used;
+
+            char utf8[4];
+            switch (classify_code_point(cp)) {
+            case CodePointClass::LETTER: {
+                size_t m = encode_utf8(fold_case(cp), utf8);
+                for (size_t k = 0; k < m; k++) emit(utf8[k]);
+                break;
+            }
+            case CodePointClass::EMOJI: {
+                // A space before, the emoji, and a pending space after it
+                size_t need = n + 2 + used + (len - i);
+                if (need > out.size()) {
+                    out.resize(need + 16);
+                    dst = &out[0];
+                }
+                pending_space = true;
+                size_t m = encode_utf8(cp, utf8);
+                for (size_t k = 0; k < m; k++) emit(utf8[k]);
+                close_token(n);
+                pending_space = true;
+                break;
+            }
+            case CodePointClass::IGNORABLE:
+                break;
+            case CodePointClass::SEPARATOR:
+                // Typographic forms of the punctuation the cleaner keeps
+                if (cp == 0x2026) {
+                    emit('.');
+                    emit('.');
+                    emit('.');
+                } else if (cp >= 0x2010 && cp <= 0x2015) {
+                    emit('-');
+                } else {
+                    pending_space = true;
+                }
+                break;
+            }
+            continue;
+        }
+
+        if (c == 'h' || c == 'w') {
+            size_t end = skip_url(text, len, i);
+            if (end != i) {
+                i = end;
+                continue;
+            }
+        } else if (c == '@') {
+            // Mentions are matched on the URL-stripped text, so URL removal
+            // has to keep running while we consume the handle.
+            size_t j = skip_url(text, len, i + 1);
+            if (j < len && tables.word[byte_at(text, j)]) {
+                while (j < len && tables.word[byte_at(text, j)]) {
+                    j = skip_url(text, len, j + 1);
+                }
+                i = j;
+                continue;
+            }
+        }
+
+        char k = tables.out[c];
+        if (k) {
+            emit(k);
+        } else {
+            pending_space = true;
+        }
+        i++;
+    }
+
+    close_token(n);
+    out.resize(n);
+    return n;
 }
 
+} // namespace
+
+TextPreprocessor::TextPreprocessor(const Executor& executor) : executor_(executor) {}
+
 vector<string> TextPreprocessor::preprocess_batch(const vector<Tweet>& tweets) {
     if (tweets.empty()) return vector<string>();
-    
+
+    TRACE_SCOPE("clean");
+    TRACE_COUNT(ROWS, tweets.size());
     vector<string> processed_texts(tweets.size());
-    
-    #pragma omp parallel for schedule(dynamic)
-    for (size_t i = 0; i < tweets.size(); i++) {
-        if (!tweets[i].text.empty()) {
-            try {
-                processed_texts[i] = clean_text(tweets[i].text);
-            } catch (const exception& e) {
-                #pragma omp critical
-                {
-                    cerr << "Error processing tweet " << tweets[i].id 
-                         << ": " << e.what() << endl;
-                    processed_texts[i] = tweets[i].text;
+    RowTasks tasks = executor_.plan(Stage::CLEAN, tweets.size(),
+                                    [&](size_t i) { return tweets[i].text.size(); });
+
+    #pragma omp parallel num_threads(tasks.threads)
+    {
+        TRACE_SCOPE("clean_rows");
+
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t t = 0; t < tasks.size(); t++) {
+            for (size_t i = tasks.begin(t); i < tasks.end(t); i++) {
+                if (!tweets[i].text.empty()) {
+                    try {
+                        const string& text = tweets[i].text;
+                        clean_text_into(text.data(), text.size(), processed_texts[i]);
+                    } catch (const exception& e) {
+                        #pragma omp critical
+                        {
+                            cerr << "Error processing tweet " << tweets[i].id
+                                 << ": " << e.what() << endl;
+                            processed_texts[i] = tweets[i].text;
+                        }
+                    }
+                } else {
+                    processed_texts[i] = "";
                 }
             }
-        } else {
-            processed_texts[i] = "";
         }
     }
-    
+
     return processed_texts;
 }
 
 string TextPreprocessor::clean_text(const string& text) {
     if (text.empty()) return "";
-    
-    string cleaned = text;
-    
-    // Remove URLs
-    static const regex url_pattern(R"((https?:\/\/|www\.)[^\s]+)");
-    cleaned = regex_replace(cleaned, url_pattern, "");
-    
-    // Remove mentions (@user)
-    static const regex mention_pattern(R"(@\w+)");
-    cleaned = regex_replace(cleaned, mention_pattern, "");
-    
-    to_lowercase(cleaned);
-    remove_special_chars(cleaned);
-    normalize_whitespace(cleaned);
-    
+
+    string cleaned;
+    clean_text_into(text.data(), text.size(), cleaned);
     return cleaned;
 }
 
-void TextPreprocessor::to_lowercase(string& text) {
-    transform(text.begin(), text.end(), text.begin(), ::tolower);
+size_t TextPreprocessor::clean_text_into(const char* text, size_t len, string& out) const {
+    size_t n = clean_scan<false>(text, len, out, nullptr);
+    if (normalization_.enabled()) n = normalize_text(out, normalization_);
+    return n;
 }
 
-void TextPreprocessor::remove_special_chars(string& text) {
-    static const regex special_chars(R"([^\w\s.,!?-])");
-    text = regex_replace(text, special_chars, " ");
+size_t TextPreprocessor::clean_and_tokenize(const char* text, size_t len, string& out,
+                                            vector<TokenSpan>& spans) const {
+    size_t first = spans.size();
+    size_t n = clean_scan<true>(text, len, out, &spans);
+    if (normalization_.enabled()) normalize_spans(out, spans, first, normalization_);
+    return n;
 }
 
-void TextPreprocessor::normalize_whitespace(string& text) {
-    static const regex multi_spaces(R"(\s+)");
-    text = regex_replace(text, multi_spaces, " ");
-    
-    if (!text.empty()) {
-        size_t first = text.find_first_not_of(" \t\n\r");
-        size_t last = text.find_last_not_of(" \t\n\r");
-        if (first != string::npos && last != string::npos) {
-            text = text.substr(first, last - first + 1);
-        } else {
-            text = "";
-        }
-    }
-}
\ No newline at end of file
+TokenizedBatch TextPreprocessor::preprocess_tokenized(const vector<Tweet>& tweets) {
+    TRACE_SCOPE("clean_tokenize");
+    TRACE_COUNT(ROWS, tweets.size());
+    TokenizedBatch batch;
+    CleanWorkspace workspace;
+    clean_tokenize_rows(tweets.size(), [&](size_t i) { return string_view(tweets[i].text); }, batch,
+                        workspace);
+    return batch;
+}
+
+void TextPreprocessor::preprocess_tokenized(const TweetBatchView& tweets, TokenizedBatch& out) const {
+    CleanWorkspace workspace;
+    preprocess_tokenized(tweets, out, workspace);
+}
+
+void TextPreprocessor::preprocess_tokenized(const TweetBatchView& tweets, TokenizedBatch& out,
+                                            CleanWorkspace& workspace) const {
+    TRACE_SCOPE("clean_tokenize");
+    TRACE_COUNT(ROWS, tweets.size());
+    clean_tokenize_rows(tweets.size(), [&](size_t i) { return tweets.text(i); }, out, workspace);
+}
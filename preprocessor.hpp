@@ -3,26 +3,78 @@
 #include <string>
 #include <vector>
 #include <iostream>
-#include <regex>
+#include "tokenizer.hpp"
+#include "token_normalizer.hpp"
+#include "tweet_batch.hpp"
+#include "executor.hpp"
+#include "parallel_utils.hpp"
 
 using namespace std;
 
-struct Tweet {
-    int id;
-    string text;
-    int sentiment;
+// Working space of TextPreprocessor::clean_tokenize_rows: the task plan,
+// each thread's scratch buffer and its share of the output before the
+// gather. Kept by whoever cleans batch after batch (one per cleaning
+// thread), so the batches themselves stay plain data.
+struct CleanWorkspace {
+    RowTasks tasks;
+    GatherSpace<char, TokenSpan> shares;
+    vector<string> scratch;
 };
 
 class TextPreprocessor {
 public:
-    TextPreprocessor(int num_threads = 4);
+    // Parallel regions run on executor, which must outlive the preprocessor.
+    explicit TextPreprocessor(const Executor& executor = Executor::global());
     vector<string> preprocess_batch(const vector<Tweet>& tweets);
     string clean_text(const string& text);
 
+    // Drop stop words and/or stem tokens after cleaning (off by default).
+    // Tokenized output keeps the cleaned text and only loses or shortens
+    // spans. Plain text output has the same tokens cut from the text itself
+    // (a dropped word takes one space with it), punctuation and emoji
+    // kept, so tokenizing it gives the same tokens as the spans.
+    void set_normalization(const TokenNormalization& normalization) { normalization_ = normalization; }
+    const TokenNormalization& normalization() const { return normalization_; }
+
+    // Same as clean_text but writes into a caller-owned buffer so it can be
+    // reused across tweets. Returns the number of bytes written.
+    size_t clean_text_into(const char* text, size_t len, string& out) const;
+
+    // Fused clean + tokenize: cleans like clean_text_into and, in the same
+    // pass, appends the spans of Tokenizer tokens in the cleaned output.
+    size_t clean_and_tokenize(const char* text, size_t len, string& out,
+                              vector<TokenSpan>& spans) const;
+    TokenizedBatch preprocess_tokenized(const vector<Tweet>& tweets);
+    // Same for a columnar batch, written into out's arrays. With a reused
+    // workspace and a recycled out nothing is allocated once both have
+    // grown to the largest batch (and per-thread share of it) seen.
+    void preprocess_tokenized(const TweetBatchView& tweets, TokenizedBatch& out) const;
+    void preprocess_tokenized(const TweetBatchView& tweets, TokenizedBatch& out,
+                              CleanWorkspace& workspace) const;
+
+    // Fused clean + tokenize of rows whose raw text is text_of(row), into
+    // out. Each thread cleans into one scratch buffer and appends the
+    // result to its share of the arena; shares are gathered in row order.
+    template <typename TextOf>
+    void clean_tokenize_rows(size_t rows, TextOf text_of, TokenizedBatch& out,
+                             CleanWorkspace& workspace,
+                             const char* stage = "clean_tokenize_rows") const {
+        RowTasks& tasks = workspace.tasks;
+        executor_.plan(Stage::CLEAN, rows, [&](size_t i) { return text_of(i).size(); }, tasks);
+        vector<string>& scratch = workspace.scratch;
+        if (scratch.size() < static_cast<size_t>(tasks.threads)) scratch.resize(tasks.threads);
+        gather_rows(workspace.shares, tasks, out.text_offsets, out.arena, out.span_offsets, out.spans,
+                    [&](size_t i, vector<char>& text, vector<TokenSpan>& spans, int tid) {
+                        string_view raw = text_of(i);
+                        string& clean = scratch[tid];
+                        clean_and_tokenize(raw.data(), raw.size(), clean, spans);
+                        text.insert(text.end(), clean.begin(), clean.end());
+                    }, stage);
+    }
+
+    const Executor& executor() const { return executor_; }
+
 private:
-    
-    void to_lowercase(string& text);
-    void remove_special_chars(string& text);
-    void normalize_whitespace(string& text);
-    int num_threads_;
-};
\ No newline at end of file
+    const Executor& executor_;
+    TokenNormalization normalization_;
+};
@@ -0,0 +1,177 @@
+#include "scoring_server.hpp"
+#include "csv_loader.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+// Load generator for parallel_processor --serve --socket. Every connection
+// keeps up to --window requests in flight, replaying tweet texts from a CSV,
+// and the client reports its own end-to-end latency next to the server's.
+//
+// scoring_client --socket PATH --input FILE [--raw] [--connections N]
+//                [--requests N] [--window N]
+
+namespace {
+
+int connect_to(const string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("Socket path too long: " + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        if (fd >= 0) close(fd);
+        throw runtime_error("Cannot connect to " + path + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+// One connection: a sender that stays at most `window` requests ahead of
+// the receiver, which times every answer against its send time.
+void run_connection(const string& path, const vector<string>& texts, size_t offset,
+                    size_t count, size_t window, vector<uint32_t>& latencies_us) {
+    int fd = connect_to(path);
+    vector<steady_clock::time_point> sent_at(count);
+    mutex lock;
+    condition_variable answered;
+    size_t received = 0;
+
+    thread sender([&] {
+        for (size_t i = 0; i < count; i++) {
+            string line = texts[(offset + i) % texts.size()] + "\n";
+            {
+                unique_lock<mutex> guard(lock);
+                answered.wait(guard, [&] { return i - received < window; });
+                sent_at[i] = steady_clock::now();
+            }
+            if (!write_all(fd, line.data(), line.size())) break;
+        }
+    });
+
+    FdLineReader reader(fd);
+    string line;
+    latencies_us.reserve(count);
+    while (received < count && reader.next(line)) {
+        auto now = steady_clock::now();
+        {
+            lock_guard<mutex> guard(lock);
+            latencies_us.push_back(static_cast<uint32_t>(
+                duration_cast<microseconds>(now - sent_at[received]).count()));
+            received++;
+        }
+        answered.notify_one();
+    }
+    sender.join();
+    close(fd);
+}
+
+string server_stats(const string& path) {
+    int fd = connect_to(path);
+    string request = string(SCORING_STATS_COMMAND) + "\n", reply;
+    write_all(fd, request.data(), request.size());
+    FdLineReader reader(fd);
+    reader.next(reply);
+    close(fd);
+    return reply;
+}
+
+double percentile(vector<uint32_t>& samples, double p) {
+    if (samples.empty()) return 0;
+    size_t rank = static_cast<size_t>(p * (samples.size() - 1));
+    nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    vector<string> args(argv + 1, argv + argc);
+    string socket_path, input;
+    TweetSchema schema;
+    size_t connections = 4, requests = 100000, window = 32;
+
+    try {
+        for (size_t i = 0; i < args.size(); i++) {
+            bool has_value = i + 1 < args.size();
+            if (args[i] == "--raw") {
+                schema = TweetSchema::twitter_raw();
+            } else if (args[i] == "--socket" && has_value) {
+                socket_path = args[++i];
+            } else if (args[i] == "--input" && has_value) {
+                input = args[++i];
+            } else if (args[i] == "--connections" && has_value) {
+                connections = max<size_t>(1, stoul(args[++i]));
+            } else if (args[i] == "--requests" && has_value) {
+                requests = stoul(args[++i]);
+            } else if (args[i] == "--window" && has_value) {
+                window = max<size_t>(1, stoul(args[++i]));
+            } else {
+                cerr << "Unknown option: " << args[i] << endl;
+                return 1;
+            }
+        }
+        if (socket_path.empty() || input.empty()) {
+            cerr << "Usage: scoring_client --socket PATH --input FILE [--raw] "
+                 << "[--connections N] [--requests N] [--window N]" << endl;
+            return 1;
+        }
+
+        // The protocol is one tweet per line.
+        vector<string> texts;
+        for (auto& tweet : load_tweets(input, schema)) {
+            replace(tweet.text.begin(), tweet.text.end(), '\n', ' ');
+            replace(tweet.text.begin(), tweet.text.end(), '\r', ' ');
+            if (tweet.text != SCORING_STATS_COMMAND) texts.push_back(move(tweet.text));
+        }
+        if (texts.empty()) {
+            cerr << "No tweets loaded from " << input << endl;
+            return 1;
+        }
+
+        vector<vector<uint32_t>> latencies(connections);
+        vector<thread> workers;
+        auto start = steady_clock::now();
+        for (size_t c = 0; c < connections; c++) {
+            size_t count = requests / connections + (c < requests % connections ? 1 : 0);
+            workers.emplace_back([&, c, count] {
+                try {
+                    run_connection(socket_path, texts, c * (requests / connections), count,
+                                   window, latencies[c]);
+                } catch (const exception& e) {
+                    cerr << "Connection " << c << ": " << e.what() << endl;
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+        double elapsed = duration<double>(steady_clock::now() - start).count();
+
+        vector<uint32_t> all;
+        for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+        cout << fixed << setprecision(0);
+        cout << "Client: " << all.size() << " answers in " << setprecision(3) << elapsed << " s, "
+             << setprecision(0) << all.size() / elapsed << " req/s, p50 "
+             << percentile(all, 0.50) << " us, p99 " << percentile(all, 0.99) << " us" << endl;
+        cout << "Server: " << server_stats(socket_path) << endl;
+    } catch (const exception& e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
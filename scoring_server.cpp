@@ -0,0 +1,333 @@
+#include "scoring_server.hpp"
+#include "instrumentation.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace std::chrono;
+
+namespace {
+
+double percentile(vector<uint32_t> samples, double p) {
+    if (samples.empty()) return 0;
+    size_t rank = static_cast<size_t>(p * (samples.size() - 1));
+    nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
+
+} // namespace
+
+string ScoringStats::summary() const {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "requests=%llu batches=%llu mean_batch=%.1f p50_us=%.0f p99_us=%.0f throughput=%.0f/s",
+             static_cast<unsigned long long>(requests), static_cast<unsigned long long>(batches),
+             mean_batch(), p50_us, p99_us, throughput());
+    if (dedup.lookups == 0) return line;
+    return string(line) + " " + dedup.summary();
+}
+
+bool FdLineReader::next(string& line) {
+    while (true) {
+        size_t end = buffer_.find('\n', pos_);
+        if (end != string::npos) {
+            line.assign(buffer_, pos_, end - pos_);
+            pos_ = end + 1;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            return true;
+        }
+        buffer_.erase(0, pos_);
+        pos_ = 0;
+
+        char chunk[1 << 16];
+        ssize_t got = read(fd_, chunk, sizeof(chunk));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            // A final line without a newline still counts.
+            if (buffer_.empty()) return false;
+            line.swap(buffer_);
+            buffer_.clear();
+            return true;
+        }
+        buffer_.append(chunk, got);
+    }
+}
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// Where answers for one client go: a socket, or the stdio output stream.
+// Queued requests hold a reference, so a socket stays open until the last
+// answer to it has been written.
+struct ScoringServer::Connection {
+    int fd = -1;
+    ostream* out = nullptr;
+
+    ~Connection() {
+        if (fd >= 0) close(fd);
+    }
+
+    void send(const string& data) {
+        if (out) {
+            out->write(data.data(), data.size());
+            out->flush();
+        } else {
+            write_all(fd, data.data(), data.size());
+        }
+    }
+};
+
+ScoringServer::ScoringServer(TextPreprocessor& preprocessor, ParallelEncoder& encoder,
+                             const SentimentModel& model, const ScoringOptions& options)
+    : preprocessor_(preprocessor), encoder_(encoder), model_(model), options_(options) {
+    if (model.vocab_hash() != 0 && model.vocab_hash() != encoder.vocabulary_hash()) {
+        throw runtime_error("Model was trained against a different vocabulary");
+    }
+    if (options_.max_batch == 0) options_.max_batch = 1;
+    if (options_.dedup_bytes > 0) cache_ = make_unique<DedupCache>(options_.dedup_bytes);
+    latencies_us_.reserve(LATENCY_WINDOW);
+}
+
+ScoringServer::~ScoringServer() {
+    finish_batcher();
+}
+
+void ScoringServer::start_batcher() {
+    started_ = steady_clock::now();
+    batcher_ = thread([this] { batch_loop(); });
+}
+
+// Answer everything still queued, then stop the batcher.
+void ScoringServer::finish_batcher() {
+    {
+        lock_guard<mutex> lock(queue_mutex_);
+        draining_ = true;
+    }
+    queue_ready_.notify_all();
+    if (batcher_.joinable()) batcher_.join();
+}
+
+void ScoringServer::submit(Request request) {
+    {
+        lock_guard<mutex> lock(queue_mutex_);
+        if (arrivals_ > 0) {
+            double gap = duration<double, micro>(request.received - last_arrival_).count();
+            gap_ewma_us_ += (gap - gap_ewma_us_) / 8;
+        }
+        arrivals_++;
+        last_arrival_ = request.received;
+        queue_.push_back(move(request));
+    }
+    queue_ready_.notify_one();
+}
+
+void ScoringServer::batch_loop() {
+    vector<Request> batch;
+    while (true) {
+        {
+            unique_lock<mutex> lock(queue_mutex_);
+            queue_ready_.wait(lock, [this] { return !queue_.empty() || draining_; });
+            if (queue_.empty()) return;
+
+            // Wait for more requests only while more are likely to come:
+            // flush at the deadline, once the average gap between arrivals
+            // no longer fits before it, or when arrivals have paused for
+            // twice that gap (e.g. every client is waiting for an answer).
+            auto deadline = queue_.front().received + microseconds(options_.max_delay_us);
+            while (queue_.size() < options_.max_batch && !draining_) {
+                auto now = steady_clock::now();
+                auto gap = microseconds(static_cast<long>(gap_ewma_us_));
+                auto idle_limit = last_arrival_ + 2 * gap;
+                if (now + gap >= deadline || now >= idle_limit) break;
+                queue_ready_.wait_until(lock, min(deadline, idle_limit));
+            }
+
+            size_t take = min(queue_.size(), options_.max_batch);
+            for (size_t i = 0; i < take; i++) {
+                batch.push_back(move(queue_.front()));
+                queue_.pop_front();
+            }
+        }
+        score(batch);
+        // Drop the requests now, so a client that has hung up is closed
+        // instead of waiting for the next batch.
+        batch.clear();
+    }
+}
+
+void ScoringServer::score(vector<Request>& batch) {
+    TRACE_SCOPE("score_batch");
+
+    // Stats queries are answered in line with the predictions around them.
+    tweets_.clear();
+    vector<size_t> scored;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (batch[i].text == SCORING_STATS_COMMAND) continue;
+        tweets_.push_back(static_cast<int>(i), 0, batch[i].text);
+        scored.push_back(i);
+    }
+
+    vector<int> classes;
+    vector<float> confidence;
+    if (!tweets_.empty()) {
+        SparseEncodings encodings;
+        if (cache_) {
+            encodings = encoder_.encode_sparse(cache_->resolve(tweets_, preprocessor_, encoder_).token_cache());
+        } else {
+            preprocessor_.preprocess_tokenized(tweets_, cleaned_, clean_workspace_);
+            encodings = encoder_.encode_sparse(cleaned_);
+        }
+        classes = model_.predict(encodings, &confidence);
+    }
+
+    // One write per connection per batch; answers keep request order.
+    unordered_map<Connection*, string> replies;
+    vector<Connection*> order;
+    size_t next_scored = 0;
+    for (size_t i = 0; i < batch.size(); i++) {
+        Connection* connection = batch[i].connection.get();
+        auto inserted = replies.emplace(connection, string());
+        if (inserted.second) order.push_back(connection);
+        string& reply = inserted.first->second;
+
+        if (next_scored < scored.size() && scored[next_scored] == i) {
+            char line[32];
+            snprintf(line, sizeof(line), "%d\t%.4f\n",
+                     SentimentModel::class_to_sentiment(classes[next_scored]),
+                     confidence[next_scored]);
+            reply += line;
+            next_scored++;
+        } else {
+            reply += stats().summary() + "\n";
+        }
+    }
+    for (Connection* connection : order) {
+        connection->send(replies[connection]);
+    }
+
+    auto now = steady_clock::now();
+    lock_guard<mutex> lock(stats_mutex_);
+    for (size_t i : scored) {
+        auto latency = static_cast<uint32_t>(duration_cast<microseconds>(now - batch[i].received).count());
+        if (latencies_us_.size() < LATENCY_WINDOW) {
+            latencies_us_.push_back(latency);
+        } else {
+            latencies_us_[latency_next_] = latency;
+        }
+        latency_next_ = (latency_next_ + 1) % LATENCY_WINDOW;
+    }
+    requests_ += scored.size();
+    batches_++;
+}
+
+ScoringStats ScoringServer::stats() const {
+    lock_guard<mutex> lock(stats_mutex_);
+    ScoringStats stats;
+    stats.requests = requests_;
+    stats.batches = batches_;
+    stats.elapsed_s = duration<double>(steady_clock::now() - started_).count();
+    stats.p50_us = percentile(latencies_us_, 0.50);
+    stats.p99_us = percentile(latencies_us_, 0.99);
+    if (cache_) stats.dedup = cache_->stats();
+    return stats;
+}
+
+void ScoringServer::serve_stdio(istream& in, ostream& out) {
+    auto connection = make_shared<Connection>();
+    connection->out = &out;
+
+    start_batcher();
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        submit(Request{connection, move(line), steady_clock::now()});
+    }
+    finish_batcher();
+}
+
+void ScoringServer::read_connection(shared_ptr<Connection> connection, int fd) {
+    FdLineReader reader(fd);
+    string line;
+    while (reader.next(line)) {
+        submit(Request{connection, move(line), steady_clock::now()});
+    }
+}
+
+void ScoringServer::serve_socket(const string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("Socket path too long: " + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw runtime_error("Cannot create socket: " + string(strerror(errno)));
+    }
+    unlink(path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, 64) != 0) {
+        string error = strerror(errno);
+        close(listener);
+        throw runtime_error("Cannot listen on " + path + ": " + error);
+    }
+
+    // One reader thread per client. done is set when the client has hung
+    // up, so the accept loop can join the thread and forget the client
+    // instead of keeping both until stop().
+    struct Reader {
+        thread worker;
+        weak_ptr<Connection> client;
+        shared_ptr<atomic<bool>> done;
+    };
+    start_batcher();
+    vector<Reader> readers;
+    while (!stopping_) {
+        readers.erase(remove_if(readers.begin(), readers.end(), [](Reader& reader) {
+                          if (!reader.done->load()) return false;
+                          reader.worker.join();
+                          return true;
+                      }), readers.end());
+
+        // Wake up regularly so stop() is noticed without a client connecting.
+        pollfd pending{listener, POLLIN, 0};
+        if (poll(&pending, 1, 100) <= 0) continue;
+
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) continue;
+        auto connection = make_shared<Connection>();
+        connection->fd = fd;
+        auto done = make_shared<atomic<bool>>(false);
+        thread worker([this, connection, fd, done] {
+            read_connection(connection, fd);
+            done->store(true);
+        });
+        readers.push_back(Reader{move(worker), connection, done});
+    }
+
+    // Stop reading, answer what was already received, then hang up.
+    close(listener);
+    unlink(path.c_str());
+    for (auto& reader : readers) {
+        if (auto connection = reader.client.lock()) shutdown(connection->fd, SHUT_RD);
+    }
+    for (auto& reader : readers) reader.worker.join();
+    finish_batcher();
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "preprocessor.hpp"
+#include "parallel_encoder.hpp"
+#include "inference_engine.hpp"
+#include "dedup_cache.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Line protocol, the same on stdin/stdout and on the Unix socket: every
+// request line is one raw tweet and gets one "<sentiment>\t<confidence>"
+// line back, in request order. The line "!stats" is answered with a
+// one-line summary of the server's counters instead.
+constexpr const char* SCORING_STATS_COMMAND = "!stats";
+
+struct ScoringOptions {
+    size_t max_batch = 64;      // flush as soon as this many requests wait
+    long max_delay_us = 1000;   // ... or when the oldest has waited this long
+    size_t dedup_bytes = 0;     // cache repeated texts up to this size (0: off)
+};
+
+struct ScoringStats {
+    uint64_t requests = 0;
+    uint64_t batches = 0;
+    double elapsed_s = 0;
+    double p50_us = 0;          // receive -> response written
+    double p99_us = 0;
+    DedupStats dedup;           // lookups stay 0 without a cache
+
+    double throughput() const { return elapsed_s > 0 ? requests / elapsed_s : 0; }
+    double mean_batch() const { return batches ? double(requests) / batches : 0; }
+    string summary() const;
+};
+
+// Reads '\n'-terminated lines from a file descriptor through a buffer.
+class FdLineReader {
+public:
+    explicit FdLineReader(int fd) : fd_(fd) {}
+    // False at end of stream or on error. A trailing '\r' is dropped.
+    bool next(string& line);
+
+private:
+    int fd_;
+    string buffer_;
+    size_t pos_ = 0;
+};
+
+// Writes all of data to fd; false if the peer went away.
+bool write_all(int fd, const char* data, size_t size);
+
+// Online scorer: keeps the preprocessor, vocabulary, encoder and model warm
+// and scores requests in micro-batches. Requests from every client go into
+// one queue; a batcher thread takes up to max_batch of them once that many
+// are waiting or the oldest is max_delay_us old, runs them through
+// clean -> encode -> predict as one batch, and writes the answers back.
+// Within that budget the wait adapts to the arrival rate, so a lone
+// request is not held back for the full delay when nothing else is coming.
+class ScoringServer {
+public:
+    ScoringServer(TextPreprocessor& preprocessor, ParallelEncoder& encoder,
+                  const SentimentModel& model, const ScoringOptions& options = ScoringOptions());
+    ~ScoringServer();
+
+    // Serve lines from in until end of input, answering on out.
+    void serve_stdio(istream& in, ostream& out);
+    // Accept clients on a Unix domain socket at path until stop().
+    void serve_socket(const string& path);
+    // Ask serve_socket to return. Only sets a flag, so it may be called
+    // from a signal handler.
+    void stop() { stopping_ = true; }
+
+    ScoringStats stats() const;
+
+private:
+    struct Connection;
+
+    struct Request {
+        shared_ptr<Connection> connection;
+        string text;
+        chrono::steady_clock::time_point received;
+    };
+
+    void submit(Request request);
+    void start_batcher();
+    void finish_batcher();
+    void batch_loop();
+    void score(vector<Request>& batch);
+    void read_connection(shared_ptr<Connection> connection, int fd);
+
+    TextPreprocessor& preprocessor_;
+    ParallelEncoder& encoder_;
+    const SentimentModel& model_;
+    ScoringOptions options_;
+    unique_ptr<DedupCache> cache_;
+    // Reused by every batch; only the batcher thread scores.
+    TweetBatch tweets_;
+    TokenizedBatch cleaned_;
+    CleanWorkspace clean_workspace_;
+
+    mutex queue_mutex_;
+    condition_variable queue_ready_;
+    deque<Request> queue_;
+    bool draining_ = false;
+    // Arrival rate estimate for the adaptive flush.
+    uint64_t arrivals_ = 0;
+    double gap_ewma_us_ = 0;
+    chrono::steady_clock::time_point last_arrival_;
+    thread batcher_;
+    atomic<bool> stopping_{false};
+
+    // Latencies of the most recent requests, for the percentiles.
+    static constexpr size_t LATENCY_WINDOW = 1 << 16;
+    mutable mutex stats_mutex_;
+    vector<uint32_t> latencies_us_;
+    size_t latency_next_ = 0;
+    uint64_t requests_ = 0;
+    uint64_t batches_ = 0;
+    chrono::steady_clock::time_point started_;
+};
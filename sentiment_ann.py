@@ -6,13 +6,126 @@ import struct
 from sklearn.model_selection import train_test_split
 from tqdm import tqdm
 import os
+import sys
+from shm_ring import ShmRingReader
+
+EMB_MAGIC = b'SENTEMB\0'
+EMB_ENDIAN_TAG = 0x01020304
+# Mirrors EmbeddingFileHeader in embedding_io.hpp (128 bytes, little-endian)
+EMB_HEADER = struct.Struct('<8sIIII9Q32x')
+LAYOUT_DENSE_F32, LAYOUT_ONEHOT_BITS, LAYOUT_SPARSE_CSR = 0, 1, 2
+
+MODEL_MAGIC = b'SENTMDL\0'
+# Mirror ModelFileHeader / ModelLayerDesc in inference_engine.hpp
+MODEL_HEADER = struct.Struct('<8sIIII4Q72x')
+MODEL_LAYER = struct.Struct('<IIIIQQ')
+ACT_NONE, ACT_RELU, ACT_SOFTMAX = 0, 1, 2
+LAYER_TRANSPOSED = 1
+
+class EmbeddingRows:
+    """Memory-mapped embedding file. Indexing with an array of row ids returns
+    a dense float32 block; nothing is read until rows are requested."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            head = f.read(EMB_HEADER.size)
+
+        if head[:8] != EMB_MAGIC:
+            # Legacy blob: u64 n, u64 dim, float32[n * dim]
+            n, dim = struct.unpack('<QQ', head[:16])
+            self.layout = LAYOUT_DENSE_F32
+            self.shape = (n, dim)
+            self.vocab_hash = 0
+            self.data = np.memmap(path, dtype=np.float32, mode='r', offset=16, shape=self.shape)
+            return
+
+        (_, version, endian, layout, flags, rows, cols, nnz, self.vocab_hash,
+         data_off, _, offsets_off, counts_off, stride) = EMB_HEADER.unpack(head)
+        if endian != EMB_ENDIAN_TAG:
+            raise ValueError(f'{path}: foreign byte order')
+        if version != 2:
+            raise ValueError(f'{path}: unsupported version {version}')
+
+        self.layout = layout
+        self.shape = (rows, cols)
+        if layout == LAYOUT_DENSE_F32:
+            self.data = np.memmap(path, dtype=np.float32, mode='r', offset=data_off,
+                                  shape=(rows, cols))
+        elif layout == LAYOUT_ONEHOT_BITS:
+            self.data = np.memmap(path, dtype=np.uint8, mode='r', offset=data_off,
+                                  shape=(rows, stride))
+        elif layout == LAYOUT_SPARSE_CSR:
+            self.indices = np.memmap(path, dtype=np.uint32, mode='r', offset=data_off,
+                                     shape=(nnz,)) if nnz else np.zeros(0, np.uint32)
+            self.offsets = np.memmap(path, dtype=np.uint64, mode='r', offset=offsets_off,
+                                     shape=(rows + 1,))
+            self.counts = None
+            if flags & 1 and nnz:
+                self.counts = np.memmap(path, dtype=np.float32, mode='r', offset=counts_off,
+                                        shape=(nnz,))
+        else:
+            raise ValueError(f'{path}: unknown layout {layout}')
+
+    def __len__(self):
+        return self.shape[0]
+
+    def __getitem__(self, rows):
+        if isinstance(rows, slice):
+            rows = np.arange(*rows.indices(self.shape[0]))
+        rows = np.atleast_1d(np.asarray(rows, dtype=np.int64))
+        if self.layout == LAYOUT_DENSE_F32:
+            return np.asarray(self.data[rows], dtype=np.float32)
+        if self.layout == LAYOUT_ONEHOT_BITS:
+            bits = np.unpackbits(self.data[rows], axis=1, bitorder='little')
+            return bits[:, :self.shape[1]].astype(np.float32)
+
+        out = np.zeros((len(rows), self.shape[1]), dtype=np.float32)
+        for i, r in enumerate(rows):
+            lo, hi = int(self.offsets[r]), int(self.offsets[r + 1])
+            out[i, self.indices[lo:hi]] = 1.0 if self.counts is None else self.counts[lo:hi]
+        return out
 
 def load_embeddings_bin(path):
-    with open(path, 'rb') as f:
-        n = struct.unpack('Q', f.read(8))[0]
-        dim = struct.unpack('Q', f.read(8))[0]
-        data = np.fromfile(f, dtype=np.float32)
-        return data.reshape(n, dim)
+    return EmbeddingRows(path)
+
+def write_model_file(path, layers, vocab_hash=0):
+    """Write [(weight[out, in], bias[out], activation)] for the C++
+    SentimentModel. The first layer is stored transposed so the engine can
+    gather one weight row per one-hot column."""
+    def align(offset):
+        return (offset + 63) // 64 * 64
+
+    offset = align(MODEL_HEADER.size + MODEL_LAYER.size * len(layers))
+    descs, blobs = [], []
+    for i, (weight, bias, activation) in enumerate(layers):
+        weight = np.asarray(weight, dtype=np.float32)
+        bias = np.asarray(bias, dtype=np.float32)
+        out_features, in_features = weight.shape
+        stored = np.ascontiguousarray(weight.T if i == 0 else weight)
+        weights_off = offset
+        bias_off = align(weights_off + stored.nbytes)
+        offset = align(bias_off + bias.nbytes)
+        descs.append(MODEL_LAYER.pack(in_features, out_features, activation,
+                                      LAYER_TRANSPOSED if i == 0 else 0,
+                                      weights_off, bias_off))
+        blobs += [(weights_off, stored), (bias_off, bias)]
+
+    input_size = layers[0][0].shape[1]
+    num_classes = layers[-1][0].shape[0]
+    with open(path, 'wb') as f:
+        f.write(MODEL_HEADER.pack(MODEL_MAGIC, 1, EMB_ENDIAN_TAG, len(layers), 0,
+                                  input_size, num_classes, vocab_hash, MODEL_HEADER.size))
+        f.write(b''.join(descs))
+        for blob_off, blob in blobs:
+            f.write(b'\0' * (blob_off - f.tell()))
+            f.write(blob.tobytes())
+
+def export_weights(model, path, vocab_hash=0):
+    """Export a SentimentANN for parallel_processor --classify."""
+    def params(linear):
+        return linear.weight.detach().cpu().numpy(), linear.bias.detach().cpu().numpy()
+    write_model_file(path, [(*params(model.layer1), ACT_RELU),
+                            (*params(model.layer2), ACT_SOFTMAX)], vocab_hash)
 
 def load_labels(path, n_samples):
     labels = []
@@ -64,12 +177,12 @@ def main():
         X = load_embeddings_bin(emb_path)
         y = load_labels('data/raw/train_for_cpp.csv', size)
         
-        # Split into train/validation sets
-        X_train, X_val, y_train, y_val = train_test_split(X, y, test_size=0.2, random_state=42)
+        # Split row ids rather than rows so the embeddings stay memory-mapped
+        train_idx, val_idx, y_train, y_val = train_test_split(
+            np.arange(len(X)), y, test_size=0.2, random_state=42)
         
-        # Convert to PyTorch tensors
-        X_train = torch.FloatTensor(X_train)
-        X_val = torch.FloatTensor(X_val)
+        # Validation rows are materialized once; training rows per batch
+        X_val = torch.from_numpy(X[val_idx])
         y_train = torch.LongTensor(y_train)
         y_val = torch.LongTensor(y_val)
         
@@ -87,13 +200,13 @@ def main():
         for epoch in range(epochs):
             model.train()
             total_loss = 0
-            num_batches = len(X_train) // batch_size
+            num_batches = len(train_idx) // batch_size
             
             for i in range(num_batches):
                 start_idx = i * batch_size
                 end_idx = start_idx + batch_size
                 
-                batch_X = X_train[start_idx:end_idx]
+                batch_X = torch.from_numpy(X[train_idx[start_idx:end_idx]])
                 batch_y = y_train[start_idx:end_idx]
                 
                 optimizer.zero_grad()
@@ -120,6 +233,51 @@ def main():
         
         print(f"Best validation accuracy: {best_val_acc:.4f}")
 
+        # Weights for the native engine, tagged with the encodings' vocabulary
+        model.load_state_dict(torch.load(f'models/sentiment_ann_{size}.pth'))
+        export_weights(model, f'models/sentiment_ann_{size}.weights', X.vocab_hash)
+
+def train_from_ring(name, batch_size=32):
+    """Train one pass over the batches `parallel_processor --ring` publishes
+    while it is still encoding. Each ring batch is scored before it is
+    trained on, which gives a running (progressive) accuracy."""
+    reader = ShmRingReader(name)
+    print(f"Reading ring {name}: {reader.cols} columns")
+    model = SentimentANN(reader.cols)
+    criterion = nn.CrossEntropyLoss()
+    optimizer = optim.Adam(model.parameters(), lr=0.001)
+
+    seen = correct = 0
+    for step, ring_batch in enumerate(reader):
+        if len(ring_batch) == 0:
+            continue
+        y = torch.from_numpy(ring_batch.labels.astype(np.int64))
+        model.eval()
+        with torch.no_grad():
+            preds = torch.argmax(model(torch.from_numpy(ring_batch.dense())), dim=1)
+            correct += int((preds == y).sum())
+            seen += len(ring_batch)
+
+        model.train()
+        for start in range(0, len(ring_batch), batch_size):
+            rows = np.arange(start, min(start + batch_size, len(ring_batch)))
+            optimizer.zero_grad()
+            loss = criterion(model(torch.from_numpy(ring_batch.dense(rows))), y[rows])
+            loss.backward()
+            optimizer.step()
+
+        if (step + 1) % 20 == 0:
+            print(f'Batch {step+1}, {seen} tweets, Loss: {loss.item():.4f}, '
+                  f'Progressive Acc: {correct/seen:.4f}')
+    reader.close()
+
+    print(f"Trained on {seen} tweets, progressive accuracy {correct/max(seen, 1):.4f}")
+    torch.save(model.state_dict(), 'models/sentiment_ann_ring.pth')
+    export_weights(model, 'models/sentiment_ann_ring.weights', reader.vocab_hash)
+
 if __name__ == "__main__":
     os.makedirs('models', exist_ok=True)
-    main()
\ No newline at end of file
+    if len(sys.argv) == 3 and sys.argv[1] == '--ring':
+        train_from_ring(sys.argv[2])
+    else:
+        main()
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "sequential_processor.hpp"
 #include "preprocessor.hpp"
+#include "csv_loader.hpp"
 #include <iostream>
 #include <vector>
 #include <string>
@@ -10,73 +11,7 @@
 using namespace std;
 using namespace std::chrono;
 
-// Implementation of load_tweets
-vector<Tweet> load_tweets(const string& filename) {
-    vector<Tweet> tweets;
-    ifstream file(filename);
-    
-    if (!file.is_open()) {
-        cerr << "Error: Cannot open file " << filename << endl;
-        return tweets;
-    }
-    
-    string line;
-    int line_num = 0;
-    
-    // Skip header
-    getline(file, line);
-    
-    while (getline(file, line)) {
-        line_num++;
-        stringstream ss(line);
-        vector<string> fields;
-        string field;
-        
-        while (getline(ss, field, ',')) {
-            fields.push_back(field);
-        }
-        
-        if (fields.size() >= 3) {
-            Tweet tweet;
-            tweet.id = line_num;
-            
-            string text = fields[1];
-            if (text.length() >= 2 && text.front() == '"' && text.back() == '"') {
-                text = text.substr(1, text.length() - 2);
-            }
-            tweet.text = text;
-            
-            string sentiment_str = fields.back();
-            if (sentiment_str.length() >= 2 && 
-                sentiment_str.front() == '"' && 
-                sentiment_str.back() == '"') {
-                sentiment_str = sentiment_str.substr(1, sentiment_str.length() - 2);
-            }
-            
-            sentiment_str.erase(
-                remove_if(sentiment_str.begin(), sentiment_str.end(), 
-                        [](char c) { return isspace(c); }),
-                sentiment_str.end()
-            );
-            
-            if (sentiment_str == "Positive" || sentiment_str == "2") {
-                tweet.sentiment = 2;
-            } else if (sentiment_str == "Negative" || sentiment_str == "0") {
-                tweet.sentiment = 0;
-            } else if (sentiment_str == "Irrelevant" || sentiment_str == "-1") {
-                tweet.sentiment = -1;
-            } else {
-                tweet.sentiment = 1;  // Default to neutral
-            }
-            tweets.push_back(tweet);
-        }
-    }
-    
-    cout << "Successfully loaded " << tweets.size() << " tweets from " << filename << endl;
-    return tweets;
-}
-
-int main() {
+int main(int argc, char** argv) {
 
     cout<< "RAGHAV SHARMA 2023BCS0050 GAURAV JHALANI 2023BCS0032" << endl;
     try {
@@ -92,6 +27,13 @@ int main() {
         }
         
         SequentialProcessor processor;
+        // --vocab FILE encodes every subset against one saved vocabulary
+        if (argc == 3 && string(argv[1]) == "--vocab") {
+            processor.load_vocabulary(argv[2]);
+        } else if (argc != 1) {
+            cerr << "Usage: sequential_processor [--vocab FILE]" << endl;
+            return 1;
+        }
         
         // Process each batch size
         for (size_t n : sizes) {
@@ -3,7 +3,7 @@
 #include <stdexcept>
 
 SequentialProcessor::SequentialProcessor() 
-    : preprocessor(1), encoder(5000, 1) {} // Single thread
+    : executor(1), preprocessor(executor), encoder(5000, executor) {} // Single thread
 
 vector<string> SequentialProcessor::preprocess_sequential(const vector<Tweet>& tweets) {
     vector<string> processed_texts;
@@ -19,13 +19,20 @@ vector<vector<float>> SequentialProcessor::encode_sequential(const vector<string
     vector<vector<float>> encodings;
     encodings.reserve(texts.size());
      
-    // Build vocabulary first
-    encoder.build_vocabulary(texts);
+    // Build vocabulary first, unless one was loaded
+    if (!fixed_vocabulary) {
+        encoder.build_vocabulary(texts);
+    }
     
     // Sequential encoding
     return encoder.encode_sequential(texts);
 }
 
+void SequentialProcessor::load_vocabulary(const string& filename) {
+    encoder.load_vocabulary(filename);
+    fixed_vocabulary = true;
+}
+
 SequentialProcessor::ProcessResult SequentialProcessor::process_batch(const vector<Tweet>& tweets) {
     ProcessResult result;
 
@@ -18,12 +18,17 @@ public:
     };
     
     ProcessResult process_batch(const vector<Tweet>& tweets);
+    // Encode every later batch against a saved vocabulary instead of
+    // building one per batch.
+    void load_vocabulary(const string& filename);
     void save_encodings(const string& filename, const vector<vector<float>>& encodings);
 
 private:
     vector<string> preprocess_sequential(const vector<Tweet>& tweets);
     vector<vector<float>> encode_sequential(const vector<string>& texts);
     
+    Executor executor;
     TextPreprocessor preprocessor;
     ParallelEncoder encoder;
+    bool fixed_vocabulary = false;
 };
\ No newline at end of file
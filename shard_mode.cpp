@@ -0,0 +1,294 @@
+#include "shard_mode.hpp"
+#include "csv_loader.hpp"
+#include "embedding_io.hpp"
+#include "instrumentation.hpp"
+#include "token_counter.hpp"
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace {
+
+struct stat input_stat(const string& filename) {
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) {
+        throw runtime_error("Cannot open input: " + filename);
+    }
+    return info;
+}
+
+size_t input_size(const string& filename) {
+    return static_cast<size_t>(input_stat(filename).st_size);
+}
+
+// The saved plan, if it was made for the input as it is now (same size and
+// modification time) and the same shard count.
+bool load_shard_ranges(const string& input, const string& workdir, size_t shards,
+                       vector<pair<size_t, size_t>>& ranges) {
+    ifstream in(shard_ranges_path(workdir));
+    struct stat info = input_stat(input);
+    unsigned long long size = 0, mtime = 0;
+    size_t planned = 0;
+    if (!(in >> size >> mtime >> planned) || size != static_cast<unsigned long long>(info.st_size) ||
+        mtime != static_cast<unsigned long long>(info.st_mtime) || planned != shards) {
+        return false;
+    }
+    ranges.assign(shards, {0, 0});
+    for (auto& range : ranges) {
+        if (!(in >> range.first >> range.second) || range.first > range.second ||
+            range.second > size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+string json_string(const string& text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+            continue;
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+const char* layout_name(EmbeddingLayout layout) {
+    switch (layout) {
+    case EmbeddingLayout::DENSE_F32: return "dense_f32";
+    case EmbeddingLayout::ONEHOT_BITS: return "onehot_bits";
+    case EmbeddingLayout::SPARSE_CSR: return "sparse_csr";
+    }
+    return "unknown";
+}
+
+} // namespace
+
+pair<size_t, size_t> shard_byte_range(size_t file_size, size_t shard, size_t shards) {
+    if (shards == 0 || shard >= shards) {
+        throw invalid_argument("Shard " + to_string(shard) + " out of " + to_string(shards));
+    }
+    auto boundary = [&](size_t i) {
+        return static_cast<size_t>(static_cast<unsigned __int128>(file_size) * i / shards);
+    };
+    return {boundary(shard), boundary(shard + 1)};
+}
+
+vector<pair<size_t, size_t>> shard_record_ranges(const string& input, size_t shards) {
+    size_t size = input_size(input);
+    vector<size_t> offsets;
+    for (size_t shard = 0; shard < shards; shard++) {
+        offsets.push_back(shard_byte_range(size, shard, shards).first);
+    }
+    offsets.push_back(size);
+    vector<size_t> starts = CsvReader::record_starts(input, offsets);
+
+    vector<pair<size_t, size_t>> ranges;
+    for (size_t shard = 0; shard < shards; shard++) {
+        ranges.emplace_back(starts[shard], starts[shard + 1]);
+    }
+    return ranges;
+}
+
+void write_shard_ranges(const string& input, const string& workdir, size_t shards) {
+    TRACE_SCOPE("write_shard_ranges");
+    struct stat info = input_stat(input);
+    auto ranges = shard_record_ranges(input, shards);
+
+    string path = shard_ranges_path(workdir);
+    ofstream out(path);
+    if (!out) throw runtime_error("Cannot open file for writing: " + path);
+    out << info.st_size << " " << static_cast<unsigned long long>(info.st_mtime) << " " << shards
+        << "\n";
+    for (const auto& range : ranges) out << range.first << " " << range.second << "\n";
+    if (!out) throw runtime_error("Failed writing shard ranges: " + path);
+}
+
+pair<size_t, size_t> shard_record_range(const string& input, const string& workdir, size_t shard,
+                                        size_t shards) {
+    vector<pair<size_t, size_t>> ranges;
+    if (load_shard_ranges(input, workdir, shards, ranges)) {
+        if (shard >= shards) {
+            throw invalid_argument("Shard " + to_string(shard) + " out of " + to_string(shards));
+        }
+        return ranges[shard];
+    }
+    auto range = shard_byte_range(input_size(input), shard, shards);
+    vector<size_t> starts = CsvReader::record_starts(input, {range.first, range.second});
+    return {starts[0], starts[1]};
+}
+
+string shard_ranges_path(const string& workdir) {
+    return workdir + "/ranges.txt";
+}
+
+string shard_counts_path(const string& workdir, size_t shard) {
+    return workdir + "/counts-" + to_string(shard) + ".voc";
+}
+
+string shard_output_path(const string& workdir, size_t shard) {
+    return workdir + "/shard-" + to_string(shard) + ".bin";
+}
+
+string shard_vocabulary_path(const string& workdir) {
+    return workdir + "/vocab.voc";
+}
+
+string shard_manifest_path(const string& workdir) {
+    return workdir + "/manifest.json";
+}
+
+size_t count_shard(const string& input, const string& workdir, size_t shard, size_t shards,
+                   const TweetSchema& schema, TextPreprocessor& preprocessor, size_t batch_size) {
+    TRACE_SCOPE("count_shard");
+    auto range = shard_record_range(input, workdir, shard, shards);
+    CsvReader reader(input, schema.has_header, 0, range.second);
+    reader.seek(range.first);
+    TweetProjector projector(schema, reader.header());
+
+    const Executor& executor = preprocessor.executor();
+    ShardedTokenCounter counter(executor.threads_for(Stage::COUNT));
+    vector<string_view> records;
+    TweetBatch tweets;
+    TokenizedBatch cleaned;
+    CleanWorkspace workspace;
+    int record_number = 0;
+    size_t counted = 0;
+
+    while (true) {
+        records.clear();
+        if (reader.next_records(batch_size, records) == 0) break;
+        tweets.clear();
+        for (auto record : records) projector.project(record, ++record_number, tweets);
+
+        // Tokens only live for this batch, so the counter copies new ones.
+        preprocessor.preprocess_tokenized(tweets, cleaned, workspace);
+        count_tokens(cleaned, counter, executor);
+        counted += tweets.size();
+        reader.release_consumed();
+    }
+
+    counter.merge();
+    vector<string> words;
+    vector<uint64_t> counts;
+    for (auto& entry : counter.top_k(counter.distinct())) {
+        words.push_back(move(entry.first));
+        counts.push_back(entry.second);
+    }
+    FrozenVocabulary(words, counts).save(shard_counts_path(workdir, shard));
+    return counted;
+}
+
+FrozenVocabulary merge_shard_counts(const string& workdir, size_t shards, size_t vocab_size,
+                                    const Executor& executor) {
+    TRACE_SCOPE("merge_shard_counts");
+    vector<FrozenVocabulary> parts;
+    for (size_t shard = 0; shard < shards; shard++) {
+        parts.push_back(FrozenVocabulary::load(shard_counts_path(workdir, shard)));
+    }
+
+    // Words are views into the mapped counts files, which outlive the counter.
+    int threads = executor.threads_for(Stage::COUNT);
+    ShardedTokenCounter counter(threads);
+    #pragma omp parallel num_threads(threads)
+    {
+        int tid = omp_get_thread_num();
+        for (const auto& part : parts) {
+            #pragma omp for schedule(static) nowait
+            for (size_t id = 0; id < part.size(); id++) {
+                counter.add(tid, part.word(id), part.count(id));
+            }
+        }
+    }
+    counter.merge();
+
+    vector<string> words;
+    vector<uint64_t> counts;
+    for (auto& entry : counter.top_k(vocab_size)) {
+        words.push_back(move(entry.first));
+        counts.push_back(entry.second);
+    }
+    FrozenVocabulary vocabulary(words, counts);
+    vocabulary.save(shard_vocabulary_path(workdir));
+    return vocabulary;
+}
+
+StreamingStats encode_shard(const string& input, const string& workdir, size_t shard,
+                            size_t shards, TextPreprocessor& preprocessor,
+                            ParallelEncoder& encoder, StreamingOptions options) {
+    auto range = shard_record_range(input, workdir, shard, shards);
+    options.byte_begin = range.first;
+    options.byte_end = range.second;
+    options.begin_at_record = true;
+    return run_streaming_pipeline(input, shard_output_path(workdir, shard), preprocessor, encoder,
+                                  options);
+}
+
+void write_shard_manifest(const string& input, const string& workdir, size_t shards) {
+    size_t size = input_size(input);
+    vector<EmbeddingReader> files;
+    for (size_t shard = 0; shard < shards; shard++) {
+        files.emplace_back(shard_output_path(workdir, shard));
+        const EmbeddingReader& file = files.back();
+        const EmbeddingReader& first = files.front();
+        if (file.is_legacy() || file.cols() != first.cols() || file.layout() != first.layout() ||
+            file.vocab_hash() != first.vocab_hash()) {
+            throw runtime_error("Shard " + to_string(shard) + " does not match shard 0: " +
+                                shard_output_path(workdir, shard));
+        }
+    }
+
+    // The vocabulary is only listed if the shards were encoded against it;
+    // hashed shards have none.
+    string vocabulary_path = shard_vocabulary_path(workdir);
+    bool has_vocabulary = false;
+    if (!files.empty() && ifstream(vocabulary_path).good()) {
+        has_vocabulary = FrozenVocabulary::load(vocabulary_path).content_hash() == files[0].vocab_hash();
+    }
+
+    vector<pair<size_t, size_t>> ranges;
+    if (!load_shard_ranges(input, workdir, shards, ranges)) ranges = shard_record_ranges(input, shards);
+
+    string path = shard_manifest_path(workdir);
+    ofstream out(path);
+    if (!out) throw runtime_error("Cannot open file for writing: " + path);
+
+    uint64_t rows = 0, nnz = 0;
+    for (const auto& file : files) {
+        rows += file.rows();
+        nnz += file.nnz();
+    }
+    char hash[24];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(files.empty() ? 0 : files[0].vocab_hash()));
+
+    out << "{\n";
+    out << "  \"input\": " << json_string(input) << ",\n";
+    out << "  \"input_bytes\": " << size << ",\n";
+    out << "  \"shards\": " << shards << ",\n";
+    out << "  \"layout\": \"" << (files.empty() ? "none" : layout_name(files[0].layout())) << "\",\n";
+    out << "  \"cols\": " << (files.empty() ? 0 : files[0].cols()) << ",\n";
+    out << "  \"vocab_hash\": \"" << hash << "\",\n";
+    out << "  \"vocabulary\": " << (has_vocabulary ? json_string("vocab.voc") : "null") << ",\n";
+    out << "  \"rows\": " << rows << ",\n";
+    out << "  \"nnz\": " << nnz << ",\n";
+    out << "  \"files\": [\n";
+    for (size_t shard = 0; shard < shards; shard++) {
+        const auto& range = ranges[shard];
+        out << "    {\"shard\": " << shard
+            << ", \"path\": " << json_string("shard-" + to_string(shard) + ".bin")
+            << ", \"byte_begin\": " << range.first
+            << ", \"byte_end\": " << range.second
+            << ", \"rows\": " << files[shard].rows()
+            << ", \"nnz\": " << files[shard].nnz() << "}"
+            << (shard + 1 < shards ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    if (!out) throw runtime_error("Failed writing manifest: " + path);
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "preprocessor.hpp"
+#include "parallel_encoder.hpp"
+#include "streaming_pipeline.hpp"
+#include "frozen_vocabulary.hpp"
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Multi-process sharding. Worker i of N takes the records that start in
+// the i-th of N equal byte slices of the input CSV and works in two phases
+// around one reduce step, exchanging nothing but files in a shared work
+// directory, so the workers can be local processes or run on other nodes:
+//
+//   plan    (once)       record-aligned byte range of every shard -> ranges.txt
+//   count   (per shard)  every distinct token with its frequency -> counts-<i>.voc
+//   merge   (once)       sum of all counts, top vocab_size words -> vocab.voc
+//   encode  (per shard)  the shard against vocab.voc             -> shard-<i>.bin
+//   manifest (once)      byte ranges, rows and nnz of every shard -> manifest.json
+//
+// The plan is optional: a worker without one finds its own range by
+// reading the input up to it.
+//
+// With feature hashing there is no vocabulary, so count and merge are
+// skipped and shards only have to agree on the hashing settings.
+
+// Byte range [begin, end) of shard `shard` out of `shards`. CsvReader turns
+// it into whole records.
+pair<size_t, size_t> shard_byte_range(size_t file_size, size_t shard, size_t shards);
+
+// The byte ranges of all shards moved to record starts, found in one pass
+// over the input. Shard i reads exactly the records in the i-th range.
+vector<pair<size_t, size_t>> shard_record_ranges(const string& input, size_t shards);
+
+// Plan step: save shard_record_ranges to shard_ranges_path, so that no
+// worker has to read the input ahead of its own range.
+void write_shard_ranges(const string& input, const string& workdir, size_t shards);
+
+// Record range of one shard, from the saved plan if it was made for this
+// input and shard count, else found by reading the input up to its end.
+pair<size_t, size_t> shard_record_range(const string& input, const string& workdir, size_t shard,
+                                        size_t shards);
+
+string shard_ranges_path(const string& workdir);
+string shard_counts_path(const string& workdir, size_t shard);
+string shard_output_path(const string& workdir, size_t shard);
+string shard_vocabulary_path(const string& workdir);
+string shard_manifest_path(const string& workdir);
+
+// Count phase: clean and tokenize the shard batch by batch and save the
+// frequency of every distinct token, as a vocabulary file holding all of
+// them. Returns the number of tweets counted.
+size_t count_shard(const string& input, const string& workdir, size_t shard, size_t shards,
+                   const TweetSchema& schema, TextPreprocessor& preprocessor,
+                   size_t batch_size = 4096);
+
+// Reduce step: add up the counts of all shards and keep the vocab_size
+// words ranked like ParallelEncoder::build_vocabulary (count desc, word
+// asc), so the result equals a single-process build over the whole input.
+// Saves it to shard_vocabulary_path. Throws if a counts file is missing.
+FrozenVocabulary merge_shard_counts(const string& workdir, size_t shards, size_t vocab_size,
+                                    const Executor& executor = Executor::global());
+
+// Encode phase: stream the shard through load -> clean -> encode -> write
+// into shard_output_path. The encoder must hold the merged vocabulary or
+// the job's hashing settings.
+StreamingStats encode_shard(const string& input, const string& workdir, size_t shard,
+                            size_t shards, TextPreprocessor& preprocessor,
+                            ParallelEncoder& encoder, StreamingOptions options = StreamingOptions());
+
+// Describe the finished shard files in manifest.json, in shard order, so a
+// reader can treat them as one matrix. Throws if a shard file is missing or
+// the shards disagree on columns, layout or vocabulary.
+void write_shard_manifest(const string& input, const string& workdir, size_t shards);
@@ -0,0 +1,157 @@
+#include "shm_ring.hpp"
+#include "instrumentation.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+size_t align8(size_t bytes) { return (bytes + 7) & ~size_t(7); }
+
+size_t batch_bytes(size_t rows, size_t nnz, bool counts) {
+    size_t bytes = sizeof(RingRecord);
+    bytes += align8(rows * sizeof(int32_t)) * 2;
+    bytes += (rows + 1) * sizeof(uint64_t);
+    bytes += align8(nnz * sizeof(uint32_t));
+    if (counts) bytes += align8(nnz * sizeof(float));
+    return bytes;
+}
+
+bool process_alive(uint32_t pid) {
+    return kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+}
+
+} // namespace
+
+ShmRingWriter::ShmRingWriter(const string& name, size_t capacity, size_t cols, uint64_t vocab_hash,
+                             double attach_timeout)
+    : name_("/" + name), capacity_(align8(capacity)),
+      attach_deadline_(chrono::steady_clock::now() +
+                       chrono::duration_cast<chrono::steady_clock::duration>(
+                           chrono::duration<double>(attach_timeout))),
+      attach_timeout_(attach_timeout) {
+    if (capacity_ < 2 * sizeof(RingRecord)) {
+        throw invalid_argument("Ring capacity too small: " + to_string(capacity));
+    }
+    mapped_bytes_ = sizeof(RingHeader) + capacity_;
+
+    shm_unlink(name_.c_str());
+    int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        throw runtime_error("Cannot create shared memory " + name_ + ": " + strerror(errno));
+    }
+    void* p = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(mapped_bytes_)) == 0) {
+        p = mmap(nullptr, mapped_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int error = errno;
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(name_.c_str());
+        throw runtime_error("Cannot map shared memory " + name_ + ": " + strerror(error));
+    }
+
+    // A fresh segment reads as zeros, which is a valid empty ring; the magic
+    // goes in last so a reader never sees a half-written header.
+    header_ = static_cast<RingHeader*>(p);
+    data_ = static_cast<char*>(p) + sizeof(RingHeader);
+    header_->version = RING_FORMAT_VERSION;
+    header_->endian_tag = RING_ENDIAN_TAG;
+    header_->capacity = capacity_;
+    header_->cols = cols;
+    header_->vocab_hash = vocab_hash;
+    header_->producer_pid = static_cast<uint32_t>(getpid());
+    atomic_thread_fence(memory_order_release);
+    memcpy(header_->magic, RING_MAGIC, sizeof(RING_MAGIC));
+}
+
+ShmRingWriter::~ShmRingWriter() {
+    if (!header_) return;
+    if (!finished_) header_->state.store(static_cast<uint32_t>(RingState::ABORTED));
+    munmap(header_, mapped_bytes_);
+    shm_unlink(name_.c_str());
+}
+
+// Block until the ring holds everything up to position end. Polls with a
+// growing sleep: the reader is a Python process, so there is no shared
+// futex or semaphore to wait on.
+void ShmRingWriter::wait_for_space(uint64_t end) {
+    if (end - header_->tail.load(memory_order_acquire) <= capacity_) return;
+    TRACE_WAIT("ring_full_wait");
+    auto pause = chrono::microseconds(20);
+    while (end - header_->tail.load(memory_order_acquire) > capacity_) {
+        uint32_t reader = header_->reader_pid.load(memory_order_relaxed);
+        if (reader != 0 && !process_alive(reader)) {
+            throw runtime_error("Reader of " + name_ + " has exited");
+        }
+        if (reader == 0 && chrono::steady_clock::now() > attach_deadline_) {
+            char seconds[32];
+            snprintf(seconds, sizeof(seconds), "%g", attach_timeout_);
+            throw runtime_error("No reader attached to " + name_ + " within " + seconds + " s");
+        }
+        this_thread::sleep_for(pause);
+        pause = min(pause * 2, chrono::microseconds(2000));
+    }
+}
+
+void ShmRingWriter::append(const SparseEncodings& batch, const vector<int>& labels,
+                           const vector<int>& ids) {
+    TRACE_SCOPE("ring_append");
+    size_t rows = batch.rows(), nnz = batch.nnz();
+    if (labels.size() != rows || ids.size() != rows) {
+        throw invalid_argument("Ring batch has " + to_string(rows) + " rows but " +
+                               to_string(labels.size()) + " labels");
+    }
+    bool counts = batch.has_counts();
+    size_t bytes = batch_bytes(rows, nnz, counts);
+    if (bytes > capacity_) {
+        throw runtime_error("Batch of " + to_string(bytes) + " bytes does not fit ring " + name_ +
+                            " of " + to_string(capacity_) + " bytes");
+    }
+
+    // Records never wrap: skip to the start of the ring if this one would.
+    uint64_t start = head_;
+    size_t room = capacity_ - start % capacity_;
+    if (room < bytes) {
+        wait_for_space(start + room);
+        if (room >= sizeof(RingRecord)) {
+            RingRecord pad{RING_RECORD_PAD, 0, 0, 0, room};
+            memcpy(at(start), &pad, sizeof(pad));
+        }
+        start += room;
+    }
+    wait_for_space(start + bytes);
+
+    char* out = at(start);
+    RingRecord record{RING_RECORD_BATCH, counts ? RING_FLAG_COUNTS : 0, rows, nnz, bytes};
+    memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+    static_assert(sizeof(int) == sizeof(int32_t), "labels and ids are stored as int32");
+    if (rows) memcpy(out, labels.data(), rows * sizeof(int32_t));
+    out += align8(rows * sizeof(int32_t));
+    if (rows) memcpy(out, ids.data(), rows * sizeof(int32_t));
+    out += align8(rows * sizeof(int32_t));
+    memcpy(out, batch.row_offsets.data(), (rows + 1) * sizeof(uint64_t));
+    out += (rows + 1) * sizeof(uint64_t);
+    if (nnz) memcpy(out, batch.indices.data(), nnz * sizeof(uint32_t));
+    out += align8(nnz * sizeof(uint32_t));
+    if (counts && nnz) memcpy(out, batch.counts.data(), nnz * sizeof(float));
+
+    head_ = start + bytes;
+    header_->head.store(head_, memory_order_release);
+    rows_ += rows;
+}
+
+void ShmRingWriter::finish() {
+    if (finished_) return;
+    header_->state.store(static_cast<uint32_t>(RingState::FINISHED), memory_order_release);
+    finished_ = true;
+    wait_for_space(head_ + capacity_);
+}
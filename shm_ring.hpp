@@ -0,0 +1,100 @@
+#pragma once
+#include "parallel_encoder.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Single-producer, single-reader ring of encoded batches in POSIX shared
+// memory, so a trainer on the same host (shm_ring.py) consumes batches
+// while the pipeline is still encoding, without going through a file.
+//
+// The segment is a 192-byte header followed by `capacity` bytes of ring.
+// head and tail are byte positions that only grow; a record starts at
+// head % capacity, 8-byte aligned, and never wraps: when the rest of the
+// ring is too short for it, the producer fills the rest with a pad record
+// (or, if not even a record header fits, leaves it and the reader skips
+// it the same way). The producer publishes a record by advancing head
+// after writing it; the reader frees it by advancing tail after copying.
+struct RingHeader {
+    char magic[8];                  // "SENTRING"
+    uint32_t version;               // RING_FORMAT_VERSION
+    uint32_t endian_tag;            // RING_ENDIAN_TAG as written by the producer
+    uint64_t capacity;              // ring bytes after the header
+    uint64_t cols;
+    uint64_t vocab_hash;            // ParallelEncoder::vocabulary_hash()
+    uint32_t producer_pid;
+    uint8_t reserved0[20];
+    // Written by the producer
+    atomic<uint64_t> head;
+    atomic<uint32_t> state;         // RingState
+    uint8_t reserved1[52];
+    // Written by the reader
+    atomic<uint64_t> tail;
+    atomic<uint32_t> reader_pid;    // 0 until a reader attaches
+    uint8_t reserved2[52];
+};
+static_assert(sizeof(RingHeader) == 192, "ring header must stay 192 bytes");
+
+enum class RingState : uint32_t { OPEN = 0, FINISHED = 1, ABORTED = 2 };
+
+// Followed, for RING_RECORD_BATCH, by int32 labels[rows] (model classes,
+// 0-3), int32 ids[rows], uint64 row_offsets[rows + 1], uint32
+// indices[nnz] and, with RING_FLAG_COUNTS, float32 counts[nnz]; each
+// array starts 8-byte aligned. Offsets count from the batch's first index.
+struct RingRecord {
+    uint32_t kind;                  // RING_RECORD_*
+    uint32_t flags;                 // RING_FLAG_*
+    uint64_t rows;
+    uint64_t nnz;
+    uint64_t bytes;                 // whole record, header included
+};
+static_assert(sizeof(RingRecord) == 32, "ring record header must stay 32 bytes");
+
+constexpr char RING_MAGIC[8] = {'S', 'E', 'N', 'T', 'R', 'I', 'N', 'G'};
+constexpr uint32_t RING_FORMAT_VERSION = 1;
+constexpr uint32_t RING_ENDIAN_TAG = 0x01020304;
+constexpr uint32_t RING_RECORD_BATCH = 1;
+constexpr uint32_t RING_RECORD_PAD = 2;
+constexpr uint32_t RING_FLAG_COUNTS = 1u << 0;
+
+// Producer side. Creates the segment "/<name>" (replacing a stale one),
+// which finish() or the destructor unlinks again; a reader that has
+// attached keeps its mapping. append() waits while the ring is full and
+// throws runtime_error if the reader has exited, no reader has attached
+// within attach_timeout seconds of creation (the same default as
+// shm_ring.py's wait for the ring), or a batch can never fit.
+class ShmRingWriter {
+public:
+    ShmRingWriter(const string& name, size_t capacity, size_t cols, uint64_t vocab_hash,
+                  double attach_timeout = 30.0);
+    ~ShmRingWriter();
+
+    ShmRingWriter(const ShmRingWriter&) = delete;
+    ShmRingWriter& operator=(const ShmRingWriter&) = delete;
+
+    void append(const SparseEncodings& batch, const vector<int>& labels, const vector<int>& ids);
+    // Mark the end of the stream and wait until the reader has drained it.
+    void finish();
+
+    const string& name() const { return name_; }
+    uint64_t rows() const { return rows_; }
+
+private:
+    void wait_for_space(uint64_t end);
+    char* at(uint64_t position) { return data_ + position % capacity_; }
+
+    string name_;
+    RingHeader* header_ = nullptr;
+    char* data_ = nullptr;
+    size_t capacity_;
+    size_t mapped_bytes_;
+    chrono::steady_clock::time_point attach_deadline_;
+    double attach_timeout_;
+    uint64_t head_ = 0;
+    uint64_t rows_ = 0;
+    bool finished_ = false;
+};
@@ -0,0 +1,144 @@
+import os
+import struct
+import time
+from multiprocessing import resource_tracker, shared_memory
+
+import numpy as np
+
+RING_MAGIC = b'SENTRING'
+RING_ENDIAN_TAG = 0x01020304
+# Mirrors RingHeader / RingRecord in shm_ring.hpp (little-endian)
+RING_INFO = struct.Struct('<8sIIQQQI')
+RING_HEADER_SIZE = 192
+HEAD_OFF, STATE_OFF, TAIL_OFF, READER_PID_OFF = 64, 72, 128, 136
+RING_RECORD = struct.Struct('<IIQQQ')
+RECORD_BATCH, RECORD_PAD = 1, 2
+FLAG_COUNTS = 1
+STATE_OPEN, STATE_FINISHED, STATE_ABORTED = 0, 1, 2
+
+
+def _align8(n):
+    return (n + 7) // 8 * 8
+
+
+def _alive(pid):
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    except PermissionError:
+        pass
+    return True
+
+
+class RingBatch:
+    """One encoded batch: CSR rows over `cols` columns, model classes (0-3)
+    and tweet ids. Arrays are copies, so they outlive the ring slot."""
+
+    def __init__(self, cols, labels, ids, offsets, indices, counts):
+        self.cols = cols
+        self.labels = labels
+        self.ids = ids
+        self.offsets = offsets
+        self.indices = indices
+        self.counts = counts
+
+    def __len__(self):
+        return len(self.labels)
+
+    def dense(self, rows=None):
+        """float32 rows x cols block, of all rows or the given row ids."""
+        rows = np.arange(len(self)) if rows is None else np.asarray(rows)
+        out = np.zeros((len(rows), self.cols), dtype=np.float32)
+        for i, r in enumerate(rows):
+            lo, hi = int(self.offsets[r]), int(self.offsets[r + 1])
+            out[i, self.indices[lo:hi]] = 1.0 if self.counts is None else self.counts[lo:hi]
+        return out
+
+
+class ShmRingReader:
+    """Reader for `parallel_processor --ring`: attaches to the shared-memory
+    ring `name` and yields RingBatch objects while the producer is still
+    encoding. Waits up to `timeout` seconds for the producer to create the
+    ring, then polls for new batches until the producer finishes."""
+
+    def __init__(self, name, timeout=30.0, poll=0.0005):
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                self._shm = shared_memory.SharedMemory(name=name)
+                if bytes(self._shm.buf[:8]) == RING_MAGIC:
+                    break
+                self._shm.close()
+            except FileNotFoundError:
+                pass
+            if time.monotonic() > deadline:
+                raise TimeoutError(f'no ring named {name}')
+            time.sleep(0.05)
+        # The producer owns (and unlinks) the segment; before Python 3.13 the
+        # tracker would unlink it again at exit.
+        try:
+            resource_tracker.unregister(self._shm._name, 'shared_memory')
+        except Exception:
+            pass
+
+        buf = self._shm.buf
+        (_, version, endian, self.capacity, self.cols, self.vocab_hash,
+         self.producer_pid) = RING_INFO.unpack_from(buf, 0)
+        if endian != RING_ENDIAN_TAG:
+            raise ValueError(f'{name}: foreign byte order')
+        if version != 1:
+            raise ValueError(f'{name}: unsupported version {version}')
+        self._buf = buf
+        self._poll = poll
+        struct.pack_into('<I', buf, READER_PID_OFF, os.getpid())
+
+    def _u64(self, off):
+        return struct.unpack_from('<Q', self._buf, off)[0]
+
+    def _array(self, off, dtype, count):
+        return np.frombuffer(self._buf, dtype=dtype, count=count, offset=off).copy()
+
+    def __iter__(self):
+        tail = self._u64(TAIL_OFF)
+        while True:
+            head = self._u64(HEAD_OFF)
+            if tail == head:
+                state = struct.unpack_from('<I', self._buf, STATE_OFF)[0]
+                if state == STATE_ABORTED:
+                    raise RuntimeError('producer aborted')
+                # Re-read head: the last batch lands before the state flips.
+                if state == STATE_FINISHED and self._u64(HEAD_OFF) == tail:
+                    return
+                if state == STATE_OPEN and not _alive(self.producer_pid):
+                    raise RuntimeError('producer exited')
+                time.sleep(self._poll)
+                continue
+
+            off = tail % self.capacity
+            room = self.capacity - off
+            if room < RING_RECORD.size:
+                tail += room
+                continue
+            base = RING_HEADER_SIZE + off
+            kind, flags, rows, nnz, size = RING_RECORD.unpack_from(self._buf, base)
+            if kind == RECORD_BATCH:
+                p = base + RING_RECORD.size
+                labels = self._array(p, np.int32, rows)
+                p += _align8(rows * 4)
+                ids = self._array(p, np.int32, rows)
+                p += _align8(rows * 4)
+                offsets = self._array(p, np.uint64, rows + 1)
+                p += (rows + 1) * 8
+                indices = self._array(p, np.uint32, nnz)
+                p += _align8(nnz * 4)
+                counts = self._array(p, np.float32, nnz) if flags & FLAG_COUNTS else None
+                batch = RingBatch(self.cols, labels, ids, offsets, indices, counts)
+            tail += size
+            struct.pack_into('<Q', self._buf, TAIL_OFF, tail)
+            if kind == RECORD_BATCH:
+                yield batch
+
+    def close(self):
+        self._buf = None
+        self._shm.close()
@@ -0,0 +1,278 @@
+#include "streaming_pipeline.hpp"
+#include "bounded_queue.hpp"
+#include "instrumentation.hpp"
+#include "shm_ring.hpp"
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <sys/resource.h>
+#include <thread>
+
+using namespace std::chrono;
+
+namespace {
+
+// Project the next batch of records into tweets, which is cleared first;
+// returns false at end of file.
+bool read_batch(CsvReader& reader, const TweetProjector& projector, size_t batch_size,
+                int& record_number, vector<string_view>& records, TweetBatch& tweets) {
+    TRACE_SCOPE("read_batch");
+    records.clear();
+    if (reader.next_records(batch_size, records) == 0) return false;
+
+    tweets.clear();
+    for (auto record : records) {
+        TRACE_COUNT(BYTES_IN, record.size());
+        projector.project(record, ++record_number, tweets);
+    }
+    return true;
+}
+
+// What the sink needs to know about each row besides its encoding.
+struct RowKeys {
+    vector<int> ids;
+    vector<int> labels;
+
+    explicit RowKeys(const TweetBatch& tweets) : ids(tweets.ids), labels(tweets.labels) {}
+};
+
+struct CleanedBatch {
+    RowKeys keys;
+    TokenizedBatch batch;
+    // With a dedup cache the clean stage has looked the tokens up already.
+    TokenCache tokens;
+    bool resolved = false;
+};
+
+struct EncodedBatch {
+    RowKeys keys;
+    SparseEncodings encodings;
+};
+
+void record_peak_rss(StreamingStats& stats) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        stats.peak_rss_kb = usage.ru_maxrss;
+    }
+}
+
+// Load -> clean -> encode on three threads; sink(EncodedBatch&) runs on the
+// calling thread for every batch, in input order.
+template <typename Sink>
+void run_stages(const string& input_path, TextPreprocessor& preprocessor,
+                ParallelEncoder& encoder, const StreamingOptions& options,
+                StreamingStats& stats, Sink&& sink) {
+    if (encoder.get_vocab_size() == 0) {
+        throw runtime_error("Streaming pipeline needs a vocabulary or feature hashing");
+    }
+
+    if (options.counter && options.dedup_bytes > 0) {
+        throw invalid_argument("Token counting needs the cleaned batches; turn dedup off");
+    }
+    CsvReader reader(input_path, options.schema.has_header,
+                     options.begin_at_record ? 0 : options.byte_begin, options.byte_end);
+    if (options.begin_at_record) reader.seek(options.byte_begin);
+    TweetProjector projector(options.schema, reader.header());
+
+    unique_ptr<DedupCache> cache;
+    if (options.dedup_bytes > 0) cache = make_unique<DedupCache>(options.dedup_bytes);
+
+    // Batches cycle back to the stage that fills them, so arenas are reused
+    // rather than allocated per batch. Up to queue_depth wait in a queue, one
+    // is being filled and one drained.
+    BatchPool<TweetBatch> raw_batches(options.queue_depth + 2);
+    BatchPool<TokenizedBatch> clean_batches(options.queue_depth + 2);
+
+    BoundedQueue<TweetBatch> loaded(options.queue_depth);
+    BoundedQueue<CleanedBatch> cleaned(options.queue_depth);
+    BoundedQueue<EncodedBatch> encoded(options.queue_depth);
+
+    exception_ptr failure;
+    mutex failure_mutex;
+    auto fail = [&](exception_ptr error) {
+        {
+            lock_guard<mutex> lock(failure_mutex);
+            if (!failure) failure = error;
+        }
+        loaded.close();
+        cleaned.close();
+        encoded.close();
+    };
+
+    thread load_stage([&] {
+        try {
+            int record_number = options.first_record;
+            vector<string_view> records;
+            records.reserve(options.batch_size);
+            while (true) {
+                TweetBatch tweets = raw_batches.acquire();
+                if (!read_batch(reader, projector, options.batch_size, record_number, records,
+                                tweets)) break;
+                if (!loaded.push(move(tweets))) break;
+                reader.release_consumed();
+            }
+            stats.records = record_number - options.first_record;
+            stats.end_offset = reader.offset();
+            loaded.close();
+        } catch (...) {
+            fail(current_exception());
+        }
+    });
+
+    thread clean_stage([&] {
+        try {
+            // Only the batches travel down the queue; the cleaner's working
+            // space stays with this thread.
+            CleanWorkspace workspace;
+            while (auto tweets = loaded.pop()) {
+                // Cleaning and tokenizing share one pass; the encoder only
+                // looks the token spans up. Deduplicated batches come with
+                // their token ids, since the cache holds those too.
+                CleanedBatch batch{RowKeys(*tweets), clean_batches.acquire(), {}};
+                if (cache) {
+                    batch.tokens = cache->resolve(*tweets, preprocessor, encoder).token_cache();
+                    batch.resolved = true;
+                } else {
+                    preprocessor.preprocess_tokenized(*tweets, batch.batch, workspace);
+                    if (options.counter) {
+                        count_tokens(batch.batch, *options.counter, preprocessor.executor(), Stage::CLEAN);
+                    }
+                }
+                raw_batches.release(move(*tweets));
+                if (!cleaned.push(move(batch))) break;
+            }
+            cleaned.close();
+        } catch (...) {
+            fail(current_exception());
+        }
+    });
+
+    thread encode_stage([&] {
+        try {
+            while (auto batch = cleaned.pop()) {
+                EncodedBatch out{move(batch->keys), batch->resolved
+                                                        ? encoder.encode_sparse(batch->tokens)
+                                                        : encoder.encode_sparse(batch->batch)};
+                clean_batches.release(move(batch->batch));
+                if (!encoded.push(move(out))) break;
+            }
+            encoded.close();
+        } catch (...) {
+            fail(current_exception());
+        }
+    });
+
+    try {
+        while (auto batch = encoded.pop()) {
+            sink(*batch);
+            stats.tweets += batch->encodings.rows();
+            stats.batches++;
+        }
+    } catch (...) {
+        fail(current_exception());
+    }
+
+    load_stage.join();
+    clean_stage.join();
+    encode_stage.join();
+    if (failure) rethrow_exception(failure);
+    if (cache) stats.dedup = cache->stats();
+}
+
+} // namespace
+
+StreamingStats run_streaming_pipeline(const string& input_path,
+                                      const string& output_path,
+                                      TextPreprocessor& preprocessor,
+                                      ParallelEncoder& encoder,
+                                      const StreamingOptions& options) {
+    auto start_time = high_resolution_clock::now();
+    StreamingStats stats;
+
+    // Signed hashing yields +1/-1 values, which travel as counts.
+    EmbeddingStreamWriter writer(output_path, options.layout, encoder.get_vocab_size(),
+                                 encoder.vocabulary_hash(), encoder.feature_hashing().signed_hash,
+                                 options.append_output);
+    run_stages(input_path, preprocessor, encoder, options, stats,
+               [&](EncodedBatch& batch) { writer.append(batch.encodings); });
+    writer.finish();
+
+    record_peak_rss(stats);
+    stats.elapsed_ms = duration_cast<milliseconds>(high_resolution_clock::now() - start_time).count();
+    return stats;
+}
+
+StreamingStats run_classification_pipeline(const string& input_path,
+                                           const string& output_path,
+                                           TextPreprocessor& preprocessor,
+                                           ParallelEncoder& encoder,
+                                           const SentimentModel& model,
+                                           const StreamingOptions& options) {
+    if (model.vocab_hash() != 0 && model.vocab_hash() != encoder.vocabulary_hash()) {
+        throw runtime_error("Model was trained against a different vocabulary");
+    }
+
+    auto start_time = high_resolution_clock::now();
+    StreamingStats stats;
+
+    ofstream out(output_path);
+    if (!out) {
+        throw runtime_error("Cannot open file for writing: " + output_path);
+    }
+    out << "id,sentiment,confidence\n";
+
+    vector<float> confidence;
+    run_stages(input_path, preprocessor, encoder, options, stats, [&](EncodedBatch& batch) {
+        vector<int> classes = model.predict(batch.encodings, &confidence);
+        for (size_t i = 0; i < classes.size(); i++) {
+            int sentiment = SentimentModel::class_to_sentiment(classes[i]);
+            if (sentiment == batch.keys.labels[i]) stats.correct++;
+            out << batch.keys.ids[i] << "," << sentiment << "," << confidence[i] << "\n";
+        }
+        if (!out) {
+            throw runtime_error("Failed writing predictions: " + output_path);
+        }
+    });
+
+    record_peak_rss(stats);
+    stats.elapsed_ms = duration_cast<milliseconds>(high_resolution_clock::now() - start_time).count();
+    return stats;
+}
+
+StreamingStats run_ring_pipeline(const string& input_path,
+                                 const string& ring_name,
+                                 size_t ring_bytes,
+                                 TextPreprocessor& preprocessor,
+                                 ParallelEncoder& encoder,
+                                 const StreamingOptions& options) {
+    auto start_time = high_resolution_clock::now();
+    StreamingStats stats;
+
+    ShmRingWriter ring(ring_name, ring_bytes, encoder.get_vocab_size(), encoder.vocabulary_hash());
+    vector<int> classes;
+    run_stages(input_path, preprocessor, encoder, options, stats, [&](EncodedBatch& batch) {
+        classes.resize(batch.keys.labels.size());
+        for (size_t i = 0; i < classes.size(); i++) {
+            classes[i] = SentimentModel::sentiment_to_class(batch.keys.labels[i]);
+        }
+        ring.append(batch.encodings, classes, batch.keys.ids);
+    });
+    ring.finish();
+
+    record_peak_rss(stats);
+    stats.elapsed_ms = duration_cast<milliseconds>(high_resolution_clock::now() - start_time).count();
+    return stats;
+}
+
+TweetBatch load_tweet_sample(const string& filename, const TweetSchema& schema,
+                             size_t max_tweets) {
+    CsvReader reader(filename, schema.has_header);
+    TweetProjector projector(schema, reader.header());
+
+    int record_number = 0;
+    vector<string_view> records;
+    TweetBatch tweets;
+    read_batch(reader, projector, max_tweets, record_number, records, tweets);
+    return tweets;
+}
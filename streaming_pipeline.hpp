@@ -0,0 +1,83 @@
+#pragma once
+#include "preprocessor.hpp"
+#include "parallel_encoder.hpp"
+#include "csv_loader.hpp"
+#include "embedding_io.hpp"
+#include "inference_engine.hpp"
+#include "dedup_cache.hpp"
+#include "token_counter.hpp"
+
+using namespace std;
+
+struct StreamingOptions {
+    size_t batch_size = 4096;   // tweets per batch
+    size_t queue_depth = 4;     // batches buffered between two stages
+    EmbeddingLayout layout = EmbeddingLayout::SPARSE_CSR;
+    TweetSchema schema;
+    // Cache cleaned texts and token ids of up to this many bytes so that
+    // repeated texts are processed once (0 turns deduplication off).
+    size_t dedup_bytes = 0;
+    // Only records starting in this byte range of the input (see CsvReader).
+    size_t byte_begin = 0;
+    size_t byte_end = SIZE_MAX;
+    // byte_begin is a known record start (a CsvReader::offset() saved by an
+    // earlier run), so it is not searched for.
+    bool begin_at_record = false;
+    // Record numbers, the ids of tweets without an id column, continue
+    // from here.
+    int first_record = 0;
+    // When set, the clean stage also counts every token into it (see
+    // count_tokens), with the clean stage's threads; needs dedup_bytes == 0.
+    ShardedTokenCounter* counter = nullptr;
+    // Add the rows to an existing output file of the same shape instead of
+    // replacing it (see EmbeddingStreamWriter).
+    bool append_output = false;
+};
+
+struct StreamingStats {
+    size_t records = 0;     // records read, including ones without all columns
+    size_t end_offset = 0;  // input offset after the last record read
+    size_t tweets = 0;
+    size_t batches = 0;
+    long elapsed_ms = 0;
+    long peak_rss_kb = 0;
+    size_t correct = 0;  // classification: predictions equal to the label column
+    DedupStats dedup;
+};
+
+// Load -> clean -> encode -> write as four concurrent stages joined by
+// bounded queues. At most queue_depth batches wait between two stages, so
+// peak memory follows batch_size rather than the input size. The encoder
+// must already hold a vocabulary.
+StreamingStats run_streaming_pipeline(const string& input_path,
+                                      const string& output_path,
+                                      TextPreprocessor& preprocessor,
+                                      ParallelEncoder& encoder,
+                                      const StreamingOptions& options = StreamingOptions());
+
+// Same load -> clean -> encode stages, but the last stage scores every batch
+// with model and writes "id,sentiment,confidence" lines to output_path
+// instead of embeddings. Throws if the model was trained against another
+// vocabulary than the encoder holds.
+StreamingStats run_classification_pipeline(const string& input_path,
+                                           const string& output_path,
+                                           TextPreprocessor& preprocessor,
+                                           ParallelEncoder& encoder,
+                                           const SentimentModel& model,
+                                           const StreamingOptions& options = StreamingOptions());
+
+// Same load -> clean -> encode stages, but the last stage publishes every
+// batch (CSR rows, model classes and ids) into a shared-memory ring named
+// ring_name with ring_bytes of room (see shm_ring.hpp) for a trainer to
+// consume as it arrives. Returns once the reader has drained the ring.
+StreamingStats run_ring_pipeline(const string& input_path,
+                                 const string& ring_name,
+                                 size_t ring_bytes,
+                                 TextPreprocessor& preprocessor,
+                                 ParallelEncoder& encoder,
+                                 const StreamingOptions& options = StreamingOptions());
+
+// Read only the first max_tweets records, e.g. to build a vocabulary
+// before streaming the rest of a large file.
+TweetBatch load_tweet_sample(const string& filename, const TweetSchema& schema,
+                             size_t max_tweets);
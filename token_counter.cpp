@@ -0,0 +1,281 @@
+#include "token_counter.hpp"
+#include "hash_utils.hpp"
+#include "instrumentation.hpp"
+#include <algorithm>
+#include <omp.h>
+
+namespace {
+
+// Order used for vocabulary selection: more frequent first, then by word.
+template <typename Entry>
+bool ranks_before(const Entry& a, const Entry& b) {
+    if (a.second != b.second) return a.second > b.second;
+    return a.first < b.first;
+}
+
+// Memory per monitored word: the entry, the index node (key view, id and
+// next pointer, plus allocator overhead) and its bucket, the heap slots,
+// and the longest word's heap buffer with its terminator and overhead.
+constexpr size_t SPACE_SAVING_ENTRY_BYTES =
+    sizeof(SpaceSavingCounter::Entry) +
+    (sizeof(string_view) + 2 * sizeof(uint32_t) + 2 * sizeof(void*)) + sizeof(void*) +
+    2 * sizeof(uint32_t) + (SpaceSavingCounter::MAX_WORD_BYTES + 1 + 2 * sizeof(void*));
+
+bool entry_ranks_before(const SpaceSavingCounter::Entry& a, const SpaceSavingCounter::Entry& b) {
+    if (a.count != b.count) return a.count > b.count;
+    return a.word < b.word;
+}
+
+} // namespace
+
+static_assert(ShardedTokenCounter::NUM_SHARDS == 64, "shard_of assumes 64 shards");
+
+ShardedTokenCounter::ShardedTokenCounter(int num_threads)
+    : threads_(max(1, num_threads)) {}
+
+void ShardedTokenCounter::add(int thread, string_view token, uint64_t count, bool stable) {
+    uint64_t hash = hash_bytes(token);
+    auto& tables = threads_[thread];
+    auto& shard = tables.shards[shard_of(hash)];
+
+    auto it = shard.find(HashedKey{token, hash});
+    if (it != shard.end()) {
+        it->second += count;
+        return;
+    }
+    if (!stable) {
+        tables.arena.emplace_back(token);
+        token = tables.arena.back();
+    }
+    shard.emplace(HashedKey{token, hash}, count);
+}
+
+void ShardedTokenCounter::merge() {
+    merged_.assign(NUM_SHARDS, Shard());
+
+    #pragma omp parallel for schedule(dynamic) num_threads(static_cast<int>(threads_.size()))
+    for (size_t s = 0; s < NUM_SHARDS; s++) {
+        Shard& target = merged_[s];
+        size_t largest = 0;
+        for (const auto& tables : threads_) largest = max(largest, tables.shards[s].size());
+        target.reserve(largest);
+
+        for (auto& tables : threads_) {
+            for (const auto& entry : tables.shards[s]) {
+                target[entry.first] += entry.second;
+            }
+            Shard().swap(tables.shards[s]);
+        }
+    }
+}
+
+vector<pair<string, uint64_t>> ShardedTokenCounter::top_k(size_t k) const {
+    using Candidate = pair<string_view, uint64_t>;
+    auto by_rank = [](const Candidate& a, const Candidate& b) { return ranks_before(a, b); };
+
+    // Each shard keeps only its own top k, so the final sort sees at most
+    // NUM_SHARDS * k candidates.
+    vector<vector<Candidate>> shard_top(merged_.size());
+    #pragma omp parallel for schedule(dynamic) num_threads(static_cast<int>(threads_.size()))
+    for (size_t s = 0; s < merged_.size(); s++) {
+        auto& candidates = shard_top[s];
+        candidates.reserve(merged_[s].size());
+        for (const auto& entry : merged_[s]) {
+            candidates.emplace_back(entry.first.text, entry.second);
+        }
+        if (candidates.size() > k) {
+            nth_element(candidates.begin(), candidates.begin() + k, candidates.end(), by_rank);
+            candidates.resize(k);
+        }
+    }
+
+    vector<Candidate> all;
+    for (const auto& candidates : shard_top) {
+        all.insert(all.end(), candidates.begin(), candidates.end());
+    }
+    size_t keep = min(k, all.size());
+    partial_sort(all.begin(), all.begin() + keep, all.end(), by_rank);
+
+    vector<pair<string, uint64_t>> result;
+    result.reserve(keep);
+    for (size_t i = 0; i < keep; i++) {
+        result.emplace_back(string(all[i].first), all[i].second);
+    }
+    return result;
+}
+
+size_t ShardedTokenCounter::distinct() const {
+    size_t count = 0;
+    for (const auto& shard : merged_) count += shard.size();
+    return count;
+}
+
+uint64_t ShardedTokenCounter::total() const {
+    uint64_t count = 0;
+    for (const auto& shard : merged_) {
+        for (const auto& entry : shard) count += entry.second;
+    }
+    return count;
+}
+
+size_t SpaceSavingCounter::capacity_for(size_t bytes) {
+    return max<size_t>(1, bytes / SPACE_SAVING_ENTRY_BYTES);
+}
+
+SpaceSavingCounter::SpaceSavingCounter(size_t capacity)
+    : capacity_(min<size_t>(max<size_t>(1, capacity), UINT32_MAX)) {
+    entries_.reserve(capacity_);
+    index_.reserve(capacity_);
+    heap_.reserve(capacity_);
+    heap_pos_.reserve(capacity_);
+}
+
+void SpaceSavingCounter::add(string_view token, uint64_t count) {
+    total_ += count;
+    if (token.size() > MAX_WORD_BYTES) {
+        long_total_ += count;
+        floor_ = max(floor_, long_total_);
+        return;
+    }
+    auto it = index_.find(token);
+    if (it != index_.end()) {
+        entries_[it->second].count += count;
+        sift_down(heap_pos_[it->second]);
+        return;
+    }
+
+    if (entries_.size() < capacity_) {
+        auto id = static_cast<uint32_t>(entries_.size());
+        entries_.push_back({string(token), count, 0});
+        index_.emplace(entries_.back().word, id);
+        heap_.push_back(id);
+        heap_pos_.push_back(id);
+        sift_up(id);
+        return;
+    }
+
+    // Full: the new word takes over the least frequent slot and its count.
+    uint32_t id = heap_[0];
+    Entry& entry = entries_[id];
+    index_.erase(entry.word);
+    floor_ = max(floor_, entry.count);
+    // A fresh string, so the buffer never outgrows MAX_WORD_BYTES the way
+    // assign() might grow it.
+    entry.word = string(token);
+    entry.error = entry.count;
+    entry.count += count;
+    index_.emplace(entry.word, id);
+    sift_down(0);
+}
+
+void SpaceSavingCounter::merge(const SpaceSavingCounter& other) {
+    vector<Entry> combined;
+    combined.reserve(entries_.size() + other.entries_.size());
+    for (const auto& entry : other.entries_) {
+        if (index_.count(entry.word)) continue;
+        combined.push_back({entry.word, entry.count + floor_, entry.error + floor_});
+    }
+    // This side's words are moved rather than copied, so merging never
+    // holds two copies of the larger summary; index_ is rebuilt below.
+    for (auto& entry : entries_) {
+        auto it = other.index_.find(entry.word);
+        if (it == other.index_.end()) {
+            combined.push_back({move(entry.word), entry.count + other.floor_, entry.error + other.floor_});
+        } else {
+            const Entry& match = other.entries_[it->second];
+            combined.push_back({move(entry.word), entry.count + match.count, entry.error + match.error});
+        }
+    }
+
+    // Words pruned here are no longer monitored, so they bound the floor too.
+    uint64_t floor = floor_ + other.floor_;
+    if (combined.size() > capacity_) {
+        nth_element(combined.begin(), combined.begin() + capacity_, combined.end(), entry_ranks_before);
+        for (size_t i = capacity_; i < combined.size(); i++) floor = max(floor, combined[i].count);
+        combined.resize(capacity_);
+    }
+    total_ += other.total_;
+    long_total_ += other.long_total_;
+    floor_ = floor;
+    rebuild(move(combined));
+}
+
+vector<SpaceSavingCounter::Entry> SpaceSavingCounter::top_k(size_t k) const {
+    vector<Entry> result(entries_.begin(), entries_.end());
+    size_t keep = min(k, result.size());
+    partial_sort(result.begin(), result.begin() + keep, result.end(), entry_ranks_before);
+    result.resize(keep);
+    return result;
+}
+
+vector<SpaceSavingCounter::Entry> SpaceSavingCounter::take_ranked() && {
+    index_ = {};
+    heap_ = {};
+    heap_pos_ = {};
+    vector<Entry> entries = move(entries_);
+    entries_ = {};
+    sort(entries.begin(), entries.end(), entry_ranks_before);
+    return entries;
+}
+
+void SpaceSavingCounter::rebuild(vector<Entry>&& entries) {
+    index_.clear();
+    entries_ = move(entries);
+    entries_.reserve(capacity_);
+    heap_.resize(entries_.size());
+    heap_pos_.resize(entries_.size());
+    for (size_t i = 0; i < entries_.size(); i++) {
+        index_.emplace(entries_[i].word, static_cast<uint32_t>(i));
+        heap_[i] = static_cast<uint32_t>(i);
+        heap_pos_[i] = static_cast<uint32_t>(i);
+    }
+    for (size_t i = heap_.size() / 2; i-- > 0;) sift_down(i);
+}
+
+void SpaceSavingCounter::swap_heap(size_t a, size_t b) {
+    swap(heap_[a], heap_[b]);
+    heap_pos_[heap_[a]] = static_cast<uint32_t>(a);
+    heap_pos_[heap_[b]] = static_cast<uint32_t>(b);
+}
+
+void SpaceSavingCounter::sift_down(size_t at) {
+    while (true) {
+        size_t smallest = at;
+        for (size_t child = 2 * at + 1; child <= 2 * at + 2 && child < heap_.size(); child++) {
+            if (entries_[heap_[child]].count < entries_[heap_[smallest]].count) smallest = child;
+        }
+        if (smallest == at) return;
+        swap_heap(at, smallest);
+        at = smallest;
+    }
+}
+
+void SpaceSavingCounter::sift_up(size_t at) {
+    while (at > 0) {
+        size_t parent = (at - 1) / 2;
+        if (entries_[heap_[parent]].count <= entries_[heap_[at]].count) return;
+        swap_heap(at, parent);
+        at = parent;
+    }
+}
+
+void count_tokens(const TokenizedBatch& batch, ShardedTokenCounter& counter,
+                  const Executor& executor, Stage stage) {
+    TRACE_SCOPE("count_tokens");
+    RowTasks tasks = executor.plan(stage, batch.rows(), [&](size_t i) {
+        return batch.span_offsets[i + 1] - batch.span_offsets[i];
+    });
+    #pragma omp parallel num_threads(tasks.threads)
+    {
+        int tid = omp_get_thread_num();
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t t = 0; t < tasks.size(); t++) {
+            for (size_t i = tasks.begin(t); i < tasks.end(t); i++) {
+                size_t num_tokens = batch.span_offsets[i + 1] - batch.span_offsets[i];
+                for (size_t k = 0; k < num_tokens; k++) {
+                    counter.add(tid, batch.token(i, k), 1, false);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include "tokenizer.hpp"
+#include "executor.hpp"
+#include "hash_utils.hpp"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Token frequency table for vocabulary building.
+//
+// Every thread counts into its own set of hash-partitioned shards, so
+// counting takes no locks. merge() then combines shard s of all threads as
+// one parallel task per shard, and top_k() selects per shard before a final
+// small sort. Ties are broken by word, so the result does not depend on the
+// number of threads or on hash table iteration order.
+class ShardedTokenCounter {
+public:
+    static constexpr size_t NUM_SHARDS = 64;
+
+    explicit ShardedTokenCounter(int num_threads);
+
+    // Count token from thread `thread`. Stable tokens are kept as views and
+    // must outlive the counter; others are copied into the thread's arena.
+    void add(int thread, string_view token, uint64_t count = 1, bool stable = true);
+    void merge();
+
+    // The k most frequent words by (count desc, word asc). Needs merge().
+    vector<pair<string, uint64_t>> top_k(size_t k) const;
+    size_t distinct() const;
+    uint64_t total() const;
+
+private:
+    struct HashedKey {
+        string_view text;
+        uint64_t hash;
+        bool operator==(const HashedKey& other) const { return text == other.text; }
+    };
+    struct KeyHash {
+        size_t operator()(const HashedKey& key) const { return key.hash; }
+    };
+    using Shard = unordered_map<HashedKey, uint64_t, KeyHash>;
+
+    struct ThreadTables {
+        vector<Shard> shards = vector<Shard>(NUM_SHARDS);
+        deque<string> arena;
+    };
+
+    static size_t shard_of(uint64_t hash) { return hash >> 58; }
+
+    vector<ThreadTables> threads_;
+    vector<Shard> merged_;
+};
+
+// Bounded-memory heavy hitters (Space-Saving, Metwally et al.) for
+// vocabularies over corpora whose long tail of typos, handles and hashtags
+// does not fit in memory. At most capacity words are monitored; when a new
+// word arrives with the table full it takes over the slot of the least
+// frequent one and inherits its count as error. Every estimate is then an
+// upper bound, count - error a lower bound, and any word not monitored
+// occurred at most floor() times. Words longer than MAX_WORD_BYTES are
+// never monitored, which bounds the memory of each monitored one; their
+// total count is folded into floor() instead. Otherwise floor() <=
+// total() / capacity.
+//
+// Summaries are mergeable (Agarwal et al.): a word missing from one side is
+// charged that side's floor, so per-thread summaries combine into one with
+// the same guarantees over the union of their streams.
+class SpaceSavingCounter {
+public:
+    struct Entry {
+        string word;
+        uint64_t count;  // upper bound on the true count
+        uint64_t error;  // true count >= count - error
+    };
+
+    static constexpr size_t MAX_WORD_BYTES = 64;
+
+    // Monitored words a memory budget affords, at least one.
+    static size_t capacity_for(size_t bytes);
+
+    explicit SpaceSavingCounter(size_t capacity);
+    SpaceSavingCounter(const SpaceSavingCounter&) = delete;
+    SpaceSavingCounter& operator=(const SpaceSavingCounter&) = delete;
+    SpaceSavingCounter(SpaceSavingCounter&&) = default;
+    SpaceSavingCounter& operator=(SpaceSavingCounter&&) = default;
+
+    void add(string_view token, uint64_t count = 1);
+    // Fold other into this summary, keeping this one's capacity.
+    void merge(const SpaceSavingCounter& other);
+
+    // The k words with the highest estimates, by (count desc, word asc).
+    vector<Entry> top_k(size_t k) const;
+    // All monitored words ranked like top_k, moved out rather than copied;
+    // the counter is left empty.
+    vector<Entry> take_ranked() &&;
+    size_t size() const { return entries_.size(); }
+    size_t capacity() const { return capacity_; }
+    uint64_t total() const { return total_; }
+    // Upper bound on the count of any word that is not monitored.
+    uint64_t floor() const { return floor_; }
+
+private:
+    struct KeyHash {
+        size_t operator()(string_view key) const { return hash_bytes(key); }
+    };
+
+    void sift_down(size_t at);
+    void sift_up(size_t at);
+    void swap_heap(size_t a, size_t b);
+    void rebuild(vector<Entry>&& entries);
+
+    size_t capacity_;
+    uint64_t total_ = 0;
+    uint64_t long_total_ = 0;  // tokens too long to monitor
+    uint64_t floor_ = 0;
+    vector<Entry> entries_;  // reserved to capacity_, so word data stays put
+    unordered_map<string_view, uint32_t, KeyHash> index_;  // word -> entry
+    vector<uint32_t> heap_;  // min-heap of entries by count
+    vector<uint32_t> heap_pos_;
+};
+
+// Count every token of a cleaned batch, copying the ones counter has not
+// seen, so the batch may be recycled afterwards. Runs with the threads of
+// stage: the streaming pipeline counts on its clean thread, in CLEAN's
+// share of the budget. counter needs at least executor.threads_for(stage)
+// threads.
+void count_tokens(const TokenizedBatch& batch, ShardedTokenCounter& counter,
+                  const Executor& executor, Stage stage = Stage::COUNT);
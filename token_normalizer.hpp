@@ -0,0 +1,266 @@
+#pragma once
+#include "tokenizer.hpp"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Optional token normalization between tokenizing and vocabulary lookup:
+// stop words are dropped and the remaining words lightly stemmed, so
+// "the"/"and" no longer take vocabulary columns and "runs"/"running"
+// share one. Both steps only ever drop a token or shorten it to a prefix
+// of itself. Tokenized text keeps its bytes and only the spans change;
+// plain text loses just those token bytes (see normalize_text), so both
+// yield the same tokens.
+struct TokenNormalization {
+    bool stop_words = false;
+    bool stem = false;
+
+    bool enabled() const { return stop_words || stem; }
+};
+
+namespace stop_words {
+
+// English function words, as the tokenizer splits them ("don't" is "don",
+// "t"). Negations (no, nor, not, don, t) are kept out on purpose: they
+// carry sentiment.
+constexpr string_view WORDS[] = {
+    "i", "me", "my", "myself", "we", "our", "ours", "ourselves", "you", "your", "yours",
+    "yourself", "yourselves", "he", "him", "his", "himself", "she", "her", "hers", "herself",
+    "it", "its", "itself", "they", "them", "their", "theirs", "themselves", "what", "which",
+    "who", "whom", "this", "that", "these", "those", "am", "is", "are", "was", "were", "be",
+    "been", "being", "have", "has", "had", "having", "do", "does", "did", "doing", "a", "an",
+    "the", "and", "but", "if", "or", "because", "as", "until", "while", "of", "at", "by",
+    "for", "with", "about", "against", "between", "into", "through", "during", "before",
+    "after", "above", "below", "to", "from", "up", "down", "in", "out", "on", "off", "over",
+    "under", "again", "further", "then", "once", "here", "there", "when", "where", "why",
+    "how", "all", "any", "both", "each", "few", "more", "most", "other", "some", "such",
+    "only", "own", "same", "so", "than", "too", "very", "s", "can", "will", "just", "should",
+    "now"};
+constexpr size_t COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+constexpr size_t MAX_LENGTH = 10;  // "themselves", "yourselves"
+
+// Perfect hash by hash-and-displace: a word's hash picks a bucket, and the
+// bucket's displacement, chosen when the table is built, sends every word
+// of the bucket to a slot no other word uses. The table is computed by the
+// compiler, so a lookup is one hash, two array reads and one compare, with
+// nothing to construct at run time.
+constexpr size_t BUCKETS = 64;
+constexpr size_t SLOTS = 256;
+constexpr uint8_t EMPTY = 0xFF;
+static_assert(COUNT < EMPTY, "slot entries are uint8_t word indices");
+
+constexpr uint64_t hash_word(string_view word) {
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+    for (char c : word) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+constexpr size_t slot_of(uint64_t hash, uint32_t displacement) {
+    uint64_t h = hash + displacement * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h % SLOTS;
+}
+
+struct Table {
+    array<uint32_t, BUCKETS> displacement{};
+    array<uint8_t, SLOTS> word{};
+    bool complete = false;
+};
+
+constexpr Table build_table() {
+    Table table;
+    for (auto& slot : table.word) slot = EMPTY;
+
+    // Place the fullest buckets first, while most slots are free.
+    array<size_t, BUCKETS> sizes{};
+    for (size_t w = 0; w < COUNT; w++) sizes[hash_word(WORDS[w]) % BUCKETS]++;
+    array<size_t, BUCKETS> order{};
+    for (size_t b = 0; b < BUCKETS; b++) order[b] = b;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        for (size_t j = i + 1; j < BUCKETS; j++) {
+            if (sizes[order[j]] > sizes[order[i]]) {
+                size_t t = order[i];
+                order[i] = order[j];
+                order[j] = t;
+            }
+        }
+    }
+
+    for (size_t b : order) {
+        if (sizes[b] == 0) continue;
+        bool placed = false;
+        for (uint32_t d = 0; d < 100000 && !placed; d++) {
+            array<size_t, COUNT> slots{};
+            size_t n = 0;
+            bool fits = true;
+            for (size_t w = 0; w < COUNT && fits; w++) {
+                uint64_t h = hash_word(WORDS[w]);
+                if (h % BUCKETS != b) continue;
+                size_t slot = slot_of(h, d);
+                if (table.word[slot] != EMPTY) fits = false;
+                for (size_t k = 0; k < n && fits; k++) fits = slots[k] != slot;
+                slots[n++] = slot;
+            }
+            if (!fits) continue;
+            n = 0;
+            for (size_t w = 0; w < COUNT; w++) {
+                if (hash_word(WORDS[w]) % BUCKETS == b) table.word[slots[n++]] = static_cast<uint8_t>(w);
+            }
+            table.displacement[b] = d;
+            placed = true;
+        }
+        if (!placed) return table;
+    }
+    table.complete = true;
+    return table;
+}
+
+constexpr Table TABLE = build_table();
+static_assert(TABLE.complete, "no displacement separates the stop words; grow SLOTS");
+
+constexpr bool contains(string_view token) {
+    if (token.empty() || token.size() > MAX_LENGTH) return false;
+    uint64_t h = hash_word(token);
+    uint8_t word = TABLE.word[slot_of(h, TABLE.displacement[h % BUCKETS])];
+    return word != EMPTY && WORDS[word] == token;
+}
+
+static_assert(contains("the") && contains("themselves") && contains("i"), "stop word lookup");
+static_assert(!contains("not") && !contains("cat") && !contains("thee"), "stop word lookup");
+
+} // namespace stop_words
+
+namespace light_stemmer {
+
+inline bool is_vowel(string_view word, size_t i) {
+    switch (word[i]) {
+    case 'a': case 'e': case 'i': case 'o': case 'u': return true;
+    case 'y': return i > 0 && !is_vowel(word, i - 1);
+    default: return false;
+    }
+}
+
+inline bool has_vowel(string_view stem) {
+    for (size_t i = 0; i < stem.size(); i++) {
+        if (is_vowel(stem, i)) return true;
+    }
+    return false;
+}
+
+// Porter's measure: the number of vowel-consonant sequences in stem.
+inline size_t measure(string_view stem) {
+    size_t m = 0;
+    bool vowel = false;
+    for (size_t i = 0; i < stem.size(); i++) {
+        bool v = is_vowel(stem, i);
+        if (vowel && !v) m++;
+        vowel = v;
+    }
+    return m;
+}
+
+inline bool ends_with(string_view word, size_t n, string_view suffix) {
+    return n >= suffix.size() && word.substr(n - suffix.size(), suffix.size()) == suffix;
+}
+
+} // namespace light_stemmer
+
+// Length of the stem of a lowercase ASCII word: steps 1a and 1b of the
+// Porter stemmer, minus the rewrites that would not leave a prefix
+// ("-ies" becomes "-i", and no "e" is put back after "-ed"/"-ing").
+// Plural "s" stays after "s", "u" and "i" ("class", "bus", "this").
+// Words of three letters or less, and ones with digits or non-ASCII
+// bytes, are left alone. Irregular forms ("ran") are not related.
+inline size_t light_stem_length(string_view word) {
+    using namespace light_stemmer;
+    size_t n = word.size();
+    if (n <= 3) return n;
+    for (char c : word) {
+        if (c < 'a' || c > 'z') return n;
+    }
+
+    if (ends_with(word, n, "sses")) {
+        n -= 2;
+    } else if (ends_with(word, n, "ies")) {
+        n -= 2;
+    } else if (word[n - 1] == 's' && word[n - 2] != 's' && word[n - 2] != 'u' && word[n - 2] != 'i') {
+        n -= 1;
+    }
+
+    size_t stem = n;
+    if (ends_with(word, n, "eed")) {
+        if (measure(word.substr(0, n - 3)) > 0) n -= 1;
+        return n;
+    } else if (ends_with(word, n, "ed") && has_vowel(word.substr(0, n - 2))) {
+        stem = n - 2;
+    } else if (ends_with(word, n, "ing") && has_vowel(word.substr(0, n - 3))) {
+        stem = n - 3;
+    } else {
+        return n;
+    }
+    // "running" -> "runn" -> "run"
+    char last = word[stem - 1];
+    if (stem >= 2 && last == word[stem - 2] && !is_vowel(word, stem - 1) && last != 'l' &&
+        last != 's' && last != 'z') {
+        stem--;
+    }
+    return stem;
+}
+
+// New length of token under normalization, 0 if it is dropped.
+inline size_t normalize_token(string_view token, const TokenNormalization& normalization) {
+    if (normalization.stop_words && stop_words::contains(token)) return 0;
+    return normalization.stem ? light_stem_length(token) : token.size();
+}
+
+// Normalize spans[first ..] of text in place, dropping removed tokens.
+inline void normalize_spans(string_view text, vector<TokenSpan>& spans, size_t first,
+                            const TokenNormalization& normalization) {
+    size_t kept = first;
+    for (size_t k = first; k < spans.size(); k++) {
+        TokenSpan span = spans[k];
+        size_t length = normalize_token(text.substr(span.offset, span.length), normalization);
+        if (length == 0) continue;
+        span.length = static_cast<uint32_t>(length);
+        spans[kept++] = span;
+    }
+    spans.resize(kept);
+}
+
+// Normalize the tokens of text in place (the result is never longer):
+// stemmed tokens lose their suffix, dropped ones go together with one
+// space beside them, and every other byte is kept, so the text tokenizes
+// to what normalize_spans leaves. Returns the new length.
+inline size_t normalize_text(string& text, const TokenNormalization& normalization) {
+    size_t n = 0, copied = 0;  // text[copied ..] is still to be moved to text[n ..]
+    auto keep = [&](size_t end) {
+        memmove(&text[n], &text[copied], end - copied);
+        n += end - copied;
+    };
+    Tokenizer::for_each_span(text, [&](size_t offset, size_t length) {
+        size_t kept = normalize_token(string_view(text).substr(offset, length), normalization);
+        size_t end = offset + length;
+        if (kept > 0) {
+            keep(offset + kept);
+        } else if (offset > copied && text[offset - 1] == ' ') {
+            keep(offset - 1);
+        } else {
+            keep(offset);
+            if (end < text.size() && text[end] == ' ') end++;
+        }
+        copied = end;
+    });
+    keep(text.size());
+    text.resize(n);
+    return n;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Position of one token inside a text.
+struct TokenSpan {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Cleaned texts of a batch together with the token spans inside each of
+// them, both stored by column. Row i's text is arena[text_offsets[i] ..
+// text_offsets[i + 1]) and it owns spans[span_offsets[i] ..
+// span_offsets[i + 1]), relative to the start of its text.
+struct TokenizedBatch {
+    vector<uint64_t> text_offsets{0};
+    vector<char> arena;
+    vector<uint64_t> span_offsets{0};
+    vector<TokenSpan> spans;
+
+    size_t rows() const { return text_offsets.size() - 1; }
+    string_view text(size_t row) const {
+        return string_view(arena.data() + text_offsets[row], text_offsets[row + 1] - text_offsets[row]);
+    }
+    string_view token(size_t row, size_t k) const {
+        const TokenSpan& span = spans[span_offsets[row] + k];
+        return string_view(arena.data() + text_offsets[row] + span.offset, span.length);
+    }
+    // Keeps the capacity for the next batch.
+    void clear() {
+        text_offsets.assign(1, 0);
+        arena.clear();
+        span_offsets.assign(1, 0);
+        spans.clear();
+    }
+};
+
+// Word tokenizer used for vocabulary building and encoding: a token is a
+// maximal run of [A-Za-z0-9] and non-ASCII bytes, lowercased. On ASCII
+// this is what the old tolower + regex("[^a-z0-9 ]") + split pipeline
+// produced, without copying the text or allocating a string per token.
+// Cleaned text only keeps non-ASCII bytes for folded letters and for
+// emoji, which the cleaner sets apart with spaces, so UTF-8 sequences are
+// never split.
+class Tokenizer {
+public:
+    static bool is_token_char(unsigned char c) {
+        return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+               c >= 0x80;
+    }
+
+    // Calls emit(offset, length) for every token of text.
+    template <typename Emit>
+    static void for_each_span(string_view text, Emit&& emit) {
+        size_t n = text.size(), i = 0;
+        while (i < n) {
+            while (i < n && !is_token_char(static_cast<unsigned char>(text[i]))) i++;
+            size_t start = i;
+            while (i < n && is_token_char(static_cast<unsigned char>(text[i]))) i++;
+            if (i > start) emit(start, i - start);
+        }
+    }
+
+    // Calls emit(token) with lowercase string_views. Tokens that are already
+    // lowercase (always the case for clean_text output) point into text;
+    // others are lowercased into scratch, so views only live inside emit.
+    template <typename Emit>
+    static void for_each(string_view text, string& scratch, Emit&& emit) {
+        for_each_span(text, [&](size_t offset, size_t length) {
+            emit(lowercase(text.substr(offset, length), scratch));
+        });
+    }
+
+    // token itself if it has no uppercase letters, else a lowercased copy in
+    // scratch.
+    static string_view lowercase(string_view token, string& scratch) {
+        if (!has_upper(token)) return token;
+        scratch.assign(token.data(), token.size());
+        for (char& c : scratch) {
+            if (c >= 'A' && c <= 'Z') c = static_cast<char>(c + 32);
+        }
+        return scratch;
+    }
+
+    static size_t count(string_view text) {
+        size_t tokens = 0;
+        for_each_span(text, [&](size_t, size_t) { tokens++; });
+        return tokens;
+    }
+
+private:
+    static bool has_upper(string_view token) {
+        for (char c : token) {
+            if (c >= 'A' && c <= 'Z') return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,71 @@
+#include "tweet_batch.hpp"
+#include <cstring>
+#include <stdexcept>
+
+TweetBatch::TweetBatch(const vector<Tweet>& tweets) {
+    size_t bytes = 0;
+    for (const auto& tweet : tweets) bytes += tweet.text.size();
+    reserve(tweets.size(), bytes);
+    for (const auto& tweet : tweets) push_back(tweet.id, tweet.sentiment, tweet.text);
+}
+
+void TweetBatch::push_back(int id, int label, string_view text) {
+    char* out = append(id, label, text.size());
+    if (!text.empty()) memcpy(out, text.data(), text.size());
+}
+
+char* TweetBatch::append(int id, int label, size_t text_size) {
+    ids.push_back(id);
+    labels.push_back(label);
+    size_t start = arena.size();
+    arena.resize(start + text_size);
+    text_offsets.push_back(arena.size());
+    return arena.data() + start;
+}
+
+void TweetBatch::reserve(size_t rows, size_t text_bytes) {
+    ids.reserve(rows);
+    labels.reserve(rows);
+    text_offsets.reserve(rows + 1);
+    arena.reserve(text_bytes);
+}
+
+void TweetBatch::clear() {
+    ids.clear();
+    labels.clear();
+    text_offsets.assign(1, 0);
+    arena.clear();
+}
+
+TweetBatchView TweetBatch::view() const {
+    return TweetBatchView(*this);
+}
+
+TweetBatchView TweetBatch::slice(size_t begin, size_t end) const {
+    return TweetBatchView(*this, begin, end);
+}
+
+TweetBatchView::TweetBatchView(const TweetBatch& batch, size_t begin, size_t end) {
+    if (begin > end || end > batch.size()) {
+        throw out_of_range("Slice [" + to_string(begin) + ", " + to_string(end) +
+                           ") of a batch of " + to_string(batch.size()));
+    }
+    ids_ = batch.ids.data() + begin;
+    labels_ = batch.labels.data() + begin;
+    offsets_ = batch.text_offsets.data() + begin;
+    arena_ = batch.arena.data();
+    size_ = end - begin;
+}
+
+TweetBatchView TweetBatchView::slice(size_t begin, size_t end) const {
+    if (begin > end || end > size_) {
+        throw out_of_range("Slice [" + to_string(begin) + ", " + to_string(end) +
+                           ") of a view of " + to_string(size_));
+    }
+    TweetBatchView view = *this;
+    view.ids_ += begin;
+    view.labels_ += begin;
+    view.offsets_ += begin;
+    view.size_ = end - begin;
+    return view;
+}
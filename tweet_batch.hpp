@@ -0,0 +1,104 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+struct Tweet {
+    int id;
+    string entity;
+    string text;
+    int sentiment;
+};
+
+class TweetBatchView;
+
+// Tweets stored by column: ids and labels in arrays and every text back to
+// back in one arena, so a batch of any size is four allocations rather
+// than one per tweet. Row i's text is arena[text_offsets[i] ..
+// text_offsets[i + 1]). Entities are not kept; nothing downstream of
+// loading reads them. clear() keeps the capacity, so a recycled batch
+// (see BatchPool) refills without allocating once it has grown.
+struct TweetBatch {
+    vector<int> ids;
+    vector<int> labels;
+    vector<uint64_t> text_offsets{0};
+    vector<char> arena;
+
+    TweetBatch() = default;
+    explicit TweetBatch(const vector<Tweet>& tweets);
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+    string_view text(size_t i) const {
+        return string_view(arena.data() + text_offsets[i], text_offsets[i + 1] - text_offsets[i]);
+    }
+
+    void push_back(int id, int label, string_view text);
+    // Add a row with room for text_size bytes of text and return where they
+    // go; the caller fills them before the next append.
+    char* append(int id, int label, size_t text_size);
+    void reserve(size_t rows, size_t text_bytes);
+    void clear();
+
+    TweetBatchView view() const;
+    TweetBatchView slice(size_t begin, size_t end) const;
+};
+
+// Read-only window onto rows [begin, end) of a TweetBatch. Copying or
+// slicing it copies no text; it is valid while the batch is not modified.
+class TweetBatchView {
+public:
+    TweetBatchView() = default;
+    TweetBatchView(const TweetBatch& batch) : TweetBatchView(batch, 0, batch.size()) {}
+    TweetBatchView(const TweetBatch& batch, size_t begin, size_t end);
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    int id(size_t i) const { return ids_[i]; }
+    int label(size_t i) const { return labels_[i]; }
+    string_view text(size_t i) const {
+        return string_view(arena_ + offsets_[i], offsets_[i + 1] - offsets_[i]);
+    }
+    size_t text_bytes() const { return size_ ? offsets_[size_] - offsets_[0] : 0; }
+
+    TweetBatchView slice(size_t begin, size_t end) const;
+
+private:
+    const int* ids_ = nullptr;
+    const int* labels_ = nullptr;
+    const uint64_t* offsets_ = nullptr;  // absolute offsets into arena_
+    const char* arena_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Free list of batches that pipeline stages hand back when they are done
+// with one, so the next batch reuses its arrays instead of allocating.
+// T needs clear(). Holds at most max_free batches; thread-safe.
+template <typename T>
+class BatchPool {
+public:
+    explicit BatchPool(size_t max_free) : max_free_(max_free) {}
+
+    T acquire() {
+        lock_guard<mutex> lock(mutex_);
+        if (free_.empty()) return T();
+        T batch = move(free_.back());
+        free_.pop_back();
+        return batch;
+    }
+
+    void release(T&& batch) {
+        batch.clear();
+        lock_guard<mutex> lock(mutex_);
+        if (free_.size() < max_free_) free_.push_back(move(batch));
+    }
+
+private:
+    mutex mutex_;
+    vector<T> free_;
+    size_t max_free_;
+};
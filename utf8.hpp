@@ -0,0 +1,132 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// Small UTF-8 layer for the cleaner: strict decoding, simple case folding
+// for the scripts that show up in tweets, and a coarse classification of
+// code points into letters, emoji and everything else. Tables are ranges,
+// not full Unicode data; anything unlisted counts as a separator.
+
+enum class CodePointClass { SEPARATOR, LETTER, EMOJI, IGNORABLE };
+
+// Decode one code point starting at s[0]. Returns its length in bytes, or
+// 0 for an invalid sequence (bad lead or continuation byte, truncation,
+// overlong form, surrogate or value past U+10FFFF).
+inline size_t decode_utf8(const char* s, size_t len, uint32_t& cp) {
+    auto byte = [s](size_t i) { return static_cast<unsigned char>(s[i]); };
+    unsigned char c = byte(0);
+    size_t n;
+    uint32_t min;
+    if (c < 0x80) {
+        cp = c;
+        return 1;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        n = 2; cp = c & 0x1F; min = 0x80;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3; cp = c & 0x0F; min = 0x800;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4; cp = c & 0x07; min = 0x10000;
+    } else {
+        return 0;
+    }
+    if (len < n) return 0;
+    for (size_t i = 1; i < n; i++) {
+        if ((byte(i) & 0xC0) != 0x80) return 0;
+        cp = (cp << 6) | (byte(i) & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+    return n;
+}
+
+// Write cp as UTF-8 into out, which needs room for 4 bytes. Returns the length.
+inline size_t encode_utf8(uint32_t cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = static_cast<char>(cp);
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = static_cast<char>(0xC0 | (cp >> 6));
+        out[1] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = static_cast<char>(0xE0 | (cp >> 12));
+        out[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = static_cast<char>(0xF0 | (cp >> 18));
+    out[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Simple (one-to-one) case folding for ASCII, Latin-1, Latin Extended-A,
+// Greek, Cyrillic, Armenian and fullwidth Latin, which folds to ASCII. The
+// folded form is never longer in UTF-8 than the original.
+inline uint32_t fold_case(uint32_t cp) {
+    if (cp < 0x80) return (cp >= 'A' && cp <= 'Z') ? cp + 32 : cp;
+    if (cp < 0x100) return (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) ? cp + 32 : cp;
+    if (cp < 0x180) {
+        if (cp == 0x130) return 'i';
+        if (cp == 0x178) return 0xFF;
+        // Upper/lower pairs: even/odd, except odd/even in two runs
+        bool odd_upper = (cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E);
+        if (cp == 0x138 || cp == 0x149 || cp == 0x17F) return cp;
+        return (cp & 1) == (odd_upper ? 1u : 0u) ? cp + 1 : cp;
+    }
+    if (cp >= 0x370 && cp < 0x400) {
+        if (cp >= 0x391 && cp <= 0x3A9 && cp != 0x3A2) return cp + 32;
+        if (cp == 0x386) return 0x3AC;
+        if (cp >= 0x388 && cp <= 0x38A) return cp + 37;
+        if (cp == 0x38C) return 0x3CC;
+        if (cp == 0x38E || cp == 0x38F) return cp + 63;
+        if (cp == 0x3C2) return 0x3C3;  // final sigma
+        return cp;
+    }
+    if (cp >= 0x400 && cp < 0x500) {
+        if (cp < 0x410) return cp + 80;
+        if (cp < 0x430) return cp + 32;
+        if ((cp >= 0x460 && cp <= 0x481) || (cp >= 0x48A && cp <= 0x4BF)) return cp | 1;
+        return cp;
+    }
+    if (cp >= 0x531 && cp <= 0x556) return cp + 48;
+    if (cp >= 0xFF21 && cp <= 0xFF3A) return cp - 0xFF21 + 'a';
+    if (cp >= 0xFF41 && cp <= 0xFF5A) return cp - 0xFF41 + 'a';
+    if (cp >= 0xFF10 && cp <= 0xFF19) return cp - 0xFF10 + '0';
+    return cp;
+}
+
+inline CodePointClass classify_code_point(uint32_t cp) {
+    // Variation selectors, joiners, skin tones, keycaps, bidi controls and
+    // tag characters only modify what is around them, so they are dropped
+    // and a modified emoji folds to its base.
+    if ((cp >= 0xFE00 && cp <= 0xFE0F) || (cp >= 0x200B && cp <= 0x200F) ||
+        (cp >= 0x202A && cp <= 0x202E) || (cp >= 0x2060 && cp <= 0x206F) ||
+        (cp >= 0x1F3FB && cp <= 0x1F3FF) || cp == 0x20E3 || cp == 0xFEFF ||
+        (cp >= 0xE0000 && cp <= 0xE007F)) {
+        return CodePointClass::IGNORABLE;
+    }
+    if ((cp >= 0x1F000 && cp <= 0x1FAFF) || (cp >= 0x2600 && cp <= 0x27BF) ||
+        (cp >= 0x2300 && cp <= 0x23FF) || (cp >= 0x2B00 && cp <= 0x2BFF) ||
+        cp == 0x3030 || cp == 0x303D) {
+        return CodePointClass::EMOJI;
+    }
+    if ((cp >= 0xC0 && cp <= 0x24F && cp != 0xD7 && cp != 0xF7) ||
+        (cp >= 0x300 && cp <= 0x36F) ||                       // combining marks
+        (cp >= 0x370 && cp <= 0x3FF && cp != 0x37E && cp != 0x387) ||
+        (cp >= 0x400 && cp <= 0x52F) || (cp >= 0x531 && cp <= 0x587) ||
+        (cp >= 0x5D0 && cp <= 0x5EA) || (cp >= 0x620 && cp <= 0x64A) ||
+        (cp >= 0x900 && cp <= 0xDFF) ||                       // Indic scripts
+        (cp >= 0xE01 && cp <= 0xE3A) ||                       // Thai
+        (cp >= 0x3040 && cp <= 0x30FF) || (cp >= 0x4E00 && cp <= 0x9FFF) ||
+        (cp >= 0xAC00 && cp <= 0xD7A3) ||
+        (cp >= 0xFF10 && cp <= 0xFF19) || (cp >= 0xFF21 && cp <= 0xFF3A) ||
+        (cp >= 0xFF41 && cp <= 0xFF5A)) {
+        return CodePointClass::LETTER;
+    }
+    return CodePointClass::SEPARATOR;
+}